@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <supercan_board.h>
+
+struct sc_autobaud_rate {
+	uint32_t bitrate;
+	uint16_t sp_permille; // sample point
+};
+
+/* candidates of SC_MSG_AUTOBAUD, most common first */
+extern struct sc_autobaud_rate const sc_autobaud_nm_rates[];
+extern uint8_t const sc_autobaud_nm_rate_count;
+extern struct sc_autobaud_rate const sc_autobaud_dt_rates[];
+extern uint8_t const sc_autobaud_dt_rate_count;
+
+/* Computes a bit timing for rate at SC_BOARD_CAN_CLK_HZ within range,
+ * closest to the bitrate, then with the most time quanta.
+ *
+ * return  false if the bitrate can't be met within 0.5%
+ */
+extern bool sc_autobaud_bit_timing(struct sc_autobaud_rate const *rate, sc_can_bit_timing_range const *range, sc_can_bit_timing *bt);
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <supercan_board.h>
+
+/* clear counters and bitrates */
+extern void sc_can_bus_stats_reset(uint8_t index);
+/* called when going on bus or the interval changes, restarts all counters */
+extern void sc_can_bus_stats_enable(uint8_t index, bool on);
+SC_RAMFUNC extern bool sc_can_bus_stats_active(uint8_t index);
+extern void sc_can_bus_stats_nm_bitrate_set(uint8_t index, uint32_t bitrate);
+extern void sc_can_bus_stats_dt_bitrate_set(uint8_t index, uint32_t bitrate);
+/* advance the bus load window to device counter time now_us, CAN task */
+SC_RAMFUNC extern void sc_can_bus_stats_tick(uint8_t index, uint32_t now_us);
+SC_RAMFUNC extern void sc_can_bus_stats_error(uint8_t index);
+/* size of SC_MSG_BUS_STATS, 0 if disabled */
+extern uint8_t sc_can_bus_stats_size(uint8_t index);
+/* place SC_MSG_BUS_STATS, requires sc_can_bus_stats_size bytes, starts the next interval */
+extern void sc_can_bus_stats_place(uint8_t index, uint8_t *tx_ptr, uint32_t now_us, uint32_t timestamp_us);
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <supercan_board.h>
+
+/* clear configuration and ring */
+extern void sc_can_capture_reset(uint8_t index);
+/* store configuration, validated by the caller */
+extern void sc_can_capture_set(uint8_t index, struct sc_msg_capture_set const *msg);
+/* called when going on bus, activates the configuration and clears the ring */
+extern void sc_can_capture_enable(uint8_t index, bool on);
+/* true if configured with SC_CAPTURE_FLAG_ENABLE, also while off bus */
+extern bool sc_can_capture_configured(uint8_t index);
+SC_RAMFUNC extern bool sc_can_capture_active(uint8_t index);
+/* Moves SC_MSG_CAN_RX from the bytes just placed by sc_board_can_retrieve
+ * into the ring and evaluates the frame triggers. Other messages are moved
+ * down to close the gaps.
+ *
+ * return  bytes left at ptr
+ */
+SC_RAMFUNC extern int sc_can_capture_rx(uint8_t index, uint8_t *ptr, int bytes);
+/* non-frame trigger (SC_CAPTURE_TRIGGER_ERROR, SC_CAPTURE_TRIGGER_BUS_STATE), timestamp_us is device time */
+SC_RAMFUNC extern void sc_can_capture_event(uint8_t index, uint8_t trigger, uint32_t timestamp_us);
+/* place SC_MSG_CAPTURE and the frames of the current window
+ *
+ * return  -1 if there is nothing to place, 0 if out of space, else bytes placed
+ */
+SC_RAMFUNC extern int sc_can_capture_place(uint8_t index, uint8_t *tx_ptr, uint8_t *tx_end);
@@ -82,6 +82,16 @@ extern "C" {
 #define SC_MSG_DT_BITTIMING     0x11    ///< Host <-> Device. Configures data bittimings. Device responds with SC_MSG_ERROR
 
 #define SC_MSG_FEATURES         0x13    ///< Host <-> Device. Sets supported device features. Device responds with SC_MSG_ERROR
+#define SC_MSG_FLUSH_POLICY     0x14    ///< Host <-> Device. Configures when buffered device -> host messages are sent. Device responds with SC_MSG_ERROR
+#define SC_MSG_FILTER_SET       0x15    ///< Host <-> Device. Configures a rx message filter element (SC_FEATURE_FLAG_FLT). Device responds with SC_MSG_ERROR
+#define SC_MSG_SW_FILTER_SET    0x16    ///< Host <-> Device. Configures a software rx filter element (SC_FEATURE_FLAG_SWF). Device responds with SC_MSG_ERROR
+#define SC_MSG_GEN_SET          0x17    ///< Host <-> Device. Configures a tx message generator (SC_FEATURE_FLAG_GEN). Device responds with SC_MSG_ERROR
+#define SC_MSG_GEN_DATA         0x18    ///< Host <-> Device. Sets payload bytes of a tx message generator (SC_FEATURE_FLAG_GEN). Device responds with SC_MSG_ERROR
+#define SC_MSG_TIME_SYNC_SET    0x19    ///< Host <-> Device. Configures periodic SC_MSG_TIME_SYNC messages. Device responds with SC_MSG_ERROR
+#define SC_MSG_TXR_MODE         0x1a    ///< Host <-> Device. Selects how transmission receipts are sent. Device responds with SC_MSG_ERROR
+#define SC_MSG_BUS_STATS_SET    0x1b    ///< Host <-> Device. Configures periodic SC_MSG_BUS_STATS messages. Device responds with SC_MSG_ERROR
+#define SC_MSG_CAPTURE_SET      0x1c    ///< Host <-> Device. Configures triggered capture of received frames. Device responds with SC_MSG_ERROR
+#define SC_MSG_AUTOBAUD         0x1d    ///< Host -> Device. Detects the bitrate of the bus in monitoring mode (SC_FEATURE_FLAG_MON_MODE). Device responds with SC_MSG_ERROR, the result follows as SC_MSG_AUTOBAUD_RESULT
 #define SC_MSG_BUS              0x1e    ///< Host <-> Device. Go on / off bus. Device responds with SC_MSG_ERROR
 #define SC_MSG_ERROR            0x1f    ///< Device -> Host. Error code of last command.
 
@@ -93,6 +103,14 @@ extern "C" {
 #define SC_MSG_CAN_TX           0x22    ///< Host -> Device. Send CAN frame.
 #define SC_MSG_CAN_TXR          0x23    ///< Device -> Host. CAN frame transmission receipt.
 #define SC_MSG_CAN_ERROR        0x24    ///< Device -> Host. CAN frame error.
+#define SC_MSG_CAN_RX_COMPACT   0x25    ///< Device -> Host. Received CAN frames, compact form (SC_FEATURE_FLAG_CRX).
+#define SC_MSG_SW_FILTER_STATUS 0x26    ///< Device -> Host. Software rx filter counters (SC_FEATURE_FLAG_SWF).
+#define SC_MSG_TIME_SYNC        0x27    ///< Device -> Host. 64 bit device time at a USB start of frame (SC_MSG_TIME_SYNC_SET).
+#define SC_MSG_CAN_TXR_BATCH    0x28    ///< Device -> Host. CAN frame transmission receipts with timestamps (SC_TXR_MODE_BATCH).
+#define SC_MSG_CAN_TXR_BITMAP   0x29    ///< Device -> Host. CAN frame transmission receipts without timestamps (SC_TXR_MODE_BITMAP).
+#define SC_MSG_BUS_STATS        0x2a    ///< Device -> Host. Bus load and traffic statistics (SC_MSG_BUS_STATS_SET).
+#define SC_MSG_CAPTURE          0x2b    ///< Device -> Host. Start of a captured window of received frames (SC_MSG_CAPTURE_SET).
+#define SC_MSG_AUTOBAUD_RESULT  0x2c    ///< Device -> Host. Bitrate detected by SC_MSG_AUTOBAUD.
 
 
 #define SC_MSG_USER_OFFSET      0x80    ///< Custom device messages
@@ -107,9 +125,11 @@ extern "C" {
 #define SC_FEATURE_FLAG_TXR             0x0010 ///< Device supports CAN frame transmission receipts.
 #define SC_FEATURE_FLAG_GEN             0x0020 ///< Device supports tx message generators
 #define SC_FEATURE_FLAG_TXP             0x0040 ///< Device supports a transmit pause of 2 bit times prior to next frame transmission
+#define SC_FEATURE_FLAG_CRX             0x0080 ///< Device supports compact rx messages (SC_MSG_CAN_RX_COMPACT)
 #define SC_FEATURE_FLAG_MON_MODE        0x0100 ///< Device supports monitoring mode.
 #define SC_FEATURE_FLAG_RES_MODE        0x0200 ///< Device supports restricted mode.
 #define SC_FEATURE_FLAG_EXT_LOOP_MODE   0x0400 ///< Device supports external loopback mode. Transmitted messges are treated as received messages.
+#define SC_FEATURE_FLAG_SWF             0x0800 ///< Device supports software rx message filters with rate decimation
 #define SC_FEATURE_FLAG_USER_OFFSET     0x1000 ///< Custom feature flags
 
 
@@ -119,6 +139,18 @@ extern "C" {
 #define SC_CAN_FRAME_FLAG_BRS         0x08 ///< CAN-FD bitrate switching (set zero to transmit at arbitration rate)
 #define SC_CAN_FRAME_FLAG_ESI         0x10 ///< Set to 1 to transmit with active error state
 #define SC_CAN_FRAME_FLAG_DRP         0x20 ///< CAN frame was dropped due to full tx fifo (only received if TXR feature active)
+#define SC_CAN_FRAME_FLAG_TXQ_MASK    0xc0 ///< Host -> device: tx queue the frame is queued to (see sc_msg_can_info.tx_queue_count)
+#define SC_CAN_FRAME_FLAG_TXQ_SHIFT   6
+
+#define SC_CAN_TX_QUEUE_MAX           (SC_CAN_FRAME_FLAG_TXQ_MASK >> SC_CAN_FRAME_FLAG_TXQ_SHIFT)
+
+#define SC_FILTER_FLAG_EXT            0x01 ///< Filter element matches extended (29 bit id) frames, else standard (11 bit id) frames
+#define SC_FILTER_FLAG_ENABLE         0x02 ///< Filter element is active
+#define SC_FILTER_FLAG_PRIO           0x04 ///< Matching frames take the priority rx lane (see sc_msg_filter_info.prio)
+
+#define SC_GEN_FLAG_ENABLE            0x01 ///< Generator is active
+#define SC_GEN_FLAG_COUNTER           0x02 ///< Payload byte at counter_offset is incremented for every frame sent
+#define SC_GEN_FLAG_CHECKSUM          0x04 ///< Payload byte at checksum_offset is the 8 bit sum of all other payload bytes
 
 #define SC_CAN_STATUS_ERROR_ACTIVE          0x0
 #define SC_CAN_STATUS_ERROR_WARNING         0x1
@@ -148,6 +180,27 @@ extern "C" {
 #define SC_CAN_STATUS_FLAG_TXR_DESYNC       0x1 ///< no USB buffer space to queue TXR message
 #define SC_CAN_STATUS_FLAG_IRQ_QUEUE_FULL   0x2 ///< no space in interrupt -> task queue
 
+#define SC_TIME_SYNC_FLAG_SOF               0x1 ///< timestamp was taken at the start of frame_index, else no frame boundary was seen (e.g. bus suspended)
+
+#define SC_TXR_MODE_SINGLE                  0x0 ///< one SC_MSG_CAN_TXR per frame (default)
+#define SC_TXR_MODE_BATCH                   0x1 ///< consecutive receipts are combined into SC_MSG_CAN_TXR_BATCH
+#define SC_TXR_MODE_BITMAP                  0x2 ///< consecutive receipts are combined into SC_MSG_CAN_TXR_BITMAP
+
+#define SC_BUS_STATS_ID_EXT                 0x80000000 ///< sc_bus_stats_id.can_id is an extended (29 bit) id
+
+#define SC_CAPTURE_FLAG_ENABLE              0x01 ///< capture received frames instead of forwarding them
+#define SC_CAPTURE_FLAG_ONESHOT             0x02 ///< drop received frames after the first window until going on bus again, else re-arm
+#define SC_CAPTURE_FLAG_EXT                 0x04 ///< SC_CAPTURE_TRIGGER_ID matches extended (29 bit) ids
+
+#define SC_CAPTURE_TRIGGER_ID               0x01 ///< received frame with (can_id & can_id_mask) == (sc_msg_capture_set.can_id & can_id_mask)
+#define SC_CAPTURE_TRIGGER_DATA             0x02 ///< received frame with (data[i] & data_mask[i]) == (sc_msg_capture_set.data[i] & data_mask[i]), i < 8
+#define SC_CAPTURE_TRIGGER_ERROR            0x04 ///< bus error, see SC_MSG_CAN_ERROR
+#define SC_CAPTURE_TRIGGER_BUS_STATE        0x08 ///< bus status change, see SC_CAN_STATUS_*
+
+#define SC_AUTOBAUD_FLAG_FD                 0x01 ///< also detect the data bitrate of CAN-FD frames with BRS (SC_FEATURE_FLAG_FDF)
+#define SC_AUTOBAUD_FLAG_NM_FOUND           0x02 ///< SC_MSG_AUTOBAUD_RESULT only, nominal bit timing detected
+#define SC_AUTOBAUD_FLAG_DT_FOUND           0x04 ///< SC_MSG_AUTOBAUD_RESULT only, data bit timing detected
+
 
 
 /**
@@ -182,7 +235,7 @@ struct sc_msg_hello {
     uint8_t proto_version;
     uint8_t byte_order;
     uint16_t cmd_buffer_size; ///< always in network byte order
-    uint16_t unused;
+    uint16_t msg_buffer_size; ///< always in network byte order. Host -> device: requested device -> host message transfer size, 0 for default. Device -> host: size in use.
 } SC_PACKED;
 
 /**
@@ -240,13 +293,104 @@ struct sc_msg_can_info {
     uint8_t dtbt_tseg2_max;
     uint8_t tx_fifo_size;
     uint8_t rx_fifo_size;
-    uint8_t unused[2];
+    uint8_t gen_count;      ///< number of tx message generators (SC_MSG_GEN_SET)
+    uint8_t tx_queue_count; ///< number of tx queues, see SC_CAN_FRAME_FLAG_TXQ_MASK
 } SC_PACKED;
 
+/**
+ * Device reply to a SC_MSG_FILTER_INFO request (struct sc_msg_req).
+ */
 struct sc_msg_filter_info {
     uint8_t id;
     uint8_t len;
-    uint8_t unused0[2];
+    uint8_t std_count;  ///< number of filter elements for standard (11 bit id) frames
+    uint8_t ext_count;  ///< number of filter elements for extended (29 bit id) frames
+    uint8_t sw_count;   ///< number of software filter elements (SC_MSG_SW_FILTER_SET)
+    uint8_t prio;       ///< non-zero if SC_FILTER_FLAG_PRIO is supported
+    uint8_t unused[2];
+} SC_PACKED;
+
+/**
+ * While SC_FEATURE_FLAG_FLT is enabled the device only receives frames
+ * that match at least one active element: (frame id & mask) == (can_id & mask).
+ * Standard and extended elements are indexed separately.
+ * Elements can only be changed off bus and are cleared by SC_MSG_HELLO_DEVICE.
+ *
+ * Frames matching an element with SC_FILTER_FLAG_PRIO are buffered apart
+ * from other frames and sent to the host without waiting for
+ * SC_MSG_FLUSH_POLICY. Both kinds are placed in timestamp order.
+ * Devices without a priority lane treat such elements as regular ones.
+ */
+struct sc_msg_filter_set {
+    uint8_t id;
+    uint8_t len;
+    uint8_t index;      ///< element index, less than std_count respectively ext_count of SC_MSG_FILTER_INFO
+    uint8_t flags;      ///< SC_FILTER_FLAG_*
+    uint32_t can_id;
+    uint32_t mask;      ///< set bits must match
+} SC_PACKED;
+
+/**
+ * Software filter stage, applied after the hardware filters.
+ *
+ * While SC_FEATURE_FLAG_SWF is enabled the device only forwards frames
+ * whose id is in the range [can_id_lo, can_id_hi] of an active element.
+ * The first matching element applies. If interval_us is non-zero, the
+ * element forwards at most one frame per interval, use can_id_lo ==
+ * can_id_hi for per id decimation.
+ * Elements can only be changed off bus and are cleared by SC_MSG_HELLO_DEVICE.
+ */
+struct sc_msg_sw_filter_set {
+    uint8_t id;
+    uint8_t len;
+    uint8_t index;          ///< element index, less than sw_count of SC_MSG_FILTER_INFO
+    uint8_t flags;          ///< SC_FILTER_FLAG_*
+    uint32_t can_id_lo;
+    uint32_t can_id_hi;
+    uint32_t interval_us;   ///< 0 to forward all matching frames
+} SC_PACKED;
+
+/**
+ * Periodic frame sent by the device itself while SC_FEATURE_FLAG_GEN is enabled.
+ *
+ * The first frame is sent phase_us after going on bus, respectively after
+ * the generator was enabled while on bus, then every period_us. Each period
+ * burst frames are sent back to back. Generated frames are reported with
+ * SC_MSG_CAN_TXR using track_id, hosts need to reserve the id.
+ * Generators can be changed on bus and are cleared by SC_MSG_HELLO_DEVICE.
+ *
+ * Generators are scheduled on the 1 ms device tick. Periods below
+ * 1000 us are rejected with SC_ERROR_PARAM, use burst for higher rates.
+ * Due times advance by exactly period_us, so the schedule doesn't drift,
+ * but each frame is queued up to 1 ms late (tick jitter).
+ */
+struct sc_msg_gen_set {
+    uint8_t id;
+    uint8_t len;
+    uint8_t index;          ///< generator index, less than gen_count of SC_MSG_CAN_INFO
+    uint8_t flags;          ///< SC_GEN_FLAG_*
+    uint32_t period_us;     ///< at least 1000
+    uint32_t phase_us;
+    uint16_t count;         ///< number of periods to run, 0 to run until disabled
+    uint8_t burst;          ///< frames per period, non-zero
+    uint8_t track_id;
+    uint8_t counter_offset; ///< payload byte offset, used with SC_GEN_FLAG_COUNTER
+    uint8_t checksum_offset;///< payload byte offset, used with SC_GEN_FLAG_CHECKSUM
+    uint8_t dlc;
+    uint8_t can_flags;      ///< SC_CAN_FRAME_FLAG_*
+    uint32_t can_id;
+} SC_PACKED;
+
+/**
+ * Payload of a tx message generator, may be sent in pieces.
+ * SC_MSG_GEN_SET clears the payload.
+ */
+struct sc_msg_gen_data {
+    uint8_t id;
+    uint8_t len;
+    uint8_t index;          ///< generator index
+    uint8_t offset;         ///< payload byte offset of data
+    uint8_t data[0];
 } SC_PACKED;
 
 struct sc_msg_config {
@@ -263,6 +407,130 @@ struct sc_msg_features {
     uint32_t arg;
 } SC_PACKED;
 
+/**
+ * Device -> host messages are batched until the transfer buffer is filled
+ * to fill_percent or the oldest buffered message is deadline_us old,
+ * whichever comes first. Reset by SC_MSG_HELLO_DEVICE.
+ *
+ * The deadline is kept on the 1 ms device tick. It must be a multiple of
+ * 1000 us, messages go out up to 1 ms after it expires.
+ */
+struct sc_msg_flush_policy {
+    uint8_t id;
+    uint8_t len;
+    uint8_t fill_percent;   ///< 0 to send right away (default), 1-100 to batch
+    uint8_t unused;
+    uint32_t deadline_us;   ///< 1000-1000000 in steps of 1000, required if fill_percent is non-zero
+} SC_PACKED;
+
+/**
+ * While interval_ms is non-zero the device queues SC_MSG_TIME_SYNC along
+ * with the channel's messages when going on the bus and then every
+ * interval_ms.
+ * Reset by SC_MSG_HELLO_DEVICE.
+ */
+struct sc_msg_time_sync_set {
+    uint8_t id;
+    uint8_t len;
+    uint16_t interval_ms;   ///< 0 to disable (default), up to 60000
+} SC_PACKED;
+
+/**
+ * Selects how transmission receipts are sent, one of SC_TXR_MODE_*.
+ * Can only be changed off bus. Reset by SC_MSG_HELLO_DEVICE.
+ */
+struct sc_msg_txr_mode {
+    uint8_t id;
+    uint8_t len;
+    uint8_t mode;
+    uint8_t unused;
+} SC_PACKED;
+
+/**
+ * While interval_ms is non-zero the device counts the frames it receives
+ * and transmits and queues SC_MSG_BUS_STATS every interval_ms.
+ * Reset by SC_MSG_HELLO_DEVICE.
+ */
+struct sc_msg_bus_stats_set {
+    uint8_t id;
+    uint8_t len;
+    uint16_t interval_ms;   ///< 0 to disable (default), up to 60000
+} SC_PACKED;
+
+/**
+ * Triggered capture of received frames.
+ *
+ * While enabled, received frames are recorded into a ring on the device
+ * instead of being sent to the host. When a trigger fires, the device
+ * sends SC_MSG_CAPTURE followed by up to pre frames received before the
+ * trigger, the triggering frame and post frames received after it, all
+ * as SC_MSG_CAN_RX. SC_CAPTURE_TRIGGER_ID and SC_CAPTURE_TRIGGER_DATA
+ * both have to match if both are set. Triggers during a window are
+ * ignored. Frames already sent are not sent again as pre frames of the
+ * next window.
+ *
+ * Can only be changed off bus. Disables SC_MSG_CAN_RX_COMPACT while
+ * enabled. Reset by SC_MSG_HELLO_DEVICE.
+ */
+struct sc_msg_capture_set {
+    uint8_t id;
+    uint8_t len;
+    uint8_t flags;          ///< SC_CAPTURE_FLAG_*
+    uint8_t triggers;       ///< SC_CAPTURE_TRIGGER_*
+    uint16_t pre;           ///< frames before the trigger, < sc_msg_capture.depth
+    uint16_t post;          ///< frames after the trigger
+    uint32_t can_id;
+    uint32_t can_id_mask;
+    uint8_t data[8];
+    uint8_t data_mask[8];
+} SC_PACKED;
+
+/**
+ * Detects the bitrate of the bus.
+ *
+ * The device listens in monitoring mode at each common nominal bitrate
+ * until two frames were received without error (detected), an error
+ * occurred or timeout_ms elapsed. With SC_AUTOBAUD_FLAG_FD the data
+ * bitrates are tried the same way at the detected nominal bitrate.
+ *
+ * Can only be run off bus. The device replies SC_MSG_ERROR right away and
+ * sweeps in the background. Once complete, SC_MSG_AUTOBAUD_RESULT is
+ * queued with the channel's messages. Meanwhile SC_MSG_BUS,
+ * SC_MSG_NM_BITTIMING, SC_MSG_DT_BITTIMING and SC_MSG_AUTOBAUD fail with
+ * SC_ERROR_BUSY, SC_MSG_HELLO_DEVICE aborts the sweep.
+ *
+ * Detected bit timings are configured as if set by SC_MSG_NM_BITTIMING /
+ * SC_MSG_DT_BITTIMING. Bit timings not detected and the features are
+ * restored.
+ */
+struct sc_msg_autobaud {
+    uint8_t id;
+    uint8_t len;
+    uint8_t flags;          ///< SC_AUTOBAUD_FLAG_FD
+    uint8_t unused;
+    uint16_t timeout_ms;    ///< per bitrate, 0 for default (20), up to 100
+    uint16_t unused2;
+} SC_PACKED;
+
+struct sc_msg_autobaud_result {
+    uint8_t id;
+    uint8_t len;
+    uint8_t flags;          ///< SC_AUTOBAUD_FLAG_*
+    uint8_t unused;
+    uint32_t nm_bitrate;    ///< 0 if not detected
+    uint32_t dt_bitrate;    ///< 0 if not detected
+    uint16_t elapsed_ms;
+    uint16_t nmbt_brp;
+    uint16_t nmbt_tseg1;
+    uint8_t nmbt_sjw;
+    uint8_t nmbt_tseg2;
+    uint16_t dtbt_brp;
+    uint16_t dtbt_tseg1;
+    uint8_t dtbt_sjw;
+    uint8_t dtbt_tseg2;
+    uint16_t unused2;
+} SC_PACKED;
+
 struct sc_msg_bittiming {
     uint8_t id;
     uint8_t len;
@@ -283,7 +551,9 @@ struct sc_msg_can_status {
     uint8_t rx_errors;          ///< CAN rx error counter
     uint8_t tx_errors;          ///< CAN tx error counter
     uint8_t rx_fifo_size;       ///< CAN rx fifo fill state
-    uint8_t tx_fifo_size;       ///< CAN tx fifo fill state
+    uint8_t tx_fifo_size;       ///< CAN tx fifo fill state (tx queue 0)
+    uint16_t usb_in_busy;       ///< times all USB IN buffers were in use since last time
+    uint8_t tx_queue_size[2];   ///< fill state of tx queues 1 and up
 } SC_PACKED;
 
 struct sc_msg_can_error {
@@ -304,6 +574,65 @@ struct sc_msg_can_rx {
     uint8_t data[0];
 } SC_PACKED;
 
+/**
+ * Received CAN frames with 11 bit identifiers, compact form (SC_FEATURE_FLAG_CRX).
+ *
+ * Carries count sc_can_rx_compact_frame records back to back, each
+ * directly followed by its data. The data length follows from the dlc,
+ * it is zero for remote requests. The last pad bytes of the message are
+ * unused.
+ *
+ * The timestamp of a record is the difference to the timestamp of the
+ * previous received frame of the channel, be it sent as SC_MSG_CAN_RX
+ * or as a record. The device sends SC_MSG_CAN_RX for the first frame after
+ * going on the bus, for frames with flags other than SC_CAN_FRAME_FLAG_RTR
+ * and whenever the difference doesn't fit in 16 bits.
+ */
+struct sc_msg_can_rx_compact {
+    uint8_t id;
+    uint8_t len;            ///< must be a multiple of 4
+    uint8_t count;          ///< number of records
+    uint8_t pad;            ///< unused bytes at the end of the message
+    uint8_t records[0];
+} SC_PACKED;
+
+#define SC_CAN_RX_COMPACT_ID_MASK       0x07ff
+#define SC_CAN_RX_COMPACT_RTR           0x0800
+#define SC_CAN_RX_COMPACT_DLC_SHIFT     12
+
+struct sc_can_rx_compact_frame {
+    uint16_t id_dlc;        ///< bits 0-10 can id, bit 11 SC_CAN_RX_COMPACT_RTR, bits 12-15 dlc
+    uint16_t timestamp_delta_us;
+    uint8_t data[0];
+} SC_PACKED;
+
+struct sc_sw_filter_counts {
+    uint16_t hits;          ///< frames forwarded
+    uint16_t decimated;     ///< frames dropped due to the element interval
+} SC_PACKED;
+
+/**
+ * Sent along with SC_MSG_CAN_STATUS while SC_FEATURE_FLAG_SWF is enabled.
+ * Counters are since the last message and saturate.
+ */
+struct sc_msg_sw_filter_status {
+    uint8_t id;
+    uint8_t len;
+    uint8_t count;          ///< number of elements
+    uint8_t unused;
+    uint32_t timestamp_us;
+    uint16_t rejected;      ///< frames not matching any element
+    uint16_t unused2;
+    struct sc_sw_filter_counts elements[0];
+} SC_PACKED;
+
+/**
+ * Frames are queued to tx queue (flags & SC_CAN_FRAME_FLAG_TXQ_MASK) >> SC_CAN_FRAME_FLAG_TXQ_SHIFT.
+ * Frames in higher queues don't wait behind frames queued to lower queues.
+ * Frames of queue 0 are transmitted in order, frames of higher queues may
+ * be transmitted in CAN ID priority order. Queues the device doesn't have
+ * map to its highest queue.
+ */
 struct sc_msg_can_tx {
     uint8_t id;
     uint8_t len;            ///< must be a multiple of 4
@@ -322,6 +651,118 @@ struct sc_msg_can_txr {
     uint32_t timestamp_us;
 } SC_PACKED;
 
+struct sc_can_txr_element {
+    uint8_t flags;
+    uint8_t track_id;
+    uint16_t timestamp_delta_us; ///< time since timestamp_us of the message
+} SC_PACKED;
+
+/**
+ * Receipts of consecutive frames, in the order SC_MSG_CAN_TXR messages
+ * would have been sent. The number of elements follows from len.
+ * The device falls back to SC_MSG_CAN_TXR for receipts that don't fit.
+ */
+struct sc_msg_can_txr_batch {
+    uint8_t id;
+    uint8_t len;
+    uint8_t unused[2];
+    uint32_t timestamp_us;  ///< timestamp of the first element
+    struct sc_can_txr_element elements[0];
+} SC_PACKED;
+
+/**
+ * Receipts of consecutive frames without timestamps or frame flags.
+ * A track id appears at most once per message. The device falls back to
+ * SC_MSG_CAN_TXR for track ids beyond 31.
+ */
+struct sc_msg_can_txr_bitmap {
+    uint8_t id;
+    uint8_t len;
+    uint8_t unused[2];
+    uint32_t timestamp_us;  ///< timestamp of the last receipt
+    uint32_t sent;          ///< bit n set: frame with track id n was sent
+    uint32_t dropped;       ///< bit n set: frame with track id n was dropped (SC_CAN_FRAME_FLAG_DRP)
+} SC_PACKED;
+
+struct sc_bus_stats_id {
+    uint32_t can_id;        ///< | SC_BUS_STATS_ID_EXT for extended ids
+    uint32_t count;
+} SC_PACKED;
+
+/**
+ * Traffic of the channel since the previous SC_MSG_BUS_STATS.
+ *
+ * Frames removed by rx filters (SC_MSG_FILTER_SET) are not seen by the
+ * device and not counted. Bus load is computed from frame lengths without
+ * stuff bits. The id elements hold the most frequent ids of the interval
+ * in no particular order. Once more ids were seen than fit, counts may be
+ * too high by up to the smallest count.
+ */
+struct sc_msg_bus_stats {
+    uint8_t id;
+    uint8_t len;
+    uint8_t count;              ///< number of id elements
+    uint8_t unused;
+    uint32_t timestamp_us;
+    uint32_t interval_us;       ///< time covered by the counters
+    uint16_t load_permille;     ///< bus load over the last second
+    uint16_t load_peak_permille;///< highest bus load of a 100 ms slot in the interval
+    uint32_t frames;            ///< frames received and transmitted
+    uint32_t tx;                ///< transmitted frames
+    uint32_t fdf;               ///< CAN-FD frames
+    uint32_t brs;               ///< CAN-FD frames with bitrate switching
+    uint32_t ext;               ///< frames with extended (29 bit) ids
+    uint32_t rtr;               ///< remote request frames
+    uint16_t errors;            ///< bus errors
+    uint16_t unused2;
+    struct sc_bus_stats_id ids[0];
+} SC_PACKED;
+
+/**
+ * Precedes the frames of a captured window.
+ *
+ * pre is the number of SC_MSG_CAN_RX that follow before the trigger. For
+ * SC_CAPTURE_TRIGGER_ID and SC_CAPTURE_TRIGGER_DATA the next one is the
+ * triggering frame. Up to post frames follow after that, fewer if frames
+ * were lost because the ring overflowed.
+ */
+struct sc_msg_capture {
+    uint8_t id;
+    uint8_t len;
+    uint8_t trigger;        ///< SC_CAPTURE_TRIGGER_* that fired
+    uint8_t unused;
+    uint32_t timestamp_us;  ///< time of the trigger
+    uint16_t pre;
+    uint16_t post;
+    uint16_t depth;         ///< capacity of the ring in frames
+    uint16_t lost;          ///< frames overwritten before they were sent since the previous SC_MSG_CAPTURE
+} SC_PACKED;
+
+/**
+ * Device time paired with the USB (micro)frame that started at that time.
+ * The device samples a start of frame about once per second, messages sent
+ * in between repeat the last sample.
+ *
+ * All other device timestamps are the low 32 bits of this time base. As
+ * messages are sent in order, the host extends them to 64 bit by picking
+ * the value closest to the last SC_MSG_TIME_SYNC received. The host
+ * records its own time at the same start of frame to map device time onto
+ * its clock, which also aligns multiple adapters.
+ *
+ * The high bits count wraps of the 32 bit time since the device started,
+ * whether or not the channel is on the bus. The 64 bit time is monotonic.
+ */
+struct sc_msg_time_sync {
+    uint8_t id;
+    uint8_t len;
+    uint8_t flags;          ///< SC_TIME_SYNC_FLAG_*
+    uint8_t unused;
+    uint16_t frame_index;   ///< (USB frame number << 3) | microframe, microframe is 0 at full speed
+    uint16_t unused2;
+    uint32_t timestamp_us;      ///< low 32 bits
+    uint32_t timestamp_us_hi;   ///< high 32 bits
+} SC_PACKED;
+
 enum {
     sc_static_assert_sizeof_sc_msg_header_is_2 = sizeof(int[sizeof(struct sc_msg_header)  == 2 ? 1 : -1]),
     sc_static_assert_sc_msg_req_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_req) & 0x3) == 0 ? 1 : -1]),
@@ -332,9 +773,24 @@ enum {
     sc_static_assert_sc_msg_config_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_config) & 0x3) == 0 ? 1 : -1]),
     sc_static_assert_sc_msg_can_info_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_can_info) & 0x3) == 0 ? 1 : -1]),
     sc_static_assert_sc_msg_features_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_features) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_flush_policy_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_flush_policy) & 0x3) == 0 ? 1 : -1]),
     sc_static_assert_sc_msg_can_txr_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_can_txr) & 0x3) == 0 ? 1 : -1]),
     sc_static_assert_sc_msg_can_status_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_can_status) & 0x3) == 0 ? 1 : -1]),
     sc_static_assert_sc_msg_can_error_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_can_error) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_time_sync_set_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_time_sync_set) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_time_sync_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_time_sync) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_txr_mode_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_txr_mode) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_can_txr_batch_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_can_txr_batch) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_can_txr_element_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_can_txr_element) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_can_txr_bitmap_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_can_txr_bitmap) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_can_rx_compact_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_can_rx_compact) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sizeof_sc_can_rx_compact_frame_is_4 = sizeof(int[sizeof(struct sc_can_rx_compact_frame) == 4 ? 1 : -1]),
+    sc_static_assert_sc_msg_bus_stats_set_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_bus_stats_set) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_bus_stats_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_bus_stats) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_capture_set_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_capture_set) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_capture_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_capture) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_autobaud_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_autobaud) & 0x3) == 0 ? 1 : -1]),
+    sc_static_assert_sc_msg_autobaud_result_is_a_multiple_of_4 = sizeof(int[(sizeof(struct sc_msg_autobaud_result) & 0x3) == 0 ? 1 : -1]),
 };
 
 #ifdef __cplusplus
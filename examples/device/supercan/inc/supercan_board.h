@@ -71,6 +71,14 @@ typedef struct _sc_can_bit_timing_range {
 } sc_can_bit_timing_range;
 
 
+typedef struct _sc_can_filter {
+	uint32_t can_id;
+	uint32_t mask;
+	bool enabled;
+	bool prio; // priority rx lane, only if SC_BOARD_CAN_RX_PRIO
+} sc_can_filter;
+
+
 typedef struct _sc_can_status {
 	volatile uint32_t timestamp_us;
 	volatile uint8_t type;
@@ -111,7 +119,30 @@ extern sc_can_bit_timing_range const* sc_board_can_dt_bit_timing_range(uint8_t i
 extern void sc_board_can_nm_bit_timing_set(uint8_t index, sc_can_bit_timing const *bt);
 extern void sc_board_can_dt_bit_timing_set(uint8_t index, sc_can_bit_timing const *bt);
 extern void sc_board_can_go_bus(uint8_t index, bool on);
-SC_RAMFUNC extern bool sc_board_can_tx_queue(uint8_t index, struct sc_msg_can_tx const * msg);
+/* The board header also defines
+ * sc_board_can_ts_request(index) / sc_board_can_ts_wait(index) to read the 1 MHz device time and
+ * sc_board_usb_frame_index() to read (USB frame number << 3) | microframe.
+ */
+/* store rx filter element, applied when going on bus with SC_FEATURE_FLAG_FLT set
+ *
+ * element < SC_BOARD_CAN_FILTER_STD_COUNT respectively SC_BOARD_CAN_FILTER_EXT_COUNT,
+ * cleared by sc_board_can_reset
+ */
+extern void sc_board_can_filter_set(uint8_t index, bool ext, uint8_t element, sc_can_filter const *filter);
+/* queue tx messages in order
+ *
+ * Stops at the first message that doesn't fit into its tx queue
+ * (SC_CAN_FRAME_FLAG_TXQ_MASK). Callee notifies the controller once for
+ * all queued messages.
+ *
+ * return  number of messages queued
+ */
+SC_RAMFUNC extern uint8_t sc_board_can_tx_queue_n(uint8_t index, struct sc_msg_can_tx const * const *msgs, uint8_t count);
+/* fill rx_fifo_size, tx_fifo_size and tx_queue_size of a status message
+ *
+ * Called from the CAN task.
+ */
+SC_RAMFUNC extern void sc_board_can_status_fill(uint8_t index, struct sc_msg_can_status *msg);
 
 
 extern void sc_board_can_reset(uint8_t index);
@@ -134,10 +165,84 @@ SC_RAMFUNC static inline uint8_t dlc_to_len(uint8_t dlc)
 	return map[dlc & 0xf];
 }
 
+/* maps the board's 1 MHz counter to device time, which is disciplined to USB start of frame (timebase.c) */
+SC_RAMFUNC extern uint32_t sc_timebase_map(uint32_t counter_us);
+
+/* place a received frame into buffer
+ *
+ * Appends a record to the SC_MSG_CAN_RX_COMPACT message placed last
+ * if compact is set and the frame allows it, else places a new
+ * SC_MSG_CAN_RX_COMPACT or SC_MSG_CAN_RX. The caller copies data_len bytes
+ * of payload to *data. timestamp_us is the board counter value, placed as
+ * device time.
+ *
+ * return  number of bytes the buffer grew by, 0 if insufficient space in buffer
+ */
+SC_RAMFUNC extern uint8_t sc_can_rx_msg_place(
+	uint8_t index,
+	bool compact,
+	uint8_t *tx_ptr,
+	uint8_t *tx_end,
+	uint32_t can_id,
+	uint8_t dlc,
+	uint8_t flags,
+	uint32_t timestamp_us,
+	uint8_t data_len,
+	uint8_t **data);
+
+SC_RAMFUNC static inline bool sc_board_can_tx_queue(uint8_t index, struct sc_msg_can_tx const * msg)
+{
+	return 1 == sc_board_can_tx_queue_n(index, &msg, 1);
+}
+
+/* wake the CAN task if count (number of queued events) is non-zero
+ *
+ * Notifications coalesce, call once after queuing all events of an interrupt.
+ */
 SC_RAMFUNC extern void sc_can_notify_task_def(uint8_t index, uint32_t count);
 SC_RAMFUNC extern void sc_can_notify_task_isr(uint8_t index, uint32_t count);
 extern void sc_can_log_bit_timing(sc_can_bit_timing const *c, char const* name);
 SC_RAMFUNC extern void sc_can_status_queue(uint8_t index, sc_can_status const *status);
+enum {
+	SC_SW_FILTER_NONE = 0x7f, // no element matched or stage inactive
+	SC_SW_FILTER_DROP = 0x80, // frame is not forwarded to the host
+};
+
+/* software filter stage, evaluates a received frame without side effects
+ *
+ * Evaluating again (e.g. after a retrieve with insufficient buffer space)
+ * yields the same result.
+ *
+ * return  matching element index or SC_SW_FILTER_NONE, | SC_SW_FILTER_DROP
+ *         if the frame is to be dropped
+ */
+SC_RAMFUNC extern uint8_t sc_can_sw_filter_eval(uint8_t index, uint32_t can_id, uint8_t flags, uint32_t timestamp_us);
+/* updates counters and decimation with the result of sc_can_sw_filter_eval,
+ * call exactly once when the frame is placed or dropped
+ */
+SC_RAMFUNC extern void sc_can_sw_filter_commit(uint8_t index, uint8_t result, uint32_t timestamp_us);
+/* bus statistics, call once per received frame when it is consumed, i.e.
+ * placed or dropped by the software filter
+ *
+ * Transmitted frames are accounted by the caller of sc_board_can_tx_queue.
+ */
+SC_RAMFUNC extern void sc_can_bus_stats_frame(uint8_t index, uint32_t can_id, uint8_t flags, uint8_t dlc, bool tx);
+/* submit the USB buffer being filled as soon as the endpoint is free,
+ * regardless of SC_MSG_FLUSH_POLICY
+ *
+ * Call from sc_board_can_retrieve after placing a priority lane frame.
+ */
+SC_RAMFUNC extern void sc_can_bulk_in_flush_now(uint8_t index);
+/* place a transmission receipt as selected by SC_MSG_TXR_MODE
+ *
+ * timestamp_us is the board counter value, placed as device time.
+ * Batched receipts are appended to the message placed last if nothing
+ * was placed after it.
+ *
+ * return  number of bytes placed, 0 if merged into the message placed last,
+ *         -1 if insufficient space in buffer
+ */
+SC_RAMFUNC extern int sc_can_txr_place(uint8_t index, uint8_t *tx_ptr, uint8_t *tx_end, uint8_t track_id, uint8_t flags, uint32_t timestamp_us);
 
 #ifndef D5035_01
 #	define D5035_01 0
@@ -163,6 +268,10 @@ SC_RAMFUNC extern void sc_can_status_queue(uint8_t index, sc_can_status const *s
 #	define STM32F3DISCOVERY 0
 #endif
 
+#ifndef SUPERCAN_SIM
+#	define SUPERCAN_SIM 0
+#endif
+
 #if D5035_01
 #	include "supercan_D5035_01.h"
 #elif SAME54XPLAINEDPRO
@@ -175,12 +284,163 @@ SC_RAMFUNC extern void sc_can_status_queue(uint8_t index, sc_can_status const *s
 #	include "supercan_longan_canbed_m4.h"
 #elif STM32F3DISCOVERY
 #	include "supercan_stm32f3discovery.h"
+#elif SUPERCAN_SIM
+#	define SUPERCAN_DUMMY 1
+#	include "supercan_dummy.h"
 #else
 #	pragma GCC warning "unknown board, using dummy CAN implementation"
 #	define SUPERCAN_DUMMY 1
 #	include "supercan_dummy.h"
 #endif
 
+enum {
+	sc_static_assert_sc_board_can_filter_std_count_fits_u8 = sizeof(int[SC_BOARD_CAN_FILTER_STD_COUNT <= 255 ? 1 : -1]),
+	sc_static_assert_sc_board_can_filter_ext_count_fits_u8 = sizeof(int[SC_BOARD_CAN_FILTER_EXT_COUNT <= 255 ? 1 : -1]),
+};
+
+/* software filter elements per CAN channel */
+#ifndef SC_BOARD_CAN_SW_FILTER_COUNT
+#	define SC_BOARD_CAN_SW_FILTER_COUNT 16
+#endif
+
+enum {
+	sc_static_assert_sc_board_can_sw_filter_count_below_none = sizeof(int[SC_BOARD_CAN_SW_FILTER_COUNT < SC_SW_FILTER_NONE ? 1 : -1]),
+	sc_static_assert_sc_board_can_sw_filter_count_fits_status_msg = sizeof(int[sizeof(struct sc_msg_sw_filter_status) + SC_BOARD_CAN_SW_FILTER_COUNT * sizeof(struct sc_sw_filter_counts) <= 252 ? 1 : -1]),
+};
+
+/* most frequent ids reported per SC_MSG_BUS_STATS */
+#ifndef SC_BOARD_CAN_BUS_STATS_IDS
+#	define SC_BOARD_CAN_BUS_STATS_IDS 16
+#endif
+
+enum {
+	sc_static_assert_sc_board_can_bus_stats_ids_fits_msg = sizeof(int[sizeof(struct sc_msg_bus_stats) + SC_BOARD_CAN_BUS_STATS_IDS * sizeof(struct sc_bus_stats_id) <= 252 ? 1 : -1]),
+};
+
+/* received frames recorded per channel for SC_MSG_CAPTURE_SET, power of 2 */
+#ifndef SC_BOARD_CAN_CAPTURE_FRAMES
+#	define SC_BOARD_CAN_CAPTURE_FRAMES 64
+#endif
+
+enum {
+	sc_static_assert_sc_board_can_capture_frames_is_a_power_of_2 = sizeof(int[SC_BOARD_CAN_CAPTURE_FRAMES && (SC_BOARD_CAN_CAPTURE_FRAMES & (SC_BOARD_CAN_CAPTURE_FRAMES - 1)) == 0 ? 1 : -1]),
+	sc_static_assert_sc_board_can_capture_frames_fits_u16 = sizeof(int[SC_BOARD_CAN_CAPTURE_FRAMES <= 0x8000 ? 1 : -1]),
+};
+
+/* Boards that route SC_FILTER_FLAG_PRIO filter matches to a separate
+ * priority rx lane define this to 1.
+ */
+#ifndef SC_BOARD_CAN_RX_PRIO
+#	define SC_BOARD_CAN_RX_PRIO 0
+#endif
+
+/* Tx queues per CAN channel, see SC_CAN_FRAME_FLAG_TXQ_MASK. Queue 0 is
+ * the tx fifo.
+ */
+#ifndef SC_BOARD_CAN_TX_QUEUE_COUNT
+#	define SC_BOARD_CAN_TX_QUEUE_COUNT 1
+#endif
+
+enum {
+	sc_static_assert_sc_board_can_tx_queue_count_in_range = sizeof(int[SC_BOARD_CAN_TX_QUEUE_COUNT >= 1 && SC_BOARD_CAN_TX_QUEUE_COUNT <= SC_CAN_TX_QUEUE_MAX ? 1 : -1]),
+	sc_static_assert_sc_board_can_tx_queue_count_fits_status_msg = sizeof(int[SC_BOARD_CAN_TX_QUEUE_COUNT - 1 <= sizeof(((struct sc_msg_can_status *)0)->tx_queue_size) ? 1 : -1]),
+};
+
+SC_RAMFUNC static inline uint8_t sc_can_tx_queue(struct sc_msg_can_tx const *msg)
+{
+	uint8_t const queue = (msg->flags & SC_CAN_FRAME_FLAG_TXQ_MASK) >> SC_CAN_FRAME_FLAG_TXQ_SHIFT;
+
+	return queue < SC_BOARD_CAN_TX_QUEUE_COUNT ? queue : SC_BOARD_CAN_TX_QUEUE_COUNT - 1;
+}
+
+/* tx message generators per CAN channel */
+#ifndef SC_BOARD_CAN_GEN_COUNT
+#	define SC_BOARD_CAN_GEN_COUNT 8
+#endif
+
+enum {
+	sc_static_assert_sc_board_can_gen_count_fits_u8 = sizeof(int[SC_BOARD_CAN_GEN_COUNT <= 255 ? 1 : -1]),
+};
+
+/* USB IN (device -> host) message buffers per CAN channel */
+#ifndef SC_BOARD_USB_MSG_BANKS
+#	define SC_BOARD_USB_MSG_BANKS 2
+#endif
+
+enum {
+	sc_static_assert_sc_board_usb_msg_banks_at_least_2 = sizeof(int[SC_BOARD_USB_MSG_BANKS >= 2 ? 1 : -1]),
+	sc_static_assert_sc_board_usb_msg_banks_fit_u8 = sizeof(int[SC_BOARD_USB_MSG_BANKS <= 255 ? 1 : -1]),
+};
+
+/* largest device -> host message transfer a host can negotiate with SC_MSG_HELLO_DEVICE */
+#ifndef SC_BOARD_MSG_BUFFER_SIZE_MAX
+#	define SC_BOARD_MSG_BUFFER_SIZE_MAX MSG_BUFFER_SIZE
+#endif
+
+enum {
+	sc_static_assert_sc_board_msg_buffer_size_max_at_least_msg_buffer_size = sizeof(int[SC_BOARD_MSG_BUFFER_SIZE_MAX >= MSG_BUFFER_SIZE ? 1 : -1]),
+	sc_static_assert_sc_board_msg_buffer_size_max_fits_u16 = sizeof(int[SC_BOARD_MSG_BUFFER_SIZE_MAX <= 0x8000 ? 1 : -1]),
+	sc_static_assert_sc_board_msg_buffer_size_max_is_a_multiple_of_4 = sizeof(int[(SC_BOARD_MSG_BUFFER_SIZE_MAX & 0x3) == 0 ? 1 : -1]),
+};
+
+/* Timestamp frames with the time the CAN controller captured them instead
+ * of reconstructing the time from the interrupt. Captured timestamps mark
+ * the start of frame, reconstructed ones the end.
+ *
+ * Honored by boards whose controller timestamps relate to the 1 MHz counter
+ * (SAME5x, Teensy 4.x).
+ */
+#ifndef SC_BOARD_CAN_HW_TS
+#	define SC_BOARD_CAN_HW_TS 0
+#endif
+
+/* Log interrupt cycles spent per received / transmitted frame. Uses the
+ * Cortex-M cycle counter, requires SUPERCAN_DEBUG.
+ */
+#ifndef SUPERCAN_ISR_CYCLES
+#	define SUPERCAN_ISR_CYCLES 0
+#endif
+
+#if SUPERCAN_ISR_CYCLES
+enum {
+	SC_ISR_CYCLES_FRAMES = 4096, // frames per report
+};
+
+struct sc_isr_cycles {
+	uint32_t cycles;
+	uint32_t frames;
+};
+
+static inline void sc_isr_cycles_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+SC_RAMFUNC static inline uint32_t sc_isr_cycles_now(void)
+{
+	return DWT->CYCCNT;
+}
+
+SC_RAMFUNC static inline void sc_isr_cycles_account(uint8_t index, struct sc_isr_cycles *c, uint32_t start, uint32_t frames)
+{
+	if (!frames) {
+		return;
+	}
+
+	c->cycles += sc_isr_cycles_now() - start;
+	c->frames += frames;
+
+	if (c->frames >= SC_ISR_CYCLES_FRAMES) {
+		LOG("ch%u isr %lu cycles/frame (%s ts)\n",
+			index, (unsigned long)(c->cycles / c->frames), SC_BOARD_CAN_HW_TS ? "hw" : "sw");
+		c->cycles = 0;
+		c->frames = 0;
+	}
+}
+#endif
+
 
 
 
@@ -191,3 +451,158 @@ SC_RAMFUNC static inline uint32_t sc_bitrate(unsigned brp, unsigned tseg1, unsig
 	return SC_BOARD_CAN_CLK_HZ / ((uint32_t)brp * (1 + tseg1 + tseg2));
 }
 
+/* bit times of a frame at nominal and data bitrate, without stuff bits */
+SC_RAMFUNC static inline void sc_can_frame_bits(
+	uint32_t xtd,
+	uint32_t rtr,
+	uint32_t fdf,
+	uint32_t brs,
+	uint8_t dlc,
+	uint32_t* nmbr_bits,
+	uint32_t* dtbr_bits)
+{
+	uint32_t payload_bits = dlc_to_len(dlc) * UINT32_C(8); /* payload */
+
+	/* For SOF / interframe spacing, see ISO 11898-1:2015(E) 10.4.2.2 SOF
+	 *
+	 * Since the third bit (if dominant) in the interframe space marks
+	 * SOF, there could be sitiuations in which the IFS is only 2 bit times
+	 * long. The solution adopted here is to compute including 1 bit time SOF and shorted
+	 * IFS to 2.
+	 */
+
+	if (fdf) {
+		// FD frames have a 3 bit stuff count field and a 1 bit parity field prior to the actual checksum
+		// There is a stuff bit at the begin of the stuff count field (always) and then at fixed positions
+		// every 4 bits.
+		uint32_t crc_bits = dlc <= 10 ? (17+4+5) : (21+4+6);
+
+		if (brs) {
+			*dtbr_bits =
+				1 /* ESI */
+				+ 4 /* DLC */
+				+ payload_bits
+				+ crc_bits; /* CRC */
+
+			if (xtd) {
+				*nmbr_bits =
+					1 /* SOF? */
+					+ 11 /* ID */
+					+ 1 /* SRR */
+					+ 1 /* IDE */
+					+ 18 /* ID */
+					+ 1 /* reserved 0 */
+					+ 1 /* EDL */
+					+ 1 /* reserved 0 */
+					+ 1 /* BRS */
+					// + 1 /* ESI */
+					// + 4 /* DLC */
+					// + dlc_to_len(dlc) * UINT32_C(8) /* payload */
+					// + /* CRC */
+					+ 1 /* CRC delimiter */
+					+ 1 /* ACK slot */
+					+ 1 /* ACK delimiter */
+					+ 7 /* EOF */
+					+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
+
+			} else {
+				*nmbr_bits =
+					1 /* SOF */
+					+ 11 /* ID */
+					+ 1 /* reserved 1 */
+					+ 1 /* IDE */
+					+ 1 /* EDL */
+					+ 1 /* reserved 0 */
+					+ 1 /* BRS */
+					// + 1 /* ESI */
+					// + 4 /* DLC */
+					// + dlc_to_len(dlc) * UINT32_C(8) /* payload */
+					// + /* CRC */
+					+ 1 /* CRC delimiter */
+					+ 1 /* ACK slot */
+					+ 1 /* ACK delimiter */
+					+ 7 /* EOF */
+					+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
+			}
+		} else {
+			*dtbr_bits = 0;
+
+			if (xtd) {
+				*nmbr_bits =
+					1 /* SOF */
+					+ 11 /* ID */
+					+ 1 /* SRR */
+					+ 1 /* IDE */
+					+ 18 /* ID */
+					+ 1 /* reserved 0 */
+					+ 1 /* EDL */
+					+ 1 /* reserved 0 */
+					+ 1 /* BRS */
+					+ 1 /* ESI */
+					+ 4 /* DLC */
+					+ payload_bits
+					+ crc_bits /* CRC */
+					+ 1 /* CRC delimiter */
+					+ 1 /* ACK slot */
+					+ 1 /* ACK delimiter */
+					+ 7 /* EOF */
+					+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
+			} else {
+				*nmbr_bits =
+					1 /* SOF */
+					+ 11 /* ID */
+					+ 1 /* reserved 1 */
+					+ 1 /* IDE */
+					+ 1 /* EDL */
+					+ 1 /* reserved 0 */
+					+ 1 /* BRS */
+					+ 1 /* ESI */
+					+ 4 /* DLC */
+					+ payload_bits
+					+ crc_bits /* CRC */
+					+ 1 /* CRC delimiter */
+					+ 1 /* ACK slot */
+					+ 1 /* ACK delimiter */
+					+ 7 /* EOF */
+					+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
+			}
+		}
+	} else {
+		*dtbr_bits = 0;
+
+		if (xtd) {
+			*nmbr_bits =
+				1 /* SOF */
+				+ 11 /* non XTD identifier part */
+				+ 1 /* SRR */
+				+ 1 /* IDE */
+				+ 18 /* XTD identifier part */
+				+ 1 /* RTR */
+				+ 2 /* reserved */
+				+ 4 /* DLC */
+				+ (!rtr) * payload_bits
+				+ 15 /* CRC */
+				+ 1 /* CRC delimiter */
+				+ 1 /* ACK slot */
+				+ 1 /* ACK delimiter */
+				+ 7 /* EOF */
+				+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
+		} else {
+			*nmbr_bits =
+				1 /* SOF */
+				+ 11 /* ID */
+				+ 1 /* RTR */
+				+ 1 /* IDE */
+				+ 1 /* reserved */
+				+ 4 /* DLC */
+				+ (!rtr) * payload_bits
+				+ 15 /* CRC */
+				+ 1 /* CRC delimiter */
+				+ 1 /* ACK slot */
+				+ 1 /* ACK delimiter */
+				+ 7 /* EOF */
+				+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
+		}
+	}
+}
+
@@ -11,9 +11,17 @@
 /* dummy board, simulated CAN */
 #define SC_BOARD_USB_BCD_DEVICE (HWREV << 8)
 #define SC_BOARD_USB_MANUFACTURER_STRING "<unknown>"
-#define SC_BOARD_CAN_COUNT 1
 #define SC_BOARD_NAME BOARD_NAME
-#define SC_BOARD_CAN_CLK_HZ 48000000
+
+#if SUPERCAN_SIM
+#	define SC_BOARD_CAN_COUNT 2
+#	define SC_BOARD_CAN_CLK_HZ 80000000
+#	define SC_BOARD_USB_MSG_BANKS 8
+#	define SC_BOARD_MSG_BUFFER_SIZE_MAX 4096
+#else
+#	define SC_BOARD_CAN_COUNT 1
+#	define SC_BOARD_CAN_CLK_HZ 48000000
+#endif
 
 enum {
 	SC_BOARD_DEBUG_DEFAULT,
@@ -21,14 +29,46 @@ enum {
 };
 
 enum {
+#if SUPERCAN_SIM
+	SC_BOARD_CAN_TX_FIFO_SIZE = 32,
+	SC_BOARD_CAN_RX_FIFO_SIZE = 64,
+#else
 	SC_BOARD_CAN_TX_FIFO_SIZE = 8,
 	SC_BOARD_CAN_RX_FIFO_SIZE = 8,
+#endif
+	SC_BOARD_CAN_FILTER_STD_COUNT = 8,
+	SC_BOARD_CAN_FILTER_EXT_COUNT = 8,
 	CAN_FEAT_PERM = SC_FEATURE_FLAG_TXR,
-	CAN_FEAT_CONF = (MSG_BUFFER_SIZE >= 128 ? SC_FEATURE_FLAG_FDF : 0),
+	CAN_FEAT_CONF = (MSG_BUFFER_SIZE >= 128 ? SC_FEATURE_FLAG_FDF : 0) | SC_FEATURE_FLAG_CRX | SC_FEATURE_FLAG_FLT,
 };
 
 #define sc_board_led_can_status_set(index, on)
 #define sc_board_led_usb_burst()
 #define sc_board_led_can_traffic_burst(index)
 #define sc_board_can_ts_request(index)
-#define sc_board_can_ts_wait(index) (board_millis() * 1000U)
+#if SUPERCAN_SIM
+extern uint32_t sc_sim_timestamp_us(void);
+extern uint16_t sc_sim_usb_frame_index(void);
+#	define sc_board_can_ts_wait(index) sc_sim_timestamp_us()
+#	define sc_board_usb_frame_index() sc_sim_usb_frame_index()
+#else
+#	define sc_board_can_ts_wait(index) (board_millis() * 1000U)
+#	define sc_board_usb_frame_index() ((uint16_t)((board_millis() << 3) & 0x3fff))
+#endif
+
+/* Bus side of the simulated CAN channels, used to inject traffic */
+struct sc_dummy_can_frame {
+	uint32_t can_id;
+	uint32_t timestamp_us;
+	uint8_t dlc;
+	uint8_t flags;
+	uint8_t data[64];
+};
+
+/* returns true if the channel is on the bus, bitrates are in bit/s */
+extern bool sc_dummy_can_on_bus(uint8_t index, uint32_t *nm_bitrate, uint32_t *dt_bitrate);
+
+/* Places frames in the channel's rx fifo, returns the number of frames accepted.
+ * Frames which don't fit are reported as lost.
+ */
+extern unsigned sc_dummy_can_rx(uint8_t index, struct sc_dummy_can_frame const *frames, unsigned count);
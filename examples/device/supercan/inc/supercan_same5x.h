@@ -11,9 +11,40 @@
 
 #define SAME5X_DEBUG_TXR 0
 
+/* Copy received frames from message RAM with the DMAC. The CAN interrupt
+ * only timestamps the frames and sets up the transfer, the DMAC interrupt
+ * acknowledges them to M_CAN and notifies the CAN task.
+ */
+#ifndef SAME5X_CAN_RX_DMA
+#	define SAME5X_CAN_RX_DMA 0
+#endif
+
+/* Serialize received frames straight from message RAM into the USB buffer.
+ * The CAN interrupt only timestamps and publishes frames, the CAN task
+ * acknowledges them to M_CAN once placed.
+ */
+#ifndef SAME5X_CAN_RX_SINGLE_COPY
+#	define SAME5X_CAN_RX_SINGLE_COPY 0
+#endif
+
+#if SAME5X_CAN_RX_DMA && SAME5X_CAN_RX_SINGLE_COPY
+#	error "SAME5X_CAN_RX_DMA and SAME5X_CAN_RX_SINGLE_COPY are mutually exclusive"
+#endif
+
+#define SC_BOARD_USB_MSG_BANKS 4
+
+#define SC_BOARD_CAN_RX_PRIO 1
+#define SC_BOARD_CAN_TX_QUEUE_COUNT 2
+
 enum {
-	SC_BOARD_CAN_TX_FIFO_SIZE = 32,
+	SC_BOARD_CAN_TX_FIFO_SIZE = 32, // tx buffer elements, dedicated + fifo
 	SC_BOARD_CAN_RX_FIFO_SIZE = 64,
+	CAN_RX_PRIO_FIFO_SIZE = 8, // rx fifo1, priority lane
+	CAN_TX_BUFFER_COUNT = 4, // dedicated tx buffers, tx queue 1
+	CAN_TX_BUFFER_MASK = (1u << CAN_TX_BUFFER_COUNT) - 1,
+	CAN_TX_FIFO_QUEUE_SIZE = SC_BOARD_CAN_TX_FIFO_SIZE - CAN_TX_BUFFER_COUNT, // tx fifo, tx queue 0
+	SC_BOARD_CAN_FILTER_STD_COUNT = 32,
+	SC_BOARD_CAN_FILTER_EXT_COUNT = 16,
 };
 
 
@@ -31,6 +62,8 @@ enum {
 	CAN_FEAT_CONF = (MSG_BUFFER_SIZE >= 128 ? SC_FEATURE_FLAG_FDF : 0)
 					| SC_FEATURE_FLAG_TXP
 					| SC_FEATURE_FLAG_EHD
+					| SC_FEATURE_FLAG_CRX
+					| SC_FEATURE_FLAG_FLT
 					// not yet implemented
 					// | SC_FEATURE_FLAG_DAR
 					| SC_FEATURE_FLAG_MON_MODE
@@ -56,11 +89,20 @@ struct can_rx_fifo_element {
 	uint8_t data[CAN_ELEMENT_DATA_SIZE];
 };
 
+struct can_std_filter_element {
+	volatile CAN_SIDFE_0_Type S0;
+};
+
+struct can_ext_filter_element {
+	volatile CAN_XIDFE_0_Type F0;
+	volatile CAN_XIDFE_1_Type F1;
+};
+
 struct rx_frame {
 	volatile CAN_RXF0E_0_Type R0;
 	volatile CAN_RXF0E_1_Type R1;
+	uint8_t data[CAN_ELEMENT_DATA_SIZE]; // same layout as the rx fifo element up to here
 	volatile uint32_t ts;
-	uint8_t data[CAN_ELEMENT_DATA_SIZE];
 };
 
 struct tx_frame {
@@ -75,7 +117,15 @@ struct same5x_can {
 	CFG_TUSB_MEM_ALIGN struct can_tx_fifo_element tx_fifo[SC_BOARD_CAN_TX_FIFO_SIZE];
 	CFG_TUSB_MEM_ALIGN struct can_tx_event_fifo_element tx_event_fifo[SC_BOARD_CAN_TX_FIFO_SIZE];
 	CFG_TUSB_MEM_ALIGN struct can_rx_fifo_element rx_fifo[SC_BOARD_CAN_RX_FIFO_SIZE];
+	CFG_TUSB_MEM_ALIGN struct can_rx_fifo_element rx_prio_fifo[CAN_RX_PRIO_FIFO_SIZE];
+	CFG_TUSB_MEM_ALIGN struct can_std_filter_element rx_std_filters[SC_BOARD_CAN_FILTER_STD_COUNT];
+	CFG_TUSB_MEM_ALIGN struct can_ext_filter_element rx_ext_filters[SC_BOARD_CAN_FILTER_EXT_COUNT];
+#if SAME5X_CAN_RX_SINGLE_COPY
+	uint32_t rx_ts[SC_BOARD_CAN_RX_FIFO_SIZE]; // timestamps of the rx fifo elements
+#else
 	struct rx_frame rx_frames[SC_BOARD_CAN_RX_FIFO_SIZE];
+#endif
+	struct rx_frame rx_prio_frames[CAN_RX_PRIO_FIFO_SIZE];
 	struct tx_frame tx_frames[SC_BOARD_CAN_TX_FIFO_SIZE];
 	sc_can_bit_timing nm;
 	sc_can_bit_timing dt;
@@ -96,11 +146,19 @@ struct same5x_can {
 	uint8_t led_traffic;
 	uint8_t rx_get_index; // NOT an index, uses full range of type
 	uint8_t rx_put_index; // NOT an index, uses full range of type
+	uint8_t rx_prio_get_index; // NOT an index, uses full range of type
+	uint8_t rx_prio_put_index; // NOT an index, uses full range of type
 	uint8_t tx_get_index; // NOT an index, uses full range of type
 	uint8_t tx_put_index; // NOT an index, uses full range of type
 #if SUPERCAN_DEBUG && SAME5X_DEBUG_TXR
 	uint32_t txr;
 #endif
+#if SAME5X_CAN_RX_DMA
+	uint8_t rx_dma_get_index; // last rx fifo element of the transfer
+	uint8_t rx_dma_put_index; // NOT an index, uses full range of type
+	uint8_t rx_dma_count;
+	bool rx_dma_busy;
+#endif
 };
 
 extern struct same5x_can same5x_cans[SC_BOARD_CAN_COUNT];
@@ -164,4 +222,5 @@ static inline void same5x_enable_cache(void)
 
 
 #define sc_board_can_ts_request(index) same5x_counter_1MHz_request_current_value()
-#define sc_board_can_ts_wait(index) same5x_counter_1MHz_wait_for_current_value()
\ No newline at end of file
+#define sc_board_can_ts_wait(index) same5x_counter_1MHz_wait_for_current_value()
+#define sc_board_usb_frame_index() ((uint16_t)(USB->DEVICE.FNUM.bit.FNUM << 3))
\ No newline at end of file
@@ -26,8 +26,10 @@ enum {
 enum {
 	SC_BOARD_CAN_TX_FIFO_SIZE = 32,
 	SC_BOARD_CAN_RX_FIFO_SIZE = 32,
+	SC_BOARD_CAN_FILTER_STD_COUNT = 7, // one filter bank per element
+	SC_BOARD_CAN_FILTER_EXT_COUNT = 7,
 	CAN_FEAT_PERM = SC_FEATURE_FLAG_TXR,
-	CAN_FEAT_CONF = SC_FEATURE_FLAG_MON_MODE | SC_FEATURE_FLAG_DAR,
+	CAN_FEAT_CONF = SC_FEATURE_FLAG_MON_MODE | SC_FEATURE_FLAG_DAR | SC_FEATURE_FLAG_CRX | SC_FEATURE_FLAG_FLT,
 };
 
 #define sc_board_led_usb_burst() led_burst(LED_USB_TRAFFIC, SC_LED_BURST_DURATION_MS)
@@ -35,3 +37,4 @@ enum {
 SC_RAMFUNC extern void sc_board_led_can_status_set(uint8_t index, int status);
 #define sc_board_can_ts_request(index)
 #define sc_board_can_ts_wait(index) (TIM2->CNT)
+#define sc_board_usb_frame_index() ((uint16_t)((USB->FNR & USB_FNR_FN) << 3))
@@ -46,6 +46,13 @@
 #define SC_BOARD_CAN_TX_FIFO_SIZE 32
 #define SC_BOARD_CAN_RX_FIFO_SIZE 32
 
+/* one or more rx mailboxes per filter element */
+#define SC_BOARD_CAN_FILTER_STD_COUNT 8
+#define SC_BOARD_CAN_FILTER_EXT_COUNT 4
+
+#define SC_BOARD_USB_MSG_BANKS 8
+#define SC_BOARD_MSG_BUFFER_SIZE_MAX 4096
+
 enum {
 	SC_BOARD_DEBUG_DEFAULT,
 #if D5035_03
@@ -65,6 +72,7 @@ enum {
 
 #define sc_board_can_ts_request(index) do { } while (0)
 #define sc_board_can_ts_wait(index) (GPT2->CNT)
+#define sc_board_usb_frame_index() ((uint16_t)(USB1->FRINDEX & USB_FRINDEX_FRINDEX_MASK))
 
 
 #if D5035_03
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <supercan_board.h>
+
+/* clear all elements */
+extern void sc_can_sw_filter_reset(uint8_t index);
+/* called when going on bus, resets counters and decimation state */
+extern void sc_can_sw_filter_enable(uint8_t index, bool on);
+extern void sc_can_sw_filter_set(uint8_t index, uint8_t element, struct sc_msg_sw_filter_set const *msg);
+/* size of SC_MSG_SW_FILTER_STATUS, 0 if the stage is disabled */
+extern uint8_t sc_can_sw_filter_status_size(uint8_t index);
+/* place SC_MSG_SW_FILTER_STATUS, requires sc_can_sw_filter_status_size bytes */
+extern void sc_can_sw_filter_status_place(uint8_t index, uint8_t *tx_ptr, uint32_t timestamp_us);
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <supercan_board.h>
+
+#define SC_TIMEBASE_STACK_SIZE configMINIMAL_STACK_SIZE
+#define SC_TIMEBASE_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
+extern StackType_t sc_timebase_task_stack[SC_TIMEBASE_STACK_SIZE];
+extern StaticTask_t sc_timebase_task_mem;
+
+/* disciplines device time to USB start of frame, see timebase.c */
+extern void sc_timebase_task(void *param);
+
+/* Extends device time to 64 bit.
+ *
+ * Counts wraps of the 32 bit time whether or not any channel is on the bus.
+ * timestamp_us must be within about 35 minutes of the current time.
+ */
+SC_RAMFUNC extern uint64_t sc_timebase_extend(uint32_t timestamp_us);
+
+/* Last USB start of frame sampled by the timebase task, up to a second old.
+ *
+ * timestamp_us is the device time at the start of frame_index.
+ *
+ * return  false if no frame boundary was seen (e.g. bus suspended),
+ *         timestamp_us is then the time frame_index was read
+ */
+SC_RAMFUNC extern bool sc_timebase_sof(uint16_t *frame_index, uint32_t *timestamp_us);
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <supercan_board.h>
+
+/* maximum payload of a generated frame */
+#define SC_CAN_GEN_DATA_MAX 64
+
+/* clear all generators */
+extern void sc_can_gen_reset(uint8_t index);
+/* called when going on bus, restarts all generators */
+extern void sc_can_gen_enable(uint8_t index, bool on);
+extern bool sc_can_gen_active(uint8_t index);
+extern void sc_can_gen_set(uint8_t index, struct sc_msg_gen_set const *msg);
+extern void sc_can_gen_data(uint8_t index, struct sc_msg_gen_data const *msg);
+/* queue frames that are due, call with the CAN task's usb lock held
+ *
+ * return  us until the next frame is due,
+ *         0 if frames are pending due to a full tx fifo,
+ *         SC_TS_MAX if no generator is running
+ */
+SC_RAMFUNC extern uint32_t sc_can_gen_run(uint8_t index, uint32_t now_us);
@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* FreeRTOS configuration for the host (POSIX) simulator build.
+ *
+ * Mirrors inc/FreeRTOSConfig.h as far as the POSIX port allows it.
+ * This directory is placed in front of inc/ in the include path.
+ */
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#include <stddef.h>
+
+#include "supercan_debug.h"
+
+extern int board_uart_write(void const * buf, int len);
+__attribute__((noreturn)) extern void sc_assert_failed(char const * const msg, size_t len);
+
+/* Task stacks double as pthread stacks, hence the large values. */
+#define configMINIMAL_SECURE_STACK_SIZE         ( 4096 )
+
+#define configUSE_PREEMPTION                    1
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION 0
+#define configTICK_RATE_HZ                      ( 1000 )
+#define configMAX_PRIORITIES                    ( 5 )
+#define configMINIMAL_STACK_SIZE                ( 4096 )
+#define configTOTAL_HEAP_SIZE                   ( 0*1024 ) // dynamic is not used
+#define configMAX_TASK_NAME_LEN                 8
+#define configUSE_16_BIT_TICKS                  0
+#define configIDLE_SHOULD_YIELD                 1
+#define configUSE_MUTEXES                       1
+#define configUSE_RECURSIVE_MUTEXES             1
+#define configUSE_COUNTING_SEMAPHORES           1
+#define configQUEUE_REGISTRY_SIZE               4
+#define configUSE_QUEUE_SETS                    0
+#define configUSE_TIME_SLICING                  0
+#define configUSE_NEWLIB_REENTRANT              0
+#define configENABLE_BACKWARD_COMPATIBILITY     0
+#define configSTACK_ALLOCATION_FROM_SEPARATE_HEAP   0
+
+#define configSUPPORT_STATIC_ALLOCATION         1
+#define configSUPPORT_DYNAMIC_ALLOCATION        0
+
+/* Hook function related definitions. */
+#define configUSE_IDLE_HOOK                    0
+#define configUSE_TICK_HOOK                    0
+#define configUSE_MALLOC_FAILED_HOOK           0
+#define configCHECK_FOR_STACK_OVERFLOW         0 // pthread stacks are guarded by the host
+
+/* Run time and task stats gathering related definitions. */
+#define configGENERATE_RUN_TIME_STATS          0
+#define configUSE_TRACE_FACILITY               1
+#define configUSE_STATS_FORMATTING_FUNCTIONS   0
+
+/* Co-routine definitions. */
+#define configUSE_CO_ROUTINES                  0
+#define configMAX_CO_ROUTINE_PRIORITIES        2
+
+/* Software timer related definitions. */
+#define configUSE_TIMERS                       1
+#define configTIMER_TASK_PRIORITY              (configMAX_PRIORITIES-1)
+#define configTIMER_QUEUE_LENGTH               32
+#define configTIMER_TASK_STACK_DEPTH           configMINIMAL_STACK_SIZE
+
+/* Optional functions - most linkers will remove unused functions anyway. */
+#define INCLUDE_vTaskPrioritySet               1
+#define INCLUDE_uxTaskPriorityGet              0
+#define INCLUDE_vTaskDelete                    0
+#define INCLUDE_vTaskSuspend                   1 // required for queue, semaphore, mutex to be blocked indefinitely with portMAX_DELAY
+#define INCLUDE_xResumeFromISR                 0
+#define INCLUDE_vTaskDelayUntil                1
+#define INCLUDE_vTaskDelay                     1
+#define INCLUDE_xTaskGetSchedulerState         0
+#define INCLUDE_xTaskGetCurrentTaskHandle      0
+#define INCLUDE_uxTaskGetStackHighWaterMark    0
+#define INCLUDE_xTaskGetIdleTaskHandle         0
+#define INCLUDE_xTimerGetTimerDaemonTaskHandle 0
+#define INCLUDE_pcTaskGetTaskName              0
+#define INCLUDE_eTaskGetState                  0
+#define INCLUDE_xEventGroupSetBitFromISR       0
+#define INCLUDE_xTimerPendFunctionCall         0
+
+#if SUPERCAN_DEBUG
+#define configASSERT(x) \
+  do { \
+    if (__builtin_expect(!(x), 0)) { \
+      SC_ASSERT_FAILED("FreeRTOS ASSERT FAILED: " #x " " __FILE__ ":" SC_DEBUG_STR(__LINE__) "\n"); \
+    } \
+  } while (0)
+#else
+# define configASSERT(x)
+#endif
+
+/* Task notification counters reported with SC_SIM_STATS, see can_synth.c */
+extern void sc_sim_trace_notify_give(void);
+extern void sc_sim_trace_notify_take(void);
+
+#define traceTASK_NOTIFY(...)                   sc_sim_trace_notify_give()
+#define traceTASK_NOTIFY_GIVE_FROM_ISR(...)     sc_sim_trace_notify_give()
+#define traceTASK_NOTIFY_TAKE(...)              sc_sim_trace_notify_take()
+
+/* There is no NVIC, these only exist to derive SC_TASK_PRIORITY / SC_ISR_PRIORITY */
+#define configLIBRARY_LOWEST_INTERRUPT_PRIORITY       ( configMAX_PRIORITIES - 1 )
+#define configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY  2
+
+#endif /* __FREERTOS_CONFIG__H */
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* Minimal hw/bsp board API for the host simulator */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bsp/board.h>
+
+#include "can_synth.h"
+
+/* USB frames are timed by the host controller's clock, not the device's. */
+static struct {
+	uint64_t start_us;
+	int32_t sof_ppm; // host controller clock rate error against the device counter
+	int32_t sof_offset_us;
+} board;
+
+/* CLOCK_MONOTONIC, so host tools can relate device timestamps to their own clock */
+extern uint64_t sc_sim_timestamp_us64(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+extern uint32_t sc_sim_timestamp_us(void)
+{
+	return (uint32_t)sc_sim_timestamp_us64();
+}
+
+extern uint16_t sc_sim_usb_frame_index(void)
+{
+	uint64_t const now_us = sc_sim_timestamp_us64();
+	int64_t const elapsed_us = (int64_t)(now_us - board.start_us);
+	uint64_t const host_us = now_us + (uint64_t)(board.sof_offset_us + elapsed_us * board.sof_ppm / 1000000);
+
+	return (uint16_t)(((host_us / 1000) << 3) & 0x3fff);
+}
+
+void board_init(void)
+{
+	char const *sof_ppm = getenv("SC_SIM_SOF_PPM");
+	char const *sof_offset = getenv("SC_SIM_SOF_OFFSET_US");
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	board.start_us = sc_sim_timestamp_us64();
+	board.sof_ppm = sof_ppm ? atoi(sof_ppm) : 0;
+	board.sof_offset_us = sof_offset ? atoi(sof_offset) : 0;
+
+	sc_sim_can_synth_init();
+}
+
+void board_led_write(bool state)
+{
+	(void)state;
+}
+
+uint32_t board_button_read(void)
+{
+	return 0;
+}
+
+int board_uart_read(uint8_t* buf, int len)
+{
+	(void)buf;
+	(void)len;
+
+	return 0;
+}
+
+int board_uart_write(void const * buf, int len)
+{
+	return (int)write(STDERR_FILENO, buf, (size_t)len);
+}
@@ -0,0 +1,330 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* Synthetic CAN bus traffic for the simulator.
+ *
+ * Generates rx frames on every channel that is on the bus at the bit rates
+ * configured by the host. Traffic is configured through the environment:
+ *
+ * SC_SIM_BUS_LOAD  bus load in percent (1-100), default 50
+ * SC_SIM_FRAMES    comma separated list of frame types to cycle through
+ *                  std (11 bit), ext (29 bit), fd, fdbrs, fdext, fdbrsext
+ *                  default std
+ * SC_SIM_DLC       dlc 0-15 or 'all' to cycle through all DLCs, default 8
+ * SC_SIM_STATS     1 to print the duration of the simulated rx interrupt
+ *                  and task notification counts once per second
+ *
+ * Frame durations are computed without stuff bits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <tusb.h>
+#include <supercan_board.h>
+
+#include "can_synth.h"
+
+enum {
+	SYNTH_KIND_STD = 0,
+	SYNTH_KIND_EXT,
+	SYNTH_KIND_FD,
+	SYNTH_KIND_FD_BRS,
+	SYNTH_KIND_FD_EXT,
+	SYNTH_KIND_FD_BRS_EXT,
+	SYNTH_KIND_COUNT,
+
+	SYNTH_DLC_ALL = 0xff,
+	SYNTH_BATCH_SIZE = 32,
+};
+
+static const struct {
+	char const *name;
+	uint8_t flags;
+} synth_kinds[SYNTH_KIND_COUNT] = {
+	{ "std", 0 },
+	{ "ext", SC_CAN_FRAME_FLAG_EXT },
+	{ "fd", SC_CAN_FRAME_FLAG_FDF },
+	{ "fdbrs", SC_CAN_FRAME_FLAG_FDF | SC_CAN_FRAME_FLAG_BRS },
+	{ "fdext", SC_CAN_FRAME_FLAG_FDF | SC_CAN_FRAME_FLAG_EXT },
+	{ "fdbrsext", SC_CAN_FRAME_FLAG_FDF | SC_CAN_FRAME_FLAG_BRS | SC_CAN_FRAME_FLAG_EXT },
+};
+
+static struct synth {
+	struct synth_can {
+		struct sc_dummy_can_frame next;
+		uint64_t next_ns; // bus time the next frame ends
+		uint32_t counter;
+		uint8_t kind_index;
+		uint8_t dlc;
+		bool on_bus;
+	} cans[SC_BOARD_CAN_COUNT];
+	struct sc_dummy_can_frame batch[SYNTH_BATCH_SIZE];
+	struct synth_stats {
+		uint64_t report_us;
+		uint64_t isr_ns;
+		uint32_t isr_max_ns;
+		uint32_t isr_count;
+		uint32_t frames;
+		uint32_t notify_give;
+		uint32_t notify_take;
+		bool enabled;
+	} stats;
+	StackType_t task_stack_mem[configMINIMAL_STACK_SIZE];
+	StaticTask_t task_mem;
+	uint8_t kinds[SYNTH_KIND_COUNT];
+	uint8_t kind_count;
+	uint8_t load;
+	uint8_t dlc;
+} synth;
+
+/* nominal and data phase bits of a frame, without stuff bits */
+static void synth_frame_bits(uint8_t flags, uint8_t dlc, uint32_t *nm_bits, uint32_t *dt_bits)
+{
+	uint32_t const ext = (flags & SC_CAN_FRAME_FLAG_EXT) ? 1 : 0;
+	uint32_t const len = dlc_to_len(dlc);
+
+	if (flags & SC_CAN_FRAME_FLAG_FDF) {
+		// SOF, id, (SRR, IDE, id ext), RRS, IDE/r1, FDF, res, BRS
+		uint32_t const arbitration = 1 + 11 + 1 + 1 + 1 + 1 + 1 + ext * 20;
+		// ESI, DLC, data, stuff count, CRC, CRC delimiter
+		uint32_t const data = 1 + 4 + len * 8 + 4 + (len > 16 ? 21 : 17) + 1;
+		// ACK, ACK delimiter, EOF, IFS
+		uint32_t const tail = 2 + 7 + 3;
+
+		if (flags & SC_CAN_FRAME_FLAG_BRS) {
+			*nm_bits = arbitration + tail;
+			*dt_bits = data;
+		} else {
+			*nm_bits = arbitration + data + tail;
+			*dt_bits = 0;
+		}
+	} else {
+		// SOF, id, RTR, IDE, r0, DLC, data, CRC, CRC delimiter, ACK, ACK delimiter, EOF, IFS
+		*nm_bits = 1 + 11 + 1 + 1 + 1 + 4 + tu_min32(len, 8) * 8 + 15 + 1 + 2 + 7 + 3 + ext * 20;
+		*dt_bits = 0;
+	}
+}
+
+static void synth_frame_next(struct synth_can *can, struct sc_dummy_can_frame *frame)
+{
+	uint8_t const kind = synth.kinds[can->kind_index];
+	uint8_t const flags = synth_kinds[kind].flags;
+	uint8_t dlc = can->dlc;
+
+	if (++can->kind_index == synth.kind_count) {
+		can->kind_index = 0;
+	}
+
+	if (SYNTH_DLC_ALL == synth.dlc) {
+		can->dlc = (can->dlc + 1) & 0xf;
+	}
+
+	if (!(flags & SC_CAN_FRAME_FLAG_FDF) && dlc > 8) {
+		dlc = 8;
+	}
+
+	frame->flags = flags;
+	frame->dlc = dlc;
+	frame->can_id = (flags & SC_CAN_FRAME_FLAG_EXT) ? (0x18000000 | (can->counter & 0xffff)) : (0x100 | (can->counter & 0xff));
+	memset(frame->data, 0, sizeof(frame->data));
+	memcpy(frame->data, &can->counter, tu_min32(sizeof(can->counter), dlc_to_len(dlc)));
+
+	++can->counter;
+}
+
+static uint64_t synth_frame_duration_ns(struct sc_dummy_can_frame const *frame, uint32_t nm_bitrate, uint32_t dt_bitrate)
+{
+	uint32_t nm_bits = 0;
+	uint32_t dt_bits = 0;
+
+	synth_frame_bits(frame->flags, frame->dlc, &nm_bits, &dt_bits);
+
+	return (UINT64_C(1000000000) * nm_bits) / nm_bitrate + (UINT64_C(1000000000) * dt_bits) / dt_bitrate;
+}
+
+extern void sc_sim_trace_notify_give(void)
+{
+	__atomic_add_fetch(&synth.stats.notify_give, 1, __ATOMIC_RELAXED);
+}
+
+extern void sc_sim_trace_notify_take(void)
+{
+	__atomic_add_fetch(&synth.stats.notify_take, 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t synth_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* stands in for the CAN rx interrupt of a real board */
+static void synth_can_rx(uint8_t index, unsigned count)
+{
+	uint64_t start_ns = 0;
+	uint32_t isr_ns = 0;
+
+	if (!synth.stats.enabled) {
+		(void)sc_dummy_can_rx(index, synth.batch, count);
+		return;
+	}
+
+	start_ns = synth_ns();
+	(void)sc_dummy_can_rx(index, synth.batch, count);
+	isr_ns = (uint32_t)(synth_ns() - start_ns);
+
+	synth.stats.isr_ns += isr_ns;
+	synth.stats.isr_max_ns = tu_max32(synth.stats.isr_max_ns, isr_ns);
+	synth.stats.isr_count += 1;
+	synth.stats.frames += count;
+}
+
+static void synth_stats_report(uint64_t now_us)
+{
+	struct synth_stats *stats = &synth.stats;
+
+	if (now_us - stats->report_us < 1000000) {
+		return;
+	}
+
+	fprintf(stderr, "sim: %u frames in %u rx interrupts, avg %u max %u [ns] per interrupt, %u notifications, %u notification takes\n",
+		(unsigned)stats->frames,
+		(unsigned)stats->isr_count,
+		(unsigned)(stats->isr_count ? stats->isr_ns / stats->isr_count : 0),
+		(unsigned)stats->isr_max_ns,
+		(unsigned)__atomic_exchange_n(&stats->notify_give, 0, __ATOMIC_RELAXED),
+		(unsigned)__atomic_exchange_n(&stats->notify_take, 0, __ATOMIC_RELAXED));
+
+	stats->report_us = now_us;
+	stats->isr_ns = 0;
+	stats->isr_max_ns = 0;
+	stats->isr_count = 0;
+	stats->frames = 0;
+}
+
+static void synth_can_run(uint8_t index, uint64_t now_us)
+{
+	struct synth_can *can = &synth.cans[index];
+	uint32_t nm_bitrate = 0;
+	uint32_t dt_bitrate = 0;
+	uint64_t duration_ns = 0;
+	unsigned count = 0;
+
+	if (!sc_dummy_can_on_bus(index, &nm_bitrate, &dt_bitrate) || !nm_bitrate || !dt_bitrate) {
+		can->on_bus = false;
+		return;
+	}
+
+	if (!can->on_bus) {
+		can->on_bus = true;
+		synth_frame_next(can, &can->next);
+		duration_ns = synth_frame_duration_ns(&can->next, nm_bitrate, dt_bitrate);
+		can->next_ns = now_us * 1000 + duration_ns;
+	}
+
+	// frames are timestamped at the end of frame
+	while (can->next_ns <= now_us * 1000) {
+		struct sc_dummy_can_frame *frame = &synth.batch[count];
+		uint64_t idle_ns = 0;
+
+		*frame = can->next;
+		frame->timestamp_us = (uint32_t)(can->next_ns / 1000);
+
+		duration_ns = synth_frame_duration_ns(frame, nm_bitrate, dt_bitrate);
+		idle_ns = (duration_ns * (100 - synth.load)) / synth.load;
+
+		synth_frame_next(can, &can->next);
+		duration_ns = synth_frame_duration_ns(&can->next, nm_bitrate, dt_bitrate);
+		can->next_ns += idle_ns + duration_ns;
+
+		if (++count == (unsigned)TU_ARRAY_SIZE(synth.batch)) {
+			synth_can_rx(index, count);
+			count = 0;
+		}
+	}
+
+	if (count) {
+		synth_can_rx(index, count);
+	}
+}
+
+static void synth_task(void *param)
+{
+	(void)param;
+
+	while (42) {
+		uint64_t const now_us = sc_sim_timestamp_us64();
+
+		for (uint8_t i = 0; i < TU_ARRAY_SIZE(synth.cans); ++i) {
+			synth_can_run(i, now_us);
+		}
+
+		if (synth.stats.enabled) {
+			synth_stats_report(now_us);
+		}
+
+		vTaskDelay(1);
+	}
+}
+
+static void synth_parse_frames(char const *str)
+{
+	char buf[128];
+	char *save = NULL;
+
+	synth.kind_count = 0;
+
+	strncpy(buf, str, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+
+	for (char *tok = strtok_r(buf, ",", &save); tok && synth.kind_count < TU_ARRAY_SIZE(synth.kinds); tok = strtok_r(NULL, ",", &save)) {
+		for (uint8_t k = 0; k < SYNTH_KIND_COUNT; ++k) {
+			if (0 == strcmp(tok, synth_kinds[k].name)) {
+				synth.kinds[synth.kind_count++] = k;
+				break;
+			}
+		}
+	}
+
+	if (!synth.kind_count) {
+		synth.kinds[synth.kind_count++] = SYNTH_KIND_STD;
+	}
+}
+
+extern void sc_sim_can_synth_init(void)
+{
+	char const *load = getenv("SC_SIM_BUS_LOAD");
+	char const *frames = getenv("SC_SIM_FRAMES");
+	char const *dlc = getenv("SC_SIM_DLC");
+	char const *stats = getenv("SC_SIM_STATS");
+
+	memset(&synth, 0, sizeof(synth));
+
+	synth.load = load ? (uint8_t)tu_max32(1, tu_min32(100, (uint32_t)atoi(load))) : 50;
+	synth_parse_frames(frames ? frames : "std");
+	synth.stats.enabled = stats && atoi(stats);
+
+	if (dlc && 0 == strcmp(dlc, "all")) {
+		synth.dlc = SYNTH_DLC_ALL;
+	} else {
+		synth.dlc = dlc ? (uint8_t)(atoi(dlc) & 0xf) : 8;
+	}
+
+	for (uint8_t i = 0; i < TU_ARRAY_SIZE(synth.cans); ++i) {
+		synth.cans[i].dlc = SYNTH_DLC_ALL == synth.dlc ? 0 : synth.dlc;
+	}
+
+	(void)xTaskCreateStatic(&synth_task, "synth", TU_ARRAY_SIZE(synth.task_stack_mem), NULL, configMAX_PRIORITIES-1, synth.task_stack_mem, &synth.task_mem);
+}
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+extern uint64_t sc_sim_timestamp_us64(void);
+extern void sc_sim_can_synth_init(void);
@@ -0,0 +1,421 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* Software device controller for the host simulator.
+ *
+ * Every non-control endpoint pair is exposed as a SOCK_SEQPACKET unix domain
+ * socket named ep<N> in $SC_SIM_DIR (default /tmp/supercan-sim). One datagram
+ * written by the host completes one OUT transfer, each IN transfer is delivered
+ * to the host as one datagram.
+ *
+ * The controller runs off a FreeRTOS task that emulates one full speed USB
+ * frame per tick. Within a frame, pending transfers are serviced until the
+ * frame's bulk budget of SIM_FRAME_PACKETS maximum size packets is used up,
+ * the same way a host controller keeps polling bulk endpoints that have data.
+ * Between passes the device tasks run so they can queue their next transfer.
+ * Enumeration is short-circuited by injecting SET_ADDRESS and
+ * SET_CONFIGURATION on start.
+ */
+
+#include <tusb_option.h>
+
+#if CFG_TUSB_MCU == OPT_MCU_NONE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <device/dcd.h>
+
+#ifndef SC_SIM_DIR_DEFAULT
+#	define SC_SIM_DIR_DEFAULT "/tmp/supercan-sim"
+#endif
+
+enum {
+	SIM_EP_COUNT = 8,
+	SIM_FRAME_MASK = 0x7ff,
+	SIM_PACKET_SIZE = 64,
+	// bulk packets a full speed host schedules per frame at most
+	SIM_FRAME_PACKETS = 19,
+	SIM_FRAME_BYTES = SIM_FRAME_PACKETS * SIM_PACKET_SIZE,
+};
+
+struct sim_xfer {
+	uint8_t *buffer;
+	uint16_t total_bytes;
+	bool busy;
+};
+
+static struct sim {
+	struct sim_xfer xfers[SIM_EP_COUNT][2];
+	int listen_fds[SIM_EP_COUNT];
+	int client_fds[SIM_EP_COUNT];
+	StackType_t task_stack_mem[configMINIMAL_STACK_SIZE];
+	StaticTask_t task_mem;
+	TaskHandle_t task_handle;
+	char dir[96];
+	int budget;
+	uint16_t frame;
+	uint8_t rhport;
+	bool int_enabled;
+} sim;
+
+static void sim_task(void *param);
+
+static void sim_listen(uint8_t epnum)
+{
+	struct sockaddr_un addr;
+	int fd = -1;
+
+	if (sim.listen_fds[epnum] >= 0) {
+		return;
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf(stderr, "sim: ep%u socket: %s\n", epnum, strerror(errno));
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/ep%u", sim.dir, epnum);
+	(void)unlink(addr.sun_path);
+
+	if (bind(fd, (struct sockaddr const *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		fprintf(stderr, "sim: ep%u bind %s: %s\n", epnum, addr.sun_path, strerror(errno));
+		close(fd);
+		return;
+	}
+
+	sim.listen_fds[epnum] = fd;
+}
+
+static inline int sim_xfer_cost(uint16_t bytes)
+{
+	// a zero length packet still takes a transaction
+	return bytes ? (bytes + SIM_PACKET_SIZE - 1) / SIM_PACKET_SIZE * SIM_PACKET_SIZE : SIM_PACKET_SIZE;
+}
+
+static void sim_drop_client(uint8_t epnum)
+{
+	close(sim.client_fds[epnum]);
+	sim.client_fds[epnum] = -1;
+}
+
+static void sim_accept(uint8_t epnum)
+{
+	int fd = -1;
+
+	if (sim.listen_fds[epnum] < 0) {
+		return;
+	}
+
+	fd = accept4(sim.listen_fds[epnum], NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+
+	// latest connection wins
+	if (sim.client_fds[epnum] >= 0) {
+		sim_drop_client(epnum);
+	}
+
+	sim.client_fds[epnum] = fd;
+}
+
+static bool sim_xfer_out(uint8_t epnum)
+{
+	struct sim_xfer *xfer = &sim.xfers[epnum][TUSB_DIR_OUT];
+	uint8_t *buffer = NULL;
+	uint16_t total_bytes = 0;
+	bool busy = false;
+	ssize_t r = 0;
+
+	if (sim.client_fds[epnum] < 0) {
+		return false;
+	}
+
+	taskENTER_CRITICAL();
+	busy = xfer->busy;
+	buffer = xfer->buffer;
+	total_bytes = xfer->total_bytes;
+	taskEXIT_CRITICAL();
+
+	if (!busy) {
+		return false;
+	}
+
+	// datagrams exceeding the transfer size are truncated
+	r = recv(sim.client_fds[epnum], buffer, total_bytes, MSG_DONTWAIT);
+	if (r > 0) {
+		taskENTER_CRITICAL();
+		xfer->busy = false;
+		taskEXIT_CRITICAL();
+
+		sim.budget -= sim_xfer_cost((uint16_t)r);
+
+		dcd_event_xfer_complete(sim.rhport, epnum, (uint32_t)r, XFER_RESULT_SUCCESS, false);
+
+		return true;
+	}
+
+	if (0 == r || (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)) {
+		sim_drop_client(epnum);
+	}
+
+	return false;
+}
+
+static bool sim_xfer_in(uint8_t epnum)
+{
+	struct sim_xfer *xfer = &sim.xfers[epnum][TUSB_DIR_IN];
+	uint8_t const ep_addr = tu_edpt_addr(epnum, TUSB_DIR_IN);
+	uint8_t *buffer = NULL;
+	uint16_t total_bytes = 0;
+	bool busy = false;
+	ssize_t r = 0;
+
+	if (sim.client_fds[epnum] < 0) {
+		// no host polling the endpoint, NAK
+		return false;
+	}
+
+	taskENTER_CRITICAL();
+	busy = xfer->busy;
+	buffer = xfer->buffer;
+	total_bytes = xfer->total_bytes;
+	taskEXIT_CRITICAL();
+
+	if (!busy) {
+		return false;
+	}
+
+	if (total_bytes) {
+		// zero length datagrams are indistinguishable from EOF, don't send ZLPs
+		r = send(sim.client_fds[epnum], buffer, total_bytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (r < 0) {
+			if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+				sim_drop_client(epnum);
+			}
+
+			return false;
+		}
+	}
+
+	taskENTER_CRITICAL();
+	xfer->busy = false;
+	taskEXIT_CRITICAL();
+
+	sim.budget -= sim_xfer_cost(total_bytes);
+
+	dcd_event_xfer_complete(sim.rhport, ep_addr, total_bytes, XFER_RESULT_SUCCESS, false);
+
+	return true;
+}
+
+static void sim_enumerate(void)
+{
+	static tusb_control_request_t const set_address = {
+		.bmRequestType = 0x00,
+		.bRequest = TUSB_REQ_SET_ADDRESS,
+		.wValue = 1,
+		.wIndex = 0,
+		.wLength = 0,
+	};
+	static tusb_control_request_t const set_config = {
+		.bmRequestType = 0x00,
+		.bRequest = TUSB_REQ_SET_CONFIGURATION,
+		.wValue = 1,
+		.wIndex = 0,
+		.wLength = 0,
+	};
+
+	dcd_event_bus_reset(sim.rhport, TUSB_SPEED_FULL, false);
+	dcd_event_setup_received(sim.rhport, (uint8_t const *)&set_address, false);
+	dcd_event_setup_received(sim.rhport, (uint8_t const *)&set_config, false);
+}
+
+static void sim_task(void *param)
+{
+	(void)param;
+
+	sim_enumerate();
+
+	while (42) {
+		if (sim.int_enabled) {
+			// transfers larger than the remaining budget spill into the next frame
+			sim.budget += SIM_FRAME_BYTES;
+			if (sim.budget > SIM_FRAME_BYTES) {
+				sim.budget = SIM_FRAME_BYTES;
+			}
+
+			for (uint8_t epnum = 1; epnum < SIM_EP_COUNT; ++epnum) {
+				sim_accept(epnum);
+			}
+
+			for (bool done = false; !done && sim.budget > 0; ) {
+				done = true;
+
+				for (uint8_t epnum = 1; epnum < SIM_EP_COUNT && sim.budget > 0; ++epnum) {
+					if (sim_xfer_out(epnum)) {
+						done = false;
+					}
+
+					if (sim.budget > 0 && sim_xfer_in(epnum)) {
+						done = false;
+					}
+				}
+
+				if (!done) {
+					// let the device tasks handle the completions and queue their next transfers
+					vTaskPrioritySet(NULL, tskIDLE_PRIORITY);
+					vTaskPrioritySet(NULL, configMAX_PRIORITIES-1);
+				}
+			}
+		}
+
+		sim.frame = (sim.frame + 1) & SIM_FRAME_MASK;
+
+		vTaskDelay(1);
+	}
+}
+
+/*------------------------------------------------------------------*/
+/* Device API
+ *------------------------------------------------------------------*/
+
+void dcd_init(uint8_t rhport)
+{
+	char const *dir = getenv("SC_SIM_DIR");
+
+	sim.rhport = rhport;
+
+	for (uint8_t i = 0; i < SIM_EP_COUNT; ++i) {
+		sim.listen_fds[i] = -1;
+		sim.client_fds[i] = -1;
+	}
+
+	snprintf(sim.dir, sizeof(sim.dir), "%s", dir ? dir : SC_SIM_DIR_DEFAULT);
+	(void)mkdir(sim.dir, 0700);
+
+	fprintf(stderr, "sim: endpoint sockets in %s\n", sim.dir);
+
+	sim.task_handle = xTaskCreateStatic(&sim_task, "sim", TU_ARRAY_SIZE(sim.task_stack_mem), NULL, configMAX_PRIORITIES-1, sim.task_stack_mem, &sim.task_mem);
+}
+
+void dcd_int_enable(uint8_t rhport)
+{
+	(void)rhport;
+
+	sim.int_enabled = true;
+}
+
+void dcd_int_disable(uint8_t rhport)
+{
+	(void)rhport;
+
+	sim.int_enabled = false;
+}
+
+void dcd_set_address(uint8_t rhport, uint8_t dev_addr)
+{
+	(void)dev_addr;
+
+	// DCD is responsible for the status stage
+	dcd_edpt_xfer(rhport, tu_edpt_addr(0, TUSB_DIR_IN), NULL, 0);
+}
+
+void dcd_remote_wakeup(uint8_t rhport)
+{
+	(void)rhport;
+}
+
+void dcd_connect(uint8_t rhport)
+{
+	(void)rhport;
+}
+
+void dcd_disconnect(uint8_t rhport)
+{
+	(void)rhport;
+}
+
+//--------------------------------------------------------------------+
+// Endpoint API
+//--------------------------------------------------------------------+
+
+bool dcd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const * ep_desc)
+{
+	uint8_t const epnum = tu_edpt_number(ep_desc->bEndpointAddress);
+
+	(void)rhport;
+
+	TU_ASSERT(epnum < SIM_EP_COUNT);
+
+	sim_listen(epnum);
+
+	return sim.listen_fds[epnum] >= 0;
+}
+
+void dcd_edpt_close_all(uint8_t rhport)
+{
+	(void)rhport;
+
+	taskENTER_CRITICAL();
+	for (uint8_t i = 1; i < SIM_EP_COUNT; ++i) {
+		sim.xfers[i][TUSB_DIR_OUT].busy = false;
+		sim.xfers[i][TUSB_DIR_IN].busy = false;
+	}
+	taskEXIT_CRITICAL();
+}
+
+bool dcd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes)
+{
+	uint8_t const epnum = tu_edpt_number(ep_addr);
+	uint8_t const dir = tu_edpt_dir(ep_addr);
+	struct sim_xfer *xfer = NULL;
+
+	TU_ASSERT(epnum < SIM_EP_COUNT);
+
+	if (0 == epnum) {
+		// injected requests have no data stage, complete right away
+		dcd_event_xfer_complete(rhport, ep_addr, total_bytes, XFER_RESULT_SUCCESS, false);
+		return true;
+	}
+
+	xfer = &sim.xfers[epnum][dir];
+
+	taskENTER_CRITICAL();
+	xfer->buffer = buffer;
+	xfer->total_bytes = total_bytes;
+	xfer->busy = true;
+	taskEXIT_CRITICAL();
+
+	return true;
+}
+
+void dcd_edpt_stall(uint8_t rhport, uint8_t ep_addr)
+{
+	(void)rhport;
+	(void)ep_addr;
+}
+
+void dcd_edpt_clear_stall(uint8_t rhport, uint8_t ep_addr)
+{
+	(void)rhport;
+	(void)ep_addr;
+}
+
+#endif // CFG_TUSB_MCU == OPT_MCU_NONE
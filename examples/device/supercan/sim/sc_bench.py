@@ -0,0 +1,383 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+#
+# Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+#
+
+"""Throughput / latency benchmark for the SuperCAN simulator.
+
+Connects to the endpoint sockets of a running simulator, puts the requested
+channels on the bus and consumes the message stream for the given duration.
+
+The synthetic bus traffic is configured on the simulator side, see
+can_synth.c. Device timestamps are CLOCK_MONOTONIC based, so the latency
+reported here is the time from end of frame on the simulated bus until the
+frame is read by this process.
+
+Example:
+
+  SC_SIM_BUS_LOAD=90 SC_SIM_FRAMES=fdbrs SC_SIM_DLC=all _build/supercan-sim &
+  ./sc_bench.py --channels 0 1 --nm-bitrate 500000 --dt-bitrate 5000000 --duration 10
+"""
+
+import argparse
+import os
+import select
+import socket
+import struct
+import sys
+import time
+
+SC_VERSION = 1
+
+SC_MSG_HELLO_DEVICE = 0x01
+SC_MSG_HELLO_HOST = 0x02
+SC_MSG_CAN_INFO = 0x04
+SC_MSG_NM_BITTIMING = 0x10
+SC_MSG_DT_BITTIMING = 0x11
+SC_MSG_FEATURES = 0x13
+SC_MSG_FLUSH_POLICY = 0x14
+SC_MSG_TIME_SYNC_SET = 0x19
+SC_MSG_TXR_MODE = 0x1A
+SC_MSG_BUS_STATS_SET = 0x1B
+SC_MSG_BUS = 0x1E
+SC_MSG_ERROR = 0x1F
+SC_MSG_CAN_STATUS = 0x20
+SC_MSG_CAN_RX = 0x21
+SC_MSG_CAN_TX = 0x22
+SC_MSG_CAN_TXR = 0x23
+SC_MSG_CAN_ERROR = 0x24
+SC_MSG_CAN_RX_COMPACT = 0x25
+SC_MSG_TIME_SYNC = 0x27
+SC_MSG_CAN_TXR_BATCH = 0x28
+SC_MSG_CAN_TXR_BITMAP = 0x29
+SC_MSG_BUS_STATS = 0x2A
+
+SC_FEAT_OP_OR = 0x01
+SC_FEATURE_FLAG_FDF = 0x0001
+SC_FEATURE_FLAG_CRX = 0x0080
+SC_CAN_FRAME_FLAG_FDF = 0x04
+SC_CAN_FRAME_FLAG_BRS = 0x08
+SC_CAN_FRAME_FLAG_DRP = 0x20
+SC_TIME_SYNC_FLAG_SOF = 0x1
+
+SC_TXR_MODES = {"single": 0, "batch": 1, "bitmap": 2}
+
+CMD_BUFFER_SIZE = 64
+
+DLC_TO_LEN = [0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64]
+
+
+def now_us():
+    return time.monotonic_ns() // 1000
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    k = min(len(values) - 1, int(round((p / 100.0) * (len(values) - 1))))
+    return values[k]
+
+
+def print_histogram(values):
+    # power of two buckets, matches SUPERCAN_LATENCY_HIST on the device
+    buckets = [0] * 16
+    for v in values:
+        buckets[min(len(buckets) - 1, v.bit_length())] += 1
+    total = max(1, len(values))
+    for i, count in enumerate(buckets):
+        if count:
+            bound = ">= %5u" % (1 << (i - 1)) if i == len(buckets) - 1 else "< %6u" % (1 << i)
+            print("    %s us      %8u %5.1f%%" % (bound, count, 100 * count / total))
+
+
+class Channel:
+    def __init__(self, sim_dir, index):
+        self.index = index
+        self.cmd = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+        self.cmd.connect(os.path.join(sim_dir, "ep%u" % (1 + index * 2)))
+        self.msg = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+        self.msg.connect(os.path.join(sim_dir, "ep%u" % (2 + index * 2)))
+        self.msg_buffer_size = 512
+        self.can_clk_hz = 0
+        self.tx_fifo_size = 0
+
+        self.rx_frames = 0
+        self.rx_compact = 0
+        self.rx_ts_last = 0
+        self.rx_ts_backwards = 0
+        self.rx_payload_bytes = 0
+        self.in_bytes = 0
+        self.transfers = 0
+        self.fill = []
+        self.latencies = []
+        self.rx_lost = 0
+        self.tx_dropped = 0
+        self.usb_in_busy = 0
+        self.txr = 0
+        self.txr_dropped = 0
+        self.desync = False
+        self.time_syncs = 0
+        self.time_syncs_sof = 0
+        self.time_sync_last = -1
+        self.time_sync_error_max = 0
+        self.time_sync_monotonic = True
+        self.bus_stats = 0
+        self.bus_stats_frames = 0
+        self.bus_load_last = 0
+        self.bus_load_peak = 0
+        self.bus_stats_ids = {}
+
+    def command(self, payload):
+        self.cmd.send(payload)
+        return self.cmd.recv(CMD_BUFFER_SIZE)
+
+    def expect_error_none(self, reply, what):
+        msg_id, _, _, error = struct.unpack_from("<BBBb", reply)
+        if msg_id != SC_MSG_ERROR or error:
+            raise RuntimeError("ch%u %s failed: id=%#x error=%d" % (self.index, what, msg_id, error))
+
+    def bit_timing(self, msg_id, bitrate):
+        tq = max(4, round(self.can_clk_hz / bitrate))
+        tseg2 = max(1, tq // 5)
+        tseg1 = tq - 1 - tseg2
+        reply = self.command(struct.pack("<BBBBHH", msg_id, 8, 1, tseg2, 1, tseg1))
+        self.expect_error_none(reply, "bit timing")
+        return self.can_clk_hz // tq
+
+    def setup(self, nm_bitrate, dt_bitrate, fd, compact, msg_buffer_size):
+        reply = self.command(struct.pack("<BBBB", SC_MSG_HELLO_DEVICE, 8, SC_VERSION, 0) + struct.pack(">HH", 0, msg_buffer_size))
+        if reply[0] != SC_MSG_HELLO_HOST:
+            raise RuntimeError("ch%u unexpected reply to hello: %#x" % (self.index, reply[0]))
+
+        # drain stale data
+        self.msg.setblocking(False)
+        try:
+            while self.msg.recv(65536):
+                pass
+        except BlockingIOError:
+            pass
+
+        reply = self.command(struct.pack("<BBH", SC_MSG_CAN_INFO, 4, 0))
+        (_, _, self.msg_buffer_size, self.can_clk_hz) = struct.unpack_from("<BBHI", reply)
+        self.tx_fifo_size = reply[24]
+
+        nm = self.bit_timing(SC_MSG_NM_BITTIMING, nm_bitrate)
+        dt = self.bit_timing(SC_MSG_DT_BITTIMING, dt_bitrate)
+
+        features = (SC_FEATURE_FLAG_FDF if fd else 0) | (SC_FEATURE_FLAG_CRX if compact else 0)
+        if features:
+            reply = self.command(struct.pack("<BBBBI", SC_MSG_FEATURES, 8, 0, SC_FEAT_OP_OR, features))
+            self.expect_error_none(reply, "features")
+
+        return nm, dt
+
+    def flush_policy(self, fill_percent, deadline_us):
+        reply = self.command(struct.pack("<BBBBI", SC_MSG_FLUSH_POLICY, 8, fill_percent, 0, deadline_us))
+        self.expect_error_none(reply, "flush policy")
+
+    def time_sync(self, interval_ms):
+        reply = self.command(struct.pack("<BBH", SC_MSG_TIME_SYNC_SET, 4, interval_ms))
+        self.expect_error_none(reply, "time sync")
+
+    def txr_mode(self, mode):
+        reply = self.command(struct.pack("<BBBB", SC_MSG_TXR_MODE, 4, SC_TXR_MODES[mode], 0))
+        self.expect_error_none(reply, "txr mode")
+
+    def bus_stats_interval(self, interval_ms):
+        reply = self.command(struct.pack("<BBH", SC_MSG_BUS_STATS_SET, 4, interval_ms))
+        self.expect_error_none(reply, "bus stats")
+
+    def bus(self, on):
+        self.expect_error_none(self.command(struct.pack("<BBH", SC_MSG_BUS, 4, 1 if on else 0)), "bus")
+
+    def rx(self, dlc, ts, t_us):
+        if self.rx_frames and ((ts - self.rx_ts_last) & 0xFFFFFFFF) >= 0x80000000:
+            self.rx_ts_backwards += 1
+        self.rx_frames += 1
+        self.rx_payload_bytes += DLC_TO_LEN[dlc & 0xF]
+        self.rx_ts_last = ts
+        self.latencies.append((t_us - ts) & 0xFFFFFFFF)
+
+    def consume(self, data, t_us):
+        self.transfers += 1
+        self.in_bytes += len(data)
+        self.fill.append(len(data) / self.msg_buffer_size)
+
+        offset = 0
+        while offset + 2 <= len(data):
+            msg_id, msg_len = data[offset], data[offset + 1]
+            if not msg_id or not msg_len:
+                break
+
+            if msg_id == SC_MSG_CAN_RX:
+                _, _, dlc, flags, can_id, ts = struct.unpack_from("<BBBBII", data, offset)
+                self.rx(dlc, ts, t_us)
+            elif msg_id == SC_MSG_CAN_RX_COMPACT:
+                _, _, count, pad = struct.unpack_from("<BBBB", data, offset)
+                record = offset + 4
+                for _ in range(count):
+                    id_dlc, delta = struct.unpack_from("<HH", data, record)
+                    dlc = id_dlc >> 12
+                    record += 4 + (0 if id_dlc & 0x800 else DLC_TO_LEN[dlc])
+                    self.rx_compact += 1
+                    self.rx(dlc, (self.rx_ts_last + delta) & 0xFFFFFFFF, t_us)
+            elif msg_id == SC_MSG_CAN_STATUS:
+                flags, _, _, rx_lost, tx_dropped = struct.unpack_from("<BBIHH", data, offset + 2)
+                self.rx_lost += rx_lost
+                self.tx_dropped += tx_dropped
+                self.desync = self.desync or bool(flags & 0x1)
+                if msg_len >= 20:
+                    self.usb_in_busy += struct.unpack_from("<H", data, offset + 16)[0]
+            elif msg_id == SC_MSG_TIME_SYNC:
+                _, _, flags, _, frame_index, _, lo, hi = struct.unpack_from("<BBBBHHII", data, offset)
+                ts = (hi << 32) | lo
+                self.time_syncs += 1
+                self.time_sync_monotonic = self.time_sync_monotonic and ts >= self.time_sync_last
+                self.time_sync_last = ts
+                if flags & SC_TIME_SYNC_FLAG_SOF:
+                    # disciplined device time at the start of frame i is i * 125 us modulo 2.048 s
+                    self.time_syncs_sof += 1
+                    error = (ts - frame_index * 125) % 2048000
+                    self.time_sync_error_max = max(self.time_sync_error_max, min(error, 2048000 - error))
+            elif msg_id == SC_MSG_BUS_STATS:
+                _, _, count, _, _, _, load, peak, frames = struct.unpack_from("<BBBBIIHHI", data, offset)
+                self.bus_stats += 1
+                self.bus_stats_frames += frames
+                self.bus_load_last = load
+                self.bus_load_peak = max(self.bus_load_peak, peak)
+                for e in range(offset + 44, offset + 44 + 8 * count, 8):
+                    can_id, n = struct.unpack_from("<II", data, e)
+                    self.bus_stats_ids[can_id] = self.bus_stats_ids.get(can_id, 0) + n
+            elif msg_id == SC_MSG_CAN_TXR:
+                _, _, flags, _, _ = struct.unpack_from("<BBBBI", data, offset)
+                self.txr += 1
+                if flags & SC_CAN_FRAME_FLAG_DRP:
+                    self.txr_dropped += 1
+            elif msg_id == SC_MSG_CAN_TXR_BATCH:
+                for e in range(offset + 8, offset + msg_len, 4):
+                    self.txr += 1
+                    if data[e] & SC_CAN_FRAME_FLAG_DRP:
+                        self.txr_dropped += 1
+            elif msg_id == SC_MSG_CAN_TXR_BITMAP:
+                _, _, _, _, _, sent, dropped = struct.unpack_from("<BBBBIII", data, offset)
+                self.txr += bin(sent).count("1") + bin(dropped).count("1")
+                self.txr_dropped += bin(dropped).count("1")
+
+            offset += msg_len
+
+    def report(self, duration, histogram):
+        latencies = sorted(l for l in self.latencies if l < 0x80000000)
+        fill = sorted(self.fill)
+        print("ch%u" % self.index)
+        print("  rx frames         %u (%.0f/s), %u compact" % (self.rx_frames, self.rx_frames / duration, self.rx_compact))
+        print("  rx payload        %.0f B/s" % (self.rx_payload_bytes / duration))
+        print("  usb in            %.0f B/s in %u transfers (%.0f/s)" % (self.in_bytes / duration, self.transfers, self.transfers / duration))
+        print("  transfer fill     mean %.1f%% p10 %.1f%% p50 %.1f%% of %u bytes" % (
+            100 * sum(fill) / max(1, len(fill)), 100 * percentile(fill, 10), 100 * percentile(fill, 50), self.msg_buffer_size))
+        print("  latency [us]      p50 %u p90 %u p99 %u p99.9 %u max %u" % (
+            percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+            percentile(latencies, 99.9), latencies[-1] if latencies else 0))
+        if histogram:
+            print_histogram(latencies)
+        print("  rx lost           %u" % self.rx_lost)
+        print("  rx ts backwards   %u" % self.rx_ts_backwards)
+        print("  usb in busy       %u" % self.usb_in_busy)
+        if self.time_syncs:
+            print("  time sync         %u (%u at SOF), max SOF error %u us, monotonic %s" % (
+                self.time_syncs, self.time_syncs_sof, self.time_sync_error_max, self.time_sync_monotonic))
+        if self.bus_stats:
+            top = sorted(self.bus_stats_ids.items(), key=lambda kv: -kv[1])[:4]
+            print("  bus stats         %u, %u frames, load %.1f%% peak %.1f%%, top ids %s" % (
+                self.bus_stats, self.bus_stats_frames, self.bus_load_last / 10, self.bus_load_peak / 10,
+                " ".join("%x:%u" % kv for kv in top)))
+        if self.txr:
+            print("  txr               %u (%u dropped), tx dropped %u, desync %s" % (self.txr, self.txr_dropped, self.tx_dropped, self.desync))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--sim-dir", default=os.environ.get("SC_SIM_DIR", "/tmp/supercan-sim"))
+    parser.add_argument("--channels", type=int, nargs="+", default=[0])
+    parser.add_argument("--nm-bitrate", type=int, default=500000)
+    parser.add_argument("--dt-bitrate", type=int, default=2000000)
+    parser.add_argument("--classic", action="store_true", help="don't enable CAN-FD")
+    parser.add_argument("--compact", action="store_true", help="enable compact rx messages for 11 bit frames")
+    parser.add_argument("--duration", type=float, default=5.0, help="seconds")
+    parser.add_argument("--msg-buffer-size", type=int, default=0, help="device -> host transfer size to request, 0 for default")
+    parser.add_argument("--flush-fill", type=int, default=0, help="batch device -> host messages up to this fill level in percent")
+    parser.add_argument("--flush-deadline", type=int, default=1000, help="latest flush of batched messages in us, a multiple of 1000")
+    parser.add_argument("--tx-rate", type=int, default=0, help="CAN frames per second to send on each channel")
+    parser.add_argument("--txr-mode", choices=sorted(SC_TXR_MODES), default="single", help="how the device sends transmission receipts")
+    parser.add_argument("--time-sync", type=int, default=0, help="request SC_MSG_TIME_SYNC every this many ms")
+    parser.add_argument("--bus-stats", type=int, default=0, help="request SC_MSG_BUS_STATS every this many ms")
+    parser.add_argument("--histogram", action="store_true", help="print a histogram of the rx latency")
+    parser.add_argument("--check", action="store_true", help="fail if a channel received nothing or rx or time sync timestamps went backwards")
+    args = parser.parse_args()
+
+    channels = [Channel(args.sim_dir, i) for i in args.channels]
+
+    for ch in channels:
+        nm, dt = ch.setup(args.nm_bitrate, args.dt_bitrate, not args.classic, args.compact, args.msg_buffer_size)
+        if args.flush_fill:
+            ch.flush_policy(args.flush_fill, args.flush_deadline)
+        if args.time_sync:
+            ch.time_sync(args.time_sync)
+        if args.txr_mode != "single":
+            ch.txr_mode(args.txr_mode)
+        if args.bus_stats:
+            ch.bus_stats_interval(args.bus_stats)
+        print("ch%u nominal %u bit/s data %u bit/s, msg buffer %u bytes" % (ch.index, nm, dt, ch.msg_buffer_size))
+
+    for ch in channels:
+        ch.bus(True)
+
+    by_fd = {ch.msg.fileno(): ch for ch in channels}
+    start = now_us()
+    end = start + int(args.duration * 1000000)
+    tx_sent = 0
+    # distinct track ids so bitmap receipts can combine
+    tx_frames = [struct.pack("<BBBBIB8s3x", SC_MSG_CAN_TX, 20, 8, 0, 0x7FF, i, bytes(8)) for i in range(32)]
+
+    while True:
+        t = now_us()
+        if t >= end:
+            break
+
+        if args.tx_rate:
+            due = ((t - start) * args.tx_rate) // 1000000 - tx_sent
+            if due > 0:
+                count = min(due, channels[0].msg_buffer_size // len(tx_frames[0]))
+                data = b"".join(tx_frames[(tx_sent + i) % len(tx_frames)] for i in range(count))
+                for ch in channels:
+                    try:
+                        ch.msg.send(data)
+                    except BlockingIOError:
+                        pass
+                tx_sent += count
+
+        readable, _, _ = select.select(list(by_fd.keys()), [], [], 0.001)
+        for fd in readable:
+            ch = by_fd[fd]
+            try:
+                data = ch.msg.recv(65536)
+            except BlockingIOError:
+                continue
+            ch.consume(data, now_us() & 0xFFFFFFFF)
+
+    duration = (now_us() - start) / 1000000
+
+    for ch in channels:
+        ch.msg.setblocking(True)
+        ch.bus(False)
+
+    failed = False
+    for ch in channels:
+        ch.report(duration, args.histogram)
+        failed = failed or not ch.rx_frames or ch.rx_ts_backwards > 0 or not ch.time_sync_monotonic
+
+    return 1 if args.check and failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* Bit timings for SC_MSG_AUTOBAUD
+ *
+ * Sample points follow CiA 301 for nominal bitrates and CiA 601 for data
+ * bitrates. The sweep itself is in main.c.
+ */
+
+#include <supercan_debug.h>
+#include <autobaud.h>
+
+#include <tusb.h>
+
+
+struct sc_autobaud_rate const sc_autobaud_nm_rates[] = {
+	{ 500000, 875 },
+	{ 250000, 875 },
+	{ 1000000, 750 },
+	{ 125000, 875 },
+	{ 800000, 800 },
+	{ 100000, 875 },
+	{ 83333, 875 },
+	{ 50000, 875 },
+	{ 20000, 875 },
+	{ 10000, 875 },
+};
+
+uint8_t const sc_autobaud_nm_rate_count = TU_ARRAY_SIZE(sc_autobaud_nm_rates);
+
+struct sc_autobaud_rate const sc_autobaud_dt_rates[] = {
+	{ 2000000, 750 },
+	{ 5000000, 750 },
+	{ 4000000, 750 },
+	{ 8000000, 750 },
+	{ 1000000, 750 },
+};
+
+uint8_t const sc_autobaud_dt_rate_count = TU_ARRAY_SIZE(sc_autobaud_dt_rates);
+
+
+extern bool sc_autobaud_bit_timing(struct sc_autobaud_rate const *rate, sc_can_bit_timing_range const *range, sc_can_bit_timing *bt)
+{
+	uint32_t const tq_min = 1 + range->min.tseg1 + range->min.tseg2;
+	uint32_t const tq_max = 1 + range->max.tseg1 + range->max.tseg2;
+	uint32_t best_error = rate->bitrate / 200 + 1; // 0.5%
+	bool found = false;
+
+	for (uint32_t brp = range->min.brp; brp <= range->max.brp; ++brp) {
+		uint32_t const denom = brp * rate->bitrate;
+		uint32_t const tq = (SC_BOARD_CAN_CLK_HZ + denom / 2) / denom;
+		uint32_t bitrate = 0;
+		uint32_t error = 0;
+		uint32_t tseg2 = 0;
+		uint32_t tseg1 = 0;
+
+		if (tq < tq_min) {
+			// fewer quanta for all larger prescalers
+			break;
+		}
+
+		if (tq > tq_max) {
+			continue;
+		}
+
+		bitrate = SC_BOARD_CAN_CLK_HZ / (brp * tq);
+		error = bitrate > rate->bitrate ? bitrate - rate->bitrate : rate->bitrate - bitrate;
+
+		// ties go to the smaller prescaler, i.e. more quanta
+		if (error >= best_error) {
+			continue;
+		}
+
+		tseg2 = tq - (tq * rate->sp_permille + 500) / 1000;
+		tseg2 = tu_max32(range->min.tseg2, tu_min32(tseg2, range->max.tseg2));
+		tseg1 = tq - 1 - tseg2;
+
+		if (tseg1 < range->min.tseg1 || tseg1 > range->max.tseg1) {
+			continue;
+		}
+
+		best_error = error;
+		found = true;
+		bt->brp = brp;
+		bt->tseg1 = tseg1;
+		bt->tseg2 = tseg2;
+		bt->sjw = tu_max32(range->min.sjw, tu_min32(tseg2, range->max.sjw));
+	}
+
+	return found;
+}
@@ -0,0 +1,296 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* Bus load and traffic statistics
+ *
+ * Frames are accounted in the CAN task when they are placed into the USB
+ * buffer (rx) or queued with the controller (tx). Their length in bit times
+ * at nominal and data bitrate is summed into slots of 100 ms. Bus load is
+ * computed over the last ten completed slots. Frames are attributed to the
+ * slot in which the CAN task sees them, so bursts may spill into the next
+ * slot.
+ *
+ * The most frequent ids of an interval are tracked with the space saving
+ * algorithm: once the table is full, an unknown id replaces the id with the
+ * lowest count and inherits that count plus one.
+ */
+
+#include <string.h>
+
+#include <supercan_debug.h>
+#include <bus_stats.h>
+
+#include <tusb.h>
+
+
+enum {
+	BUS_STATS_SLOT_US = 100000,
+	BUS_STATS_SLOTS = 10,
+};
+
+struct bus_stats_slot {
+	uint32_t nm_bits;
+	uint32_t dt_bits;
+};
+
+static struct bus_stats {
+	struct bus_stats_slot slots[BUS_STATS_SLOTS]; // completed slots
+	struct bus_stats_slot current;
+	struct sc_bus_stats_id ids[SC_BOARD_CAN_BUS_STATS_IDS];
+	uint32_t nm_bitrate;
+	uint32_t dt_bitrate;
+	uint32_t slot_start_us;
+	uint32_t interval_start_us;
+	uint32_t frames;
+	uint32_t tx;
+	uint32_t fdf;
+	uint32_t brs;
+	uint32_t ext;
+	uint32_t rtr;
+	uint16_t errors;
+	uint16_t load_peak_permille;
+	uint8_t slot_put_index;
+	uint8_t slots_valid;
+	uint8_t id_count;
+	bool started;
+	bool active;
+} bus_stats[SC_BOARD_CAN_COUNT];
+
+
+SC_RAMFUNC static uint16_t bus_stats_load_permille(struct bus_stats const *s, struct bus_stats_slot const *slot, uint32_t window_us)
+{
+	uint32_t const dt_bitrate = s->dt_bitrate ? s->dt_bitrate : s->nm_bitrate;
+	uint64_t busy_us = 0;
+
+	if (unlikely(!s->nm_bitrate || !window_us)) {
+		return 0;
+	}
+
+	busy_us = ((uint64_t)slot->nm_bits * 1000000) / s->nm_bitrate + ((uint64_t)slot->dt_bits * 1000000) / dt_bitrate;
+	busy_us = (busy_us * 1000) / window_us;
+
+	// frames are accounted late, a burst may exceed a slot
+	return busy_us > 1000 ? 1000 : (uint16_t)busy_us;
+}
+
+SC_RAMFUNC static void bus_stats_slot_complete(struct bus_stats *s)
+{
+	uint16_t const load = bus_stats_load_permille(s, &s->current, BUS_STATS_SLOT_US);
+
+	if (load > s->load_peak_permille) {
+		s->load_peak_permille = load;
+	}
+
+	s->slots[s->slot_put_index] = s->current;
+	s->slot_put_index = (s->slot_put_index + 1) % BUS_STATS_SLOTS;
+
+	if (s->slots_valid < BUS_STATS_SLOTS) {
+		++s->slots_valid;
+	}
+
+	memset(&s->current, 0, sizeof(s->current));
+}
+
+SC_RAMFUNC static inline void bus_stats_id_count(struct bus_stats *s, uint32_t key)
+{
+	struct sc_bus_stats_id *min = NULL;
+
+	for (size_t i = 0; i < s->id_count; ++i) {
+		struct sc_bus_stats_id *e = &s->ids[i];
+
+		if (e->can_id == key) {
+			++e->count;
+			return;
+		}
+
+		if (!min || e->count < min->count) {
+			min = e;
+		}
+	}
+
+	if (s->id_count < TU_ARRAY_SIZE(s->ids)) {
+		struct sc_bus_stats_id *e = &s->ids[s->id_count++];
+
+		e->can_id = key;
+		e->count = 1;
+	} else {
+		min->can_id = key;
+		++min->count;
+	}
+}
+
+SC_RAMFUNC extern bool sc_can_bus_stats_active(uint8_t index)
+{
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(bus_stats));
+
+	return bus_stats[index].active;
+}
+
+SC_RAMFUNC extern void sc_can_bus_stats_tick(uint8_t index, uint32_t now_us)
+{
+	struct bus_stats *s = &bus_stats[index];
+	uint32_t elapsed_us = 0;
+
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(bus_stats));
+
+	if (unlikely(!s->started)) {
+		s->started = true;
+		s->slot_start_us = now_us;
+		s->interval_start_us = now_us;
+		return;
+	}
+
+	elapsed_us = now_us - s->slot_start_us;
+
+	for (unsigned i = 0; elapsed_us >= BUS_STATS_SLOT_US && i <= BUS_STATS_SLOTS; ++i) {
+		bus_stats_slot_complete(s);
+		s->slot_start_us += BUS_STATS_SLOT_US;
+		elapsed_us -= BUS_STATS_SLOT_US;
+	}
+
+	if (unlikely(elapsed_us >= BUS_STATS_SLOT_US)) {
+		// long idle, all slots are empty now
+		s->slot_start_us = now_us - elapsed_us % BUS_STATS_SLOT_US;
+	}
+}
+
+SC_RAMFUNC extern void sc_can_bus_stats_frame(uint8_t index, uint32_t can_id, uint8_t flags, uint8_t dlc, bool tx)
+{
+	struct bus_stats *s = &bus_stats[index];
+	uint32_t const ext = (flags & SC_CAN_FRAME_FLAG_EXT) == SC_CAN_FRAME_FLAG_EXT;
+	uint32_t const rtr = (flags & SC_CAN_FRAME_FLAG_RTR) == SC_CAN_FRAME_FLAG_RTR;
+	uint32_t const fdf = (flags & SC_CAN_FRAME_FLAG_FDF) == SC_CAN_FRAME_FLAG_FDF;
+	uint32_t const brs = fdf && (flags & SC_CAN_FRAME_FLAG_BRS) == SC_CAN_FRAME_FLAG_BRS;
+	uint32_t nm_bits = 0;
+	uint32_t dt_bits = 0;
+
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(bus_stats));
+
+	if (likely(!s->active)) {
+		return;
+	}
+
+	sc_can_frame_bits(ext, rtr, fdf, brs, dlc, &nm_bits, &dt_bits);
+
+	s->current.nm_bits += nm_bits;
+	s->current.dt_bits += dt_bits;
+
+	++s->frames;
+	s->tx += tx;
+	s->fdf += fdf;
+	s->brs += brs;
+	s->ext += ext;
+	s->rtr += rtr;
+
+	bus_stats_id_count(s, can_id | (ext ? SC_BUS_STATS_ID_EXT : 0));
+}
+
+SC_RAMFUNC extern void sc_can_bus_stats_error(uint8_t index)
+{
+	struct bus_stats *s = &bus_stats[index];
+
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(bus_stats));
+
+	if (s->active && likely(s->errors != UINT16_MAX)) {
+		++s->errors;
+	}
+}
+
+extern void sc_can_bus_stats_reset(uint8_t index)
+{
+	struct bus_stats *s = &bus_stats[index];
+
+	memset(s, 0, sizeof(*s));
+}
+
+extern void sc_can_bus_stats_enable(uint8_t index, bool on)
+{
+	struct bus_stats *s = &bus_stats[index];
+	uint32_t const nm_bitrate = s->nm_bitrate;
+	uint32_t const dt_bitrate = s->dt_bitrate;
+
+	memset(s, 0, sizeof(*s));
+	s->nm_bitrate = nm_bitrate;
+	s->dt_bitrate = dt_bitrate;
+	s->active = on;
+}
+
+extern void sc_can_bus_stats_nm_bitrate_set(uint8_t index, uint32_t bitrate)
+{
+	bus_stats[index].nm_bitrate = bitrate;
+}
+
+extern void sc_can_bus_stats_dt_bitrate_set(uint8_t index, uint32_t bitrate)
+{
+	bus_stats[index].dt_bitrate = bitrate;
+}
+
+extern uint8_t sc_can_bus_stats_size(uint8_t index)
+{
+	struct bus_stats const *s = &bus_stats[index];
+
+	if (!s->active) {
+		return 0;
+	}
+
+	return sizeof(struct sc_msg_bus_stats) + sizeof(struct sc_bus_stats_id) * s->id_count;
+}
+
+extern void sc_can_bus_stats_place(uint8_t index, uint8_t *tx_ptr, uint32_t now_us, uint32_t timestamp_us)
+{
+	struct bus_stats *s = &bus_stats[index];
+	struct sc_msg_bus_stats *msg = (struct sc_msg_bus_stats *)tx_ptr;
+	struct bus_stats_slot window;
+	uint32_t window_us = 0;
+
+	SC_DEBUG_ASSERT(s->active);
+
+	sc_can_bus_stats_tick(index, now_us);
+
+	if (s->slots_valid) {
+		memset(&window, 0, sizeof(window));
+
+		for (size_t i = 0; i < s->slots_valid; ++i) {
+			window.nm_bits += s->slots[i].nm_bits;
+			window.dt_bits += s->slots[i].dt_bits;
+		}
+
+		window_us = s->slots_valid * BUS_STATS_SLOT_US;
+	} else {
+		// less than one slot on bus
+		window = s->current;
+		window_us = now_us - s->slot_start_us;
+	}
+
+	msg->id = SC_MSG_BUS_STATS;
+	msg->len = sc_can_bus_stats_size(index);
+	msg->count = s->id_count;
+	msg->unused = 0;
+	msg->timestamp_us = timestamp_us;
+	msg->interval_us = now_us - s->interval_start_us;
+	msg->load_permille = bus_stats_load_permille(s, &window, window_us);
+	msg->load_peak_permille = tu_max16(s->load_peak_permille, msg->load_permille);
+	msg->frames = s->frames;
+	msg->tx = s->tx;
+	msg->fdf = s->fdf;
+	msg->brs = s->brs;
+	msg->ext = s->ext;
+	msg->rtr = s->rtr;
+	msg->errors = s->errors;
+	msg->unused2 = 0;
+	memcpy(msg->ids, s->ids, sizeof(*s->ids) * s->id_count);
+
+	s->interval_start_us = now_us;
+	s->frames = 0;
+	s->tx = 0;
+	s->fdf = 0;
+	s->brs = 0;
+	s->ext = 0;
+	s->rtr = 0;
+	s->errors = 0;
+	s->load_peak_permille = 0;
+	s->id_count = 0;
+}
@@ -0,0 +1,280 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* Triggered capture of received frames
+ *
+ * Runs in the CAN task on the SC_MSG_CAN_RX placed by the board. All
+ * frames go into a ring of SC_BOARD_CAN_CAPTURE_FRAMES full size messages.
+ * Frame positions are counted with free running 32 bit counters:
+ *
+ * put    next frame to record
+ * out    next frame to send
+ * end    first frame after the window
+ * floor  first frame not sent yet
+ *
+ * A trigger opens a window from up to pre frames before it (but not before
+ * floor) to post frames after it. The window is sent as frames arrive. Once
+ * complete, floor moves to its end so the next window doesn't repeat frames.
+ */
+
+#include <string.h>
+
+#include <supercan_debug.h>
+#include <capture.h>
+
+#include <tusb.h>
+
+
+enum {
+	CAPTURE_SLOT_WORDS = (sizeof(struct sc_msg_can_rx) + 64) / 4,
+};
+
+static struct capture {
+	uint32_t slots[SC_BOARD_CAN_CAPTURE_FRAMES][CAPTURE_SLOT_WORDS];
+	uint32_t can_id;
+	uint32_t can_id_mask;
+	uint32_t put; // NOT an index, uses full range of type
+	uint32_t out; // NOT an index, uses full range of type
+	uint32_t end; // NOT an index, uses full range of type
+	uint32_t floor; // NOT an index, uses full range of type
+	uint32_t trigger_at; // NOT an index, uses full range of type
+	uint32_t trigger_ts;
+	uint16_t pre;
+	uint16_t post;
+	uint16_t lost;
+	uint8_t data[8];
+	uint8_t data_mask[8];
+	uint8_t flags;
+	uint8_t triggers;
+	uint8_t trigger;
+	bool active;
+	bool triggered;
+	bool marker_pending;
+	bool done;
+} captures[SC_BOARD_CAN_COUNT];
+
+
+SC_RAMFUNC static bool capture_frame_match(struct capture const *c, struct sc_msg_can_rx const *msg)
+{
+	bool matched = false;
+
+	if (c->triggers & SC_CAPTURE_TRIGGER_ID) {
+		bool const ext = (msg->flags & SC_CAN_FRAME_FLAG_EXT) == SC_CAN_FRAME_FLAG_EXT;
+
+		if (ext != ((c->flags & SC_CAPTURE_FLAG_EXT) == SC_CAPTURE_FLAG_EXT) ||
+			(msg->can_id & c->can_id_mask) != (c->can_id & c->can_id_mask)) {
+			return false;
+		}
+
+		matched = true;
+	}
+
+	if (c->triggers & SC_CAPTURE_TRIGGER_DATA) {
+		uint8_t const len = msg->len - sizeof(*msg);
+
+		for (uint8_t i = 0; i < TU_ARRAY_SIZE(c->data); ++i) {
+			// masked bytes beyond the payload don't match
+			uint8_t const b = i < len && !(msg->flags & SC_CAN_FRAME_FLAG_RTR) ? msg->data[i] : (uint8_t)~c->data[i];
+
+			if ((b & c->data_mask[i]) != (c->data[i] & c->data_mask[i])) {
+				return false;
+			}
+		}
+
+		matched = true;
+	}
+
+	return matched;
+}
+
+SC_RAMFUNC static void capture_trigger(struct capture *c, uint8_t trigger, uint32_t trigger_at, uint32_t timestamp_us)
+{
+	uint32_t back = trigger_at - c->floor;
+
+	// pre < SC_BOARD_CAN_CAPTURE_FRAMES, the ring holds the frames before trigger_at
+	if (back > c->pre) {
+		back = c->pre;
+	}
+
+	c->out = trigger_at - back;
+	c->end = c->put + c->post;
+	c->trigger_at = trigger_at;
+	c->trigger_ts = timestamp_us;
+	c->trigger = trigger;
+	c->triggered = true;
+	c->marker_pending = true;
+}
+
+SC_RAMFUNC extern bool sc_can_capture_active(uint8_t index)
+{
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(captures));
+
+	return captures[index].active;
+}
+
+SC_RAMFUNC extern int sc_can_capture_rx(uint8_t index, uint8_t *ptr, int bytes)
+{
+	struct capture *c = &captures[index];
+	uint8_t *in_ptr = ptr;
+	uint8_t *const in_end = ptr + bytes;
+	uint8_t *out_ptr = ptr;
+
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(captures));
+	SC_DEBUG_ASSERT(c->active);
+
+	while (in_ptr < in_end) {
+		struct sc_msg_header const *hdr = (struct sc_msg_header const *)in_ptr;
+		uint8_t const len = hdr->len;
+
+		SC_DEBUG_ASSERT(len && in_ptr + len <= in_end);
+
+		if (SC_MSG_CAN_RX == hdr->id) {
+			struct sc_msg_can_rx const *msg = (struct sc_msg_can_rx const *)hdr;
+
+			SC_DEBUG_ASSERT(len <= sizeof(c->slots[0]));
+
+			if (likely(!c->done)) {
+				if (c->triggered && c->put - c->out == SC_BOARD_CAN_CAPTURE_FRAMES) {
+					// window not sent fast enough
+					++c->out;
+
+					if (likely(c->lost != UINT16_MAX)) {
+						++c->lost;
+					}
+				}
+
+				memcpy(c->slots[c->put % SC_BOARD_CAN_CAPTURE_FRAMES], msg, len);
+				++c->put;
+
+				if (!c->triggered && capture_frame_match(c, msg)) {
+					capture_trigger(c, c->triggers & (SC_CAPTURE_TRIGGER_ID | SC_CAPTURE_TRIGGER_DATA), c->put - 1, msg->timestamp_us);
+				}
+			}
+		} else {
+			if (out_ptr != in_ptr) {
+				memmove(out_ptr, in_ptr, len);
+			}
+
+			out_ptr += len;
+		}
+
+		in_ptr += len;
+	}
+
+	return out_ptr - ptr;
+}
+
+SC_RAMFUNC extern void sc_can_capture_event(uint8_t index, uint8_t trigger, uint32_t timestamp_us)
+{
+	struct capture *c = &captures[index];
+
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(captures));
+
+	if (!c->active || c->done || c->triggered || !(c->triggers & trigger)) {
+		return;
+	}
+
+	capture_trigger(c, trigger, c->put, timestamp_us);
+}
+
+SC_RAMFUNC extern int sc_can_capture_place(uint8_t index, uint8_t *tx_ptr, uint8_t *tx_end)
+{
+	struct capture *c = &captures[index];
+	uint8_t *const tx_beg = tx_ptr;
+
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(captures));
+
+	if (!c->triggered) {
+		return -1;
+	}
+
+	if (c->marker_pending) {
+		struct sc_msg_capture *msg = (struct sc_msg_capture *)tx_ptr;
+
+		if ((size_t)(tx_end - tx_ptr) < sizeof(*msg)) {
+			return 0;
+		}
+
+		c->marker_pending = false;
+
+		msg->id = SC_MSG_CAPTURE;
+		msg->len = sizeof(*msg);
+		msg->trigger = c->trigger;
+		msg->unused = 0;
+		msg->timestamp_us = c->trigger_ts;
+		msg->pre = (int32_t)(c->trigger_at - c->out) > 0 ? c->trigger_at - c->out : 0;
+		msg->post = c->post;
+		msg->depth = SC_BOARD_CAN_CAPTURE_FRAMES;
+		msg->lost = c->lost;
+		c->lost = 0;
+
+		tx_ptr += sizeof(*msg);
+	}
+
+	while (c->out != c->end && c->out != c->put) {
+		struct sc_msg_can_rx const *msg = (struct sc_msg_can_rx const *)c->slots[c->out % SC_BOARD_CAN_CAPTURE_FRAMES];
+
+		if ((size_t)(tx_end - tx_ptr) < msg->len) {
+			return tx_ptr - tx_beg;
+		}
+
+		memcpy(tx_ptr, msg, msg->len);
+		tx_ptr += msg->len;
+		++c->out;
+	}
+
+	if (c->out == c->end) {
+		c->triggered = false;
+		c->floor = c->end;
+		c->done = (c->flags & SC_CAPTURE_FLAG_ONESHOT) == SC_CAPTURE_FLAG_ONESHOT;
+	}
+
+	// waiting for post frames
+	return tx_ptr == tx_beg ? -1 : tx_ptr - tx_beg;
+}
+
+extern void sc_can_capture_reset(uint8_t index)
+{
+	struct capture *c = &captures[index];
+
+	memset(c, 0, sizeof(*c));
+}
+
+extern void sc_can_capture_set(uint8_t index, struct sc_msg_capture_set const *msg)
+{
+	struct capture *c = &captures[index];
+
+	SC_DEBUG_ASSERT(msg->pre < SC_BOARD_CAN_CAPTURE_FRAMES);
+
+	c->flags = msg->flags;
+	c->triggers = msg->triggers;
+	c->pre = msg->pre;
+	c->post = msg->post;
+	c->can_id = msg->can_id;
+	c->can_id_mask = msg->can_id_mask;
+	memcpy(c->data, msg->data, sizeof(c->data));
+	memcpy(c->data_mask, msg->data_mask, sizeof(c->data_mask));
+}
+
+extern void sc_can_capture_enable(uint8_t index, bool on)
+{
+	struct capture *c = &captures[index];
+
+	c->active = on && (c->flags & SC_CAPTURE_FLAG_ENABLE) == SC_CAPTURE_FLAG_ENABLE;
+	c->put = 0;
+	c->out = 0;
+	c->end = 0;
+	c->floor = 0;
+	c->lost = 0;
+	c->triggered = false;
+	c->marker_pending = false;
+	c->done = false;
+}
+
+extern bool sc_can_capture_configured(uint8_t index)
+{
+	return (captures[index].flags & SC_CAPTURE_FLAG_ENABLE) == SC_CAPTURE_FLAG_ENABLE;
+}
@@ -22,14 +22,37 @@
 #include <supercan_m1.h>
 #include <usb_descriptors.h>
 #include <leds.h>
+#include <sw_filter.h>
+#include <bus_stats.h>
+#include <capture.h>
+#include <autobaud.h>
+#include <tx_gen.h>
+#include <timebase.h>
 
 
 enum {
 	CAN_STATUS_FIFO_SIZE = 256,
+	TXR_BATCH_LEN_MAX = 252, // largest multiple of SC_MSG_CAN_LEN_MULTIPLE that fits len
+	RX_COMPACT_LEN_MAX = 252,
+	AUTOBAUD_TIMEOUT_MS_DEFAULT = 20,
+	AUTOBAUD_TIMEOUT_MS_MAX = 100,
+	AUTOBAUD_FRAMES_MIN = 2, // a single frame could pass the CRC by chance
 };
 
 #define SPAM 0
 
+/* Log a histogram of how long the CAN task waits for a free IN bank, see sim/README.md */
+#ifndef SUPERCAN_LATENCY_HIST
+#	define SUPERCAN_LATENCY_HIST 0
+#endif
+
+/* Sleep this many ms when the IN banks are busy instead of waiting
+ * for the transfer to complete (previous behavior), for comparison.
+ */
+#ifndef SUPERCAN_CAN_TASK_BACKOFF_MS
+#	define SUPERCAN_CAN_TASK_BACKOFF_MS 0
+#endif
+
 
 
 extern void sc_can_log_bit_timing(sc_can_bit_timing const *c, char const* name)
@@ -55,14 +78,47 @@ static void tusb_device_task(void* param);
 
 
 
+/* The USB task and the CAN task hand buffers to each other without locks.
+ *
+ * IN buffers form a ring. The CAN task fills the bank at tx_bank and
+ * submits it by advancing tx_bank. The banks from tx_get_index up to
+ * tx_bank are transferred in order, the USB task advances tx_get_index
+ * as transfers complete. Whoever sets tx_ep_busy starts the next transfer.
+ *
+ * OUT buffers are passed the other way, the USB task publishes completed
+ * transfers through rx_put_index, the CAN task processes them and
+ * advances rx_get_index. Whoever sets rx_ep_armed arms the endpoint on
+ * the next free buffer.
+ *
+ * The mutex only serializes the CAN task with reconfiguration through
+ * the command pipe and USB bus events.
+ */
 struct usb_can {
-	CFG_TUSB_MEM_ALIGN uint8_t tx_buffers[2][MSG_BUFFER_SIZE];
+	CFG_TUSB_MEM_ALIGN uint8_t tx_buffers[SC_BOARD_USB_MSG_BANKS][SC_BOARD_MSG_BUFFER_SIZE_MAX];
 	CFG_TUSB_MEM_ALIGN uint8_t rx_buffers[2][MSG_BUFFER_SIZE];
 	StaticSemaphore_t mutex_mem;
 	SemaphoreHandle_t mutex_handle;
-	uint16_t tx_offsets[2];
+	uint16_t tx_offsets[SC_BOARD_USB_MSG_BANKS];
+	uint16_t rx_lens[2];
+	uint16_t tx_banks_busy; // summed for until next SC_MSG_CAN_STATUS
+	uint16_t tx_buffer_size; // negotiated at SC_MSG_HELLO_DEVICE
+	uint32_t tx_bank_ts_us; // time the first message was placed in the bank being filled
+	uint32_t flush_deadline_us;
+	uint8_t flush_fill_percent;
+	bool flush_now; // priority frame in the bank being filled
+	uint8_t *txr_open; // batched receipt message placed last in the bank being filled, see sc_can_txr_place
+	uint8_t *rx_compact_open; // compact rx message placed last in the bank being filled, see sc_can_rx_msg_place
+	uint32_t rx_ts_base_us; // timestamp of the last rx frame placed
 	uint8_t tx_bank;
-	uint8_t rx_bank;
+	uint8_t tx_get_index;
+	uint8_t rx_put_index; // NOT an index, uses full range of type
+	uint8_t rx_get_index; // NOT an index, uses full range of type
+	bool tx_ep_busy;
+	bool tx_zlp; // zero length transfer in flight
+	bool tx_zlp_due; // zero length transfer after the one in flight
+	bool rx_ep_armed;
+	bool tx_bank_ts_valid;
+	bool rx_ts_base_valid;
 	uint8_t pipe;
 };
 
@@ -83,8 +139,31 @@ static struct usb {
 	bool mounted;
 } usb;
 
+enum {
+	AUTOBAUD_IDLE,
+	AUTOBAUD_RUNNING,
+	AUTOBAUD_DONE, // result not queued yet
+};
+
+/* SC_MSG_AUTOBAUD sweep, run by the CAN task */
+struct autobaud {
+	struct sc_msg_autobaud_result result;
+	sc_can_bit_timing bt; // being probed
+	TickType_t start_ts;
+	TickType_t probe_ts;
+	uint16_t timeout_ms;
+	uint8_t rate; // candidate index into sc_autobaud_nm_rates respectively sc_autobaud_dt_rates
+	uint8_t frames;
+	uint8_t state;
+	bool data; // probing data bitrates
+	bool probing; // on bus at bt
+};
+
 static struct can {
 	sc_can_status status_fifo[CAN_STATUS_FIFO_SIZE];
+	struct autobaud autobaud;
+	sc_can_bit_timing nm_bt; // as configured, restored after SC_MSG_AUTOBAUD
+	sc_can_bit_timing dt_bt;
 	StackType_t usb_task_stack_mem[3*configMINIMAL_SECURE_STACK_SIZE];
 	StaticTask_t usb_task_mem;
 	TaskHandle_t usb_task_handle;
@@ -94,6 +173,9 @@ static struct can {
 	uint16_t rx_lost;    // summed for until next SC_MSG_CAN_STATUS
 	uint16_t status_get_index; // NOT an index, uses full range of type
 	uint16_t status_put_index; // NOT an index, uses full range of type
+	uint16_t time_sync_interval_ms; // SC_MSG_TIME_SYNC_SET, 0 if off
+	uint16_t bus_stats_interval_ms; // SC_MSG_BUS_STATS_SET, 0 if off
+	uint8_t txr_mode; // SC_MSG_TXR_MODE
 	uint8_t int_comm_flags;
 	bool enabled;
 	bool desync;
@@ -127,26 +209,232 @@ static inline void can_state_reset(uint8_t index)
 	__atomic_store_n(&can->status_get_index, __atomic_load_n(&can->status_put_index, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
 	__atomic_store_n(&can->int_comm_flags, 0, __ATOMIC_RELAXED);
 
-	usb_can->tx_offsets[0] = 0;
-	usb_can->tx_offsets[1] = 0;
+	// discard the bank being filled, submitted banks are still transferred
+	usb_can->tx_offsets[usb_can->tx_bank] = 0;
+	usb_can->tx_banks_busy = 0;
+	usb_can->tx_bank_ts_valid = false;
+	usb_can->flush_now = false;
+	usb_can->txr_open = NULL;
+	usb_can->rx_compact_open = NULL;
+	usb_can->rx_ts_base_valid = false;
 }
 
 static inline void can_state_initial(uint8_t index)
 {
 	struct can *can = &cans[index];
 	struct usb_cmd *cmd = &usb.cmd[index];
+	struct usb_can *usb_can = &usb.can[index];
 
 	cmd->tx_offsets[0] = 0;
 	cmd->tx_offsets[1] = 0;
 
+	usb_can->tx_buffer_size = MSG_BUFFER_SIZE;
+	usb_can->flush_fill_percent = 0;
+	usb_can->flush_deadline_us = 0;
+
+	if (AUTOBAUD_IDLE != can->autobaud.state) {
+		sc_board_can_go_bus(index, false);
+		__atomic_store_n(&can->autobaud.state, AUTOBAUD_IDLE, __ATOMIC_RELEASE);
+	}
+
 	can->enabled = false;
 	can->features = sc_board_can_feat_perm(index);
+	can->time_sync_interval_ms = 0;
+	can->bus_stats_interval_ms = 0;
+	can->txr_mode = SC_TXR_MODE_SINGLE;
 
 	can_state_reset(index);
 	sc_board_can_reset(index);
+	// bit timings the board resets to
+	can->nm_bt = sc_board_can_nm_bit_timing_range(index)->min;
+	can->dt_bt = sc_board_can_dt_bit_timing_range(index) ? sc_board_can_dt_bit_timing_range(index)->min : can->nm_bt;
+	sc_can_sw_filter_reset(index);
+	sc_can_bus_stats_reset(index);
+	sc_can_capture_reset(index);
+	sc_can_gen_reset(index);
 	sc_board_led_can_status_set(index, SC_CAN_LED_STATUS_ENABLED_OFF_BUS);
 }
 
+/* features implemented independent of the board */
+static inline uint16_t sc_can_feat_conf(uint8_t index)
+{
+	return sc_board_can_feat_conf(index) | SC_FEATURE_FLAG_SWF | SC_FEATURE_FLAG_GEN;
+}
+
+static inline bool sc_can_autobaud_busy(uint8_t index)
+{
+	return AUTOBAUD_IDLE != __atomic_load_n(&cans[index].autobaud.state, __ATOMIC_ACQUIRE);
+}
+
+/* SC_MSG_AUTOBAUD, off bus, with lock */
+static void sc_can_autobaud_start(uint8_t index, struct sc_msg_autobaud const *msg)
+{
+	struct autobaud *a = &cans[index].autobaud;
+
+	memset(a, 0, sizeof(*a));
+	a->result.id = SC_MSG_AUTOBAUD_RESULT;
+	a->result.len = sizeof(a->result);
+	a->result.flags = msg->flags & SC_AUTOBAUD_FLAG_FD;
+	a->timeout_ms = msg->timeout_ms ? msg->timeout_ms : AUTOBAUD_TIMEOUT_MS_DEFAULT;
+	a->start_ts = xTaskGetTickCount();
+
+	// frames must reach the probe unfiltered and as SC_MSG_CAN_RX (no SC_FEATURE_FLAG_CRX)
+	sc_can_sw_filter_enable(index, false);
+	sc_can_bus_stats_enable(index, false);
+	sc_board_can_feat_set(index, SC_FEATURE_FLAG_MON_MODE);
+
+	__atomic_store_n(&a->state, AUTOBAUD_RUNNING, __ATOMIC_RELEASE);
+}
+
+/* keeps detected bit timings, restores everything else the sweep changed */
+static void sc_can_autobaud_finish(uint8_t index)
+{
+	struct can *can = &cans[index];
+	struct autobaud *a = &can->autobaud;
+
+	sc_board_can_nm_bit_timing_set(index, &can->nm_bt);
+
+	if (sc_board_can_dt_bit_timing_range(index)) {
+		sc_board_can_dt_bit_timing_set(index, &can->dt_bt);
+	}
+
+	sc_board_can_feat_set(index, can->features);
+
+	a->result.elapsed_ms = (xTaskGetTickCount() - a->start_ts) * portTICK_PERIOD_MS;
+	__atomic_store_n(&a->state, AUTOBAUD_DONE, __ATOMIC_RELEASE);
+
+	LOG("ch%u autobaud flags=%#x nm=%lu dt=%lu in %u [ms]\n", index, a->result.flags, (unsigned long)a->result.nm_bitrate, (unsigned long)a->result.dt_bitrate, a->result.elapsed_ms);
+}
+
+/* Advances the SC_MSG_AUTOBAUD sweep, CAN task with lock, off bus.
+ *
+ * Each candidate bitrate is probed by listening until AUTOBAUD_FRAMES_MIN
+ * frames (with BRS for data bitrates) arrived, an error occurred or the
+ * timeout elapsed. Called every tick while running.
+ *
+ * return  true once the result is ready
+ */
+static bool sc_can_autobaud_step(uint8_t index)
+{
+	struct can *can = &cans[index];
+	struct autobaud *a = &can->autobaud;
+	struct sc_msg_autobaud_result *rep = &a->result;
+
+	if (a->probing) {
+		uint32_t scratch[(sizeof(struct sc_msg_can_rx) + 64 + 3) / 4];
+		uint8_t * const beg = (uint8_t *)scratch;
+		uint8_t * const end = beg + sizeof(scratch);
+		uint16_t const status_put_index = __atomic_load_n(&can->status_put_index, __ATOMIC_ACQUIRE);
+		bool error = false;
+
+		for (; can->status_get_index != status_put_index; ) {
+			sc_can_status const *s = &can->status_fifo[can->status_get_index % TU_ARRAY_SIZE(can->status_fifo)];
+
+			if (SC_CAN_STATUS_FIFO_TYPE_BUS_ERROR == s->type && s->bus_error.code) {
+				error = true;
+			}
+
+			__atomic_store_n(&can->status_get_index, can->status_get_index+1, __ATOMIC_RELEASE);
+		}
+
+		// local buffer, the bank being filled may hold messages
+		for (int bytes = sc_board_can_retrieve(index, beg, end); bytes > 0; bytes = sc_board_can_retrieve(index, beg, end)) {
+			for (uint8_t const *ptr = beg; ptr < beg + bytes; ptr += ((struct sc_msg_header const *)ptr)->len) {
+				struct sc_msg_can_rx const *msg = (struct sc_msg_can_rx const *)ptr;
+
+				if (SC_MSG_CAN_RX == msg->id && (!a->data || (msg->flags & SC_CAN_FRAME_FLAG_BRS)) && a->frames < UINT8_MAX) {
+					++a->frames;
+				}
+			}
+		}
+
+		if (!error && a->frames < AUTOBAUD_FRAMES_MIN && xTaskGetTickCount() - a->probe_ts < pdMS_TO_TICKS(a->timeout_ms)) {
+			return false;
+		}
+
+		sc_board_can_go_bus(index, false);
+		can_state_reset(index);
+		a->probing = false;
+
+		if (error || a->frames < AUTOBAUD_FRAMES_MIN) {
+			++a->rate;
+		} else if (a->data) {
+			rep->flags |= SC_AUTOBAUD_FLAG_DT_FOUND;
+			rep->dt_bitrate = sc_bitrate(a->bt.brp, a->bt.tseg1, a->bt.tseg2);
+			rep->dtbt_brp = a->bt.brp;
+			rep->dtbt_tseg1 = a->bt.tseg1;
+			rep->dtbt_sjw = a->bt.sjw;
+			rep->dtbt_tseg2 = a->bt.tseg2;
+			can->dt_bt = a->bt;
+			sc_can_bus_stats_dt_bitrate_set(index, rep->dt_bitrate);
+			LOG("ch%u ", index);
+			sc_can_log_bit_timing(&a->bt, "autobaud data");
+			sc_can_autobaud_finish(index);
+			return true;
+		} else {
+			rep->flags |= SC_AUTOBAUD_FLAG_NM_FOUND;
+			rep->nm_bitrate = sc_bitrate(a->bt.brp, a->bt.tseg1, a->bt.tseg2);
+			rep->nmbt_brp = a->bt.brp;
+			rep->nmbt_tseg1 = a->bt.tseg1;
+			rep->nmbt_sjw = a->bt.sjw;
+			rep->nmbt_tseg2 = a->bt.tseg2;
+			can->nm_bt = a->bt;
+			sc_can_bus_stats_nm_bitrate_set(index, rep->nm_bitrate);
+			LOG("ch%u ", index);
+			sc_can_log_bit_timing(&a->bt, "autobaud nominal");
+
+			if (!(rep->flags & SC_AUTOBAUD_FLAG_FD) || !sc_board_can_dt_bit_timing_range(index)) {
+				sc_can_autobaud_finish(index);
+				return true;
+			}
+
+			a->data = true;
+			a->rate = 0;
+			sc_board_can_feat_set(index, SC_FEATURE_FLAG_MON_MODE | SC_FEATURE_FLAG_FDF);
+		}
+	}
+
+	// next candidate
+	if (a->data) {
+		sc_can_bit_timing_range const *dt_range = sc_board_can_dt_bit_timing_range(index);
+
+		for (; a->rate < sc_autobaud_dt_rate_count; ++a->rate) {
+			if (sc_autobaud_dt_rates[a->rate].bitrate > rep->nm_bitrate && sc_autobaud_bit_timing(&sc_autobaud_dt_rates[a->rate], dt_range, &a->bt)) {
+				break;
+			}
+		}
+
+		if (a->rate == sc_autobaud_dt_rate_count) {
+			sc_can_autobaud_finish(index);
+			return true;
+		}
+
+		sc_board_can_dt_bit_timing_set(index, &a->bt);
+	} else {
+		sc_can_bit_timing_range const *nm_range = sc_board_can_nm_bit_timing_range(index);
+
+		for (; a->rate < sc_autobaud_nm_rate_count; ++a->rate) {
+			if (sc_autobaud_bit_timing(&sc_autobaud_nm_rates[a->rate], nm_range, &a->bt)) {
+				break;
+			}
+		}
+
+		if (a->rate == sc_autobaud_nm_rate_count) {
+			sc_can_autobaud_finish(index);
+			return true;
+		}
+
+		sc_board_can_nm_bit_timing_set(index, &a->bt);
+	}
+
+	a->frames = 0;
+	a->probe_ts = xTaskGetTickCount();
+	a->probing = true;
+	sc_board_can_go_bus(index, true);
+
+	return false;
+}
+
 static inline bool sc_cmd_bulk_in_ep_ready(uint8_t index)
 {
 	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(usb.cmd));
@@ -164,20 +452,128 @@ static inline void sc_cmd_bulk_in_submit(uint8_t index)
 	cmd->tx_bank = !cmd->tx_bank;
 }
 
+SC_RAMFUNC static inline uint8_t sc_can_bulk_in_bank_next(uint8_t bank)
+{
+	return bank + 1 == SC_BOARD_USB_MSG_BANKS ? 0 : bank + 1;
+}
+
+/* true if there is a free bank to switch to after submitting the current one, CAN task */
 SC_RAMFUNC static inline bool sc_can_bulk_in_ep_ready(uint8_t index)
 {
 	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(usb.can));
 	struct usb_can *can = &usb.can[index];
-	return 0 == can->tx_offsets[!can->tx_bank];
+	uint8_t const gi = __atomic_load_n(&can->tx_get_index, __ATOMIC_ACQUIRE);
+	uint8_t const queued = can->tx_bank >= gi ? can->tx_bank - gi : can->tx_bank + SC_BOARD_USB_MSG_BANKS - gi;
+
+	return queued + 1 < SC_BOARD_USB_MSG_BANKS;
 }
 
+/* start transfer of the oldest submitted bank unless a transfer is in progress
+ *
+ * Called by the CAN task after submitting a bank and by the USB task on
+ * transfer completion. tx_get_index only changes while tx_ep_busy is set.
+ */
+SC_RAMFUNC static void sc_can_bulk_in_start(uint8_t index)
+{
+	struct usb_can *can = &usb.can[index];
+
+	for (;;) {
+		uint8_t gi = 0;
+
+		if (__atomic_exchange_n(&can->tx_ep_busy, true, __ATOMIC_ACQUIRE)) {
+			return;
+		}
+
+		gi = can->tx_get_index;
+
+		if (gi != __atomic_load_n(&can->tx_bank, __ATOMIC_ACQUIRE)) {
+			(void)dcd_edpt_xfer(usb.port, 0x80 | can->pipe, can->tx_buffers[gi], can->tx_offsets[gi]);
+			return;
+		}
+
+		__atomic_store_n(&can->tx_ep_busy, false, __ATOMIC_RELEASE);
+
+		// bank submitted in between?
+		if (gi == __atomic_load_n(&can->tx_bank, __ATOMIC_ACQUIRE)) {
+			return;
+		}
+	}
+}
+
+#if SUPERCAN_LATENCY_HIST
+enum {
+	LATENCY_HIST_BUCKETS = 16,
+	LATENCY_HIST_REPORT_US = 1000000,
+};
+
+/* bucket i counts waits < 2^i us, the last bucket everything longer */
+static struct latency_hist {
+	uint32_t buckets[LATENCY_HIST_BUCKETS];
+	uint32_t blocked_us;
+	uint32_t report_us;
+	uint32_t max_us;
+	bool blocked;
+} latency_hists[SC_BOARD_CAN_COUNT];
+
+SC_RAMFUNC static inline uint32_t latency_hist_now(uint8_t index)
+{
+	sc_board_can_ts_request(index);
+	return sc_board_can_ts_wait(index);
+}
+
+/* CAN task has data but all IN banks are in flight */
+SC_RAMFUNC static void latency_hist_blocked(uint8_t index)
+{
+	struct latency_hist *h = &latency_hists[index];
+
+	if (!h->blocked) {
+		h->blocked = true;
+		h->blocked_us = latency_hist_now(index);
+	}
+}
+
+SC_RAMFUNC static void latency_hist_submitted(uint8_t index)
+{
+	struct latency_hist *h = &latency_hists[index];
+	uint32_t now = 0;
+	uint32_t delta = 0;
+	unsigned bucket = 0;
+
+	if (likely(!h->blocked)) {
+		return;
+	}
+
+	now = latency_hist_now(index);
+	delta = (now - h->blocked_us) & SC_TS_MAX;
+	bucket = delta ? 32 - __builtin_clz(delta) : 0;
+	bucket = tu_min32(bucket, LATENCY_HIST_BUCKETS - 1);
+	h->blocked = false;
+
+	++h->buckets[bucket];
+	h->max_us = tu_max32(h->max_us, delta);
+
+	if (((now - h->report_us) & SC_TS_MAX) >= LATENCY_HIST_REPORT_US) {
+		h->report_us = now;
+
+		LOG("ch%u in wait max=%lu us", index, (unsigned long)h->max_us);
+		for (unsigned i = 0; i < LATENCY_HIST_BUCKETS; ++i) {
+			LOG(" %lu", (unsigned long)h->buckets[i]);
+		}
+		LOG("\n");
+
+		memset(h->buckets, 0, sizeof(h->buckets));
+		h->max_us = 0;
+	}
+}
+#endif
+
 SC_RAMFUNC static inline void sc_can_bulk_in_submit(uint8_t index, char const *func)
 {
 	SC_DEBUG_ASSERT(sc_can_bulk_in_ep_ready(index));
 	struct usb_can *can = &usb.can[index];
-	SC_DEBUG_ASSERT(can->tx_bank < 2);
+	SC_DEBUG_ASSERT(can->tx_bank < SC_BOARD_USB_MSG_BANKS);
 	SC_DEBUG_ASSERT(can->tx_offsets[can->tx_bank] > 0);
-	// SC_DEBUG_ASSERT(can->tx_offsets[can->tx_bank] <= MSG_BUFFER_SIZE);
+	// SC_DEBUG_ASSERT(can->tx_offsets[can->tx_bank] <= can->tx_buffer_size);
 
 	(void)func;
 
@@ -193,7 +589,7 @@ SC_RAMFUNC static inline void sc_can_bulk_in_submit(uint8_t index, char const *f
 
 
 	// LOG("ch%u %s: send %u bytes\n", index, func, can->tx_offsets[can->tx_bank]);
-	if (can->tx_offsets[can->tx_bank] > MSG_BUFFER_SIZE) {
+	if (can->tx_offsets[can->tx_bank] > can->tx_buffer_size) {
 		LOG("ch%u %s: msg buffer size %u out of bounds\n", index, func, can->tx_offsets[can->tx_bank]);
 		SC_DEBUG_ASSERT(false);
 		can->tx_offsets[can->tx_bank] = 0;
@@ -225,7 +621,7 @@ SC_RAMFUNC static inline void sc_can_bulk_in_submit(uint8_t index, char const *f
 		}
 
 		if (ptr + hdr->len > eptr) {
-			LOG("ch%u %s msg offset=%u len=%u exceeds buffer len=%u\n", index, func, ptr - sptr, hdr->len, MSG_BUFFER_SIZE);
+			LOG("ch%u %s msg offset=%u len=%u exceeds buffer len=%u\n", index, func, ptr - sptr, hdr->len, can->tx_buffer_size);
 			SC_DEBUG_ASSERT(false);
 			can->tx_offsets[can->tx_bank] = 0;
 			return;
@@ -240,6 +636,7 @@ SC_RAMFUNC static inline void sc_can_bulk_in_submit(uint8_t index, char const *f
 
 		switch (hdr->id) {
 		case SC_MSG_CAN_STATUS:
+		case SC_MSG_SW_FILTER_STATUS:
 			break;
 		case SC_MSG_CAN_RX: {
 			struct sc_msg_can_rx const *msg = (struct sc_msg_can_rx const *)hdr;
@@ -257,6 +654,37 @@ SC_RAMFUNC static inline void sc_can_bulk_in_submit(uint8_t index, char const *f
 			rx_ts_last = ts;
 			++rx_offset;
 		} break;
+		case SC_MSG_CAN_RX_COMPACT: {
+			struct sc_msg_can_rx_compact const *msg = (struct sc_msg_can_rx_compact const *)hdr;
+			uint8_t const *e_ptr = msg->records;
+			uint8_t const *e_end = ptr + msg->len - msg->pad;
+			uint8_t i = 0;
+
+			for (; i < msg->count; ++i) {
+				struct sc_can_rx_compact_frame const *e = (struct sc_can_rx_compact_frame const *)e_ptr;
+
+				if (e_ptr + sizeof(*e) > e_end) {
+					break;
+				}
+
+				e_ptr += sizeof(*e);
+				if (!(e->id_dlc & SC_CAN_RX_COMPACT_RTR)) {
+					e_ptr += dlc_to_len(e->id_dlc >> SC_CAN_RX_COMPACT_DLC_SHIFT);
+				}
+
+				if (rx_ts_last) {
+					rx_ts_last += e->timestamp_delta_us;
+				}
+				++rx_offset;
+			}
+
+			if (!msg->count || i != msg->count || e_ptr != e_end) {
+				LOG("ch%u %s msg offset=%u compact rx count=%u pad=%u mismatches len=%u\n", index, func, ptr - sptr, msg->count, msg->pad, hdr->len);
+				SC_DEBUG_ASSERT(false);
+				can->tx_offsets[can->tx_bank] = 0;
+				return;
+			}
+		} break;
 		case SC_MSG_CAN_TXR: {
 			struct sc_msg_can_txr const *msg = (struct sc_msg_can_txr const *)hdr;
 			uint32_t ts = msg->timestamp_us;
@@ -273,7 +701,14 @@ SC_RAMFUNC static inline void sc_can_bulk_in_submit(uint8_t index, char const *f
 			tx_ts_last = ts;
 			++tx_offset;
 		} break;
+		case SC_MSG_CAN_TXR_BATCH:
+		case SC_MSG_CAN_TXR_BITMAP:
+			tx_ts_last = 0;
+			break;
 		case SC_MSG_CAN_ERROR:
+		case SC_MSG_TIME_SYNC:
+		case SC_MSG_BUS_STATS:
+		case SC_MSG_CAPTURE:
 			break;
 		default:
 			LOG("ch%u %s msg offset %u non-device msg id %#02x\n", index, func, ptr - sptr, hdr->id);
@@ -289,9 +724,9 @@ SC_RAMFUNC static inline void sc_can_bulk_in_submit(uint8_t index, char const *f
 	// and the transfer size is a multiple of the endpoint size, and the
 	// tranfer size is smaller than the buffer size, we can either send a zlp
 	// or increase the payload size.
-	if (MSG_BUFFER_SIZE > SC_M1_EP_SIZE) { // FIX ME -> move to board file
+	if (can->tx_buffer_size > SC_M1_EP_SIZE) { // FIX ME -> move to board file
 		uint16_t offset = can->tx_offsets[can->tx_bank];
-		bool need_to_send_zlp = offset < MSG_BUFFER_SIZE && 0 == (offset % SC_M1_EP_SIZE);
+		bool need_to_send_zlp = offset < can->tx_buffer_size && 0 == (offset % SC_M1_EP_SIZE);
 		if (need_to_send_zlp) {
 			// LOG("zlpfix\n");
 			memset(&can->tx_buffers[can->tx_bank][offset], 0, 4);
@@ -300,15 +735,272 @@ SC_RAMFUNC static inline void sc_can_bulk_in_submit(uint8_t index, char const *f
 	}
 
 	// LOG("ch%u %s bytes=%u\n", index, func, can->tx_offsets[can->tx_bank]);
-	(void)dcd_edpt_xfer(usb.port, 0x80 | can->pipe, can->tx_buffers[can->tx_bank], can->tx_offsets[can->tx_bank]);
-	can->tx_bank = !can->tx_bank;
-	SC_DEBUG_ASSERT(!can->tx_offsets[can->tx_bank]);
+	uint8_t const next = sc_can_bulk_in_bank_next(can->tx_bank);
+
+	can->tx_offsets[next] = 0;
 #if SUPERCAN_DEBUG
-	memset(can->tx_buffers[can->tx_bank], 0xff, MSG_BUFFER_SIZE);
+	memset(can->tx_buffers[next], 0xff, can->tx_buffer_size);
+#endif
+	can->tx_bank_ts_valid = false;
+	can->flush_now = false;
+	can->txr_open = NULL;
+	can->rx_compact_open = NULL;
+
+	// publish
+	__atomic_store_n(&can->tx_bank, next, __ATOMIC_RELEASE);
+
+	sc_can_bulk_in_start(index);
+
+#if SUPERCAN_LATENCY_HIST
+	latency_hist_submitted(index);
 #endif
 	// LOG("ch%u %s sent\n", index, func);
 }
 
+/* Applies SC_MSG_FLUSH_POLICY to the bank being filled.
+ *
+ * return  0 if the bank should be submitted now
+ *         else the time in us until the deadline expires
+ */
+SC_RAMFUNC static uint32_t sc_can_bulk_in_flush_delay_us(uint8_t index)
+{
+	struct usb_can *can = &usb.can[index];
+	uint32_t const offset = can->tx_offsets[can->tx_bank];
+	uint32_t now = 0;
+	uint32_t age = 0;
+
+	SC_DEBUG_ASSERT(offset);
+
+	if (likely(!can->flush_fill_percent) || can->flush_now) {
+		return 0;
+	}
+
+	if (offset * 100 >= (uint32_t)can->tx_buffer_size * can->flush_fill_percent) {
+		return 0;
+	}
+
+	SC_DEBUG_ASSERT(can->tx_bank_ts_valid);
+
+	sc_board_can_ts_request(index);
+	now = sc_board_can_ts_wait(index);
+	age = now - can->tx_bank_ts_us;
+
+	return age >= can->flush_deadline_us ? 0 : can->flush_deadline_us - age;
+}
+
+SC_RAMFUNC extern void sc_can_bulk_in_flush_now(uint8_t index)
+{
+	usb.can[index].flush_now = true;
+}
+
+SC_RAMFUNC extern int sc_can_txr_place(uint8_t index, uint8_t *tx_ptr, uint8_t *tx_end, uint8_t track_id, uint8_t flags, uint32_t timestamp_us)
+{
+	struct can *can = &cans[index];
+	struct usb_can *usb_can = &usb.can[index];
+	uint8_t *open = usb_can->txr_open;
+	size_t const space = (size_t)(tx_end - tx_ptr);
+
+	timestamp_us = sc_timebase_map(timestamp_us);
+
+	// only extend the open message if nothing was placed after it
+	if (open && open + open[SC_MSG_HEADER_LEN_OFFSET] != tx_ptr) {
+		open = NULL;
+	}
+
+	switch (can->txr_mode) {
+	case SC_TXR_MODE_BATCH: {
+		struct sc_msg_can_txr_batch *msg = (struct sc_msg_can_txr_batch *)open;
+		struct sc_can_txr_element *e = NULL;
+		uint8_t bytes = sizeof(*e);
+
+		if (msg && (timestamp_us - msg->timestamp_us > UINT16_MAX || msg->len > TXR_BATCH_LEN_MAX - sizeof(*e))) {
+			msg = NULL;
+		}
+
+		if (!msg) {
+			bytes += sizeof(*msg);
+		}
+
+		if (unlikely(space < bytes)) {
+			return -1;
+		}
+
+		if (msg) {
+			e = (struct sc_can_txr_element *)tx_ptr;
+			msg->len += sizeof(*e);
+		} else {
+			msg = (struct sc_msg_can_txr_batch *)tx_ptr;
+			msg->id = SC_MSG_CAN_TXR_BATCH;
+			msg->len = bytes;
+			msg->unused[0] = 0;
+			msg->unused[1] = 0;
+			msg->timestamp_us = timestamp_us;
+			e = msg->elements;
+			usb_can->txr_open = tx_ptr;
+		}
+
+		e->flags = flags;
+		e->track_id = track_id;
+		e->timestamp_delta_us = (uint16_t)(timestamp_us - msg->timestamp_us);
+
+		return bytes;
+	}
+	case SC_TXR_MODE_BITMAP:
+		if (likely(track_id < 32)) {
+			struct sc_msg_can_txr_bitmap *msg = (struct sc_msg_can_txr_bitmap *)open;
+			uint32_t const bit = UINT32_C(1) << track_id;
+			uint8_t bytes = 0;
+
+			if (msg && ((msg->sent | msg->dropped) & bit)) {
+				msg = NULL;
+			}
+
+			if (!msg) {
+				bytes = sizeof(*msg);
+
+				if (unlikely(space < bytes)) {
+					return -1;
+				}
+
+				msg = (struct sc_msg_can_txr_bitmap *)tx_ptr;
+				msg->id = SC_MSG_CAN_TXR_BITMAP;
+				msg->len = bytes;
+				msg->unused[0] = 0;
+				msg->unused[1] = 0;
+				msg->sent = 0;
+				msg->dropped = 0;
+				usb_can->txr_open = tx_ptr;
+			}
+
+			if (flags & SC_CAN_FRAME_FLAG_DRP) {
+				msg->dropped |= bit;
+			} else {
+				msg->sent |= bit;
+			}
+
+			msg->timestamp_us = timestamp_us;
+
+			return bytes;
+		}
+		break;
+	}
+
+	struct sc_msg_can_txr *msg = (struct sc_msg_can_txr *)tx_ptr;
+
+	if (unlikely(space < sizeof(*msg))) {
+		return -1;
+	}
+
+	msg->id = SC_MSG_CAN_TXR;
+	msg->len = sizeof(*msg);
+	msg->flags = flags;
+	msg->track_id = track_id;
+	msg->timestamp_us = timestamp_us;
+
+	return sizeof(*msg);
+}
+
+SC_RAMFUNC extern uint8_t sc_can_rx_msg_place(
+	uint8_t index,
+	bool compact,
+	uint8_t *tx_ptr,
+	uint8_t *tx_end,
+	uint32_t can_id,
+	uint8_t dlc,
+	uint8_t flags,
+	uint32_t timestamp_us,
+	uint8_t data_len,
+	uint8_t **data)
+{
+	struct usb_can *usb_can = &usb.can[index];
+	size_t const space = (size_t)(tx_end - tx_ptr);
+	uint32_t delta = 0;
+	uint8_t bytes = 0;
+
+	timestamp_us = sc_timebase_map(timestamp_us);
+	delta = timestamp_us - usb_can->rx_ts_base_us;
+
+	compact = compact && usb_can->rx_ts_base_valid && delta <= UINT16_MAX && !(flags & ~SC_CAN_FRAME_FLAG_RTR);
+
+	if (compact) {
+		struct sc_msg_can_rx_compact *msg = (struct sc_msg_can_rx_compact *)usb_can->rx_compact_open;
+		struct sc_can_rx_compact_frame *e = NULL;
+		uint8_t const e_len = sizeof(*e) + data_len;
+		uint8_t used = 0;
+
+		// only extend the open message if nothing was placed after it
+		if (msg && ((uint8_t *)msg + msg->len != tx_ptr || msg->len - msg->pad + e_len > RX_COMPACT_LEN_MAX)) {
+			msg = NULL;
+		}
+
+		if (msg) {
+			// the record starts in the pad bytes of the open message
+			used = msg->len - msg->pad + e_len;
+		} else {
+			used = sizeof(*msg) + e_len;
+		}
+
+		bytes = (used + SC_MSG_CAN_LEN_MULTIPLE - 1) & ~(SC_MSG_CAN_LEN_MULTIPLE - 1);
+
+		if (msg) {
+			bytes -= msg->len;
+		}
+
+		if (unlikely(space < bytes)) {
+			return 0;
+		}
+
+		if (msg) {
+			e = (struct sc_can_rx_compact_frame *)((uint8_t *)msg + msg->len - msg->pad);
+			msg->len += bytes;
+			++msg->count;
+		} else {
+			msg = (struct sc_msg_can_rx_compact *)tx_ptr;
+			msg->id = SC_MSG_CAN_RX_COMPACT;
+			msg->len = bytes;
+			msg->count = 1;
+			e = (struct sc_can_rx_compact_frame *)msg->records;
+			usb_can->rx_compact_open = tx_ptr;
+		}
+
+		msg->pad = msg->len - used;
+		memset(e->data + data_len, 0, msg->pad);
+
+		e->id_dlc = (uint16_t)(can_id & SC_CAN_RX_COMPACT_ID_MASK) | ((uint16_t)dlc << SC_CAN_RX_COMPACT_DLC_SHIFT);
+		if (flags & SC_CAN_FRAME_FLAG_RTR) {
+			e->id_dlc |= SC_CAN_RX_COMPACT_RTR;
+		}
+		e->timestamp_delta_us = (uint16_t)delta;
+		*data = e->data;
+	} else {
+		struct sc_msg_can_rx *msg = (struct sc_msg_can_rx *)tx_ptr;
+
+		bytes = sizeof(*msg) + data_len;
+
+		// align
+		if (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1)) {
+			bytes += SC_MSG_CAN_LEN_MULTIPLE - (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1));
+		}
+
+		if (unlikely(space < bytes)) {
+			return 0;
+		}
+
+		msg->id = SC_MSG_CAN_RX;
+		msg->len = bytes;
+		msg->dlc = dlc;
+		msg->flags = flags;
+		msg->can_id = can_id;
+		msg->timestamp_us = timestamp_us;
+		*data = msg->data;
+	}
+
+	usb_can->rx_ts_base_us = timestamp_us;
+	usb_can->rx_ts_base_valid = true;
+
+	return bytes;
+}
+
 static void sc_cmd_bulk_out(uint8_t index, uint32_t xferred_bytes);
 static void sc_cmd_bulk_in(uint8_t index);
 SC_RAMFUNC static void sc_can_bulk_out(uint8_t index, uint32_t xferred_bytes);
@@ -363,10 +1055,38 @@ static void sc_cmd_bulk_out(uint8_t index, uint32_t xferred_bytes)
 
 			can_state_initial(index);
 
-			xSemaphoreGive(usb_can->mutex_handle);
+			// Hosts may ask for larger device -> host transfers. Previous
+			// protocol revisions send a shorter message, or zero.
+			if (msg->len >= sizeof(struct sc_msg_hello)) {
+				struct sc_msg_hello const *tmsg = (struct sc_msg_hello const *)msg;
+				uint16_t req = tu_ntohs(tmsg->msg_buffer_size);
 
-			// transmit empty buffers (clear whatever was in there before)
-			(void)dcd_edpt_xfer(usb.port, 0x80 | usb_can->pipe, usb_can->tx_buffers[usb_can->tx_bank], usb_can->tx_offsets[usb_can->tx_bank]);
+				if (req > MSG_BUFFER_SIZE) {
+					req = tu_min16(req, SC_BOARD_MSG_BUFFER_SIZE_MAX);
+					req &= ~(SC_MSG_CAN_LEN_MULTIPLE-1);
+					usb_can->tx_buffer_size = req;
+				}
+			}
+
+			LOG("ch%u msg buffer size %u\n", index, usb_can->tx_buffer_size);
+
+			// Drop the submitted banks and send a zero length transfer
+			// to clear whatever the host has buffered. A transfer in
+			// flight keeps its bank at tx_get_index, its completion
+			// (see sc_can_bulk_in) empties the ring and sends the ZLP.
+			memset(usb_can->tx_offsets, 0, sizeof(usb_can->tx_offsets));
+
+			if (__atomic_exchange_n(&usb_can->tx_ep_busy, true, __ATOMIC_ACQUIRE)) {
+				usb_can->tx_bank = usb_can->tx_zlp ? usb_can->tx_get_index : sc_can_bulk_in_bank_next(usb_can->tx_get_index);
+				usb_can->tx_zlp_due = true;
+			} else {
+				usb_can->tx_bank = 0;
+				usb_can->tx_get_index = 0;
+				usb_can->tx_zlp = true;
+				(void)dcd_edpt_xfer(usb.port, 0x80 | usb_can->pipe, usb_can->tx_buffers[0], 0);
+			}
+
+			xSemaphoreGive(usb_can->mutex_handle);
 
 			// reset tx buffer
 			uint8_t len = sizeof(struct sc_msg_hello);
@@ -381,6 +1101,7 @@ static void sc_cmd_bulk_out(uint8_t index, uint32_t xferred_bytes)
 			rep->byte_order = SC_BYTE_ORDER_LE;
 #endif
 			rep->cmd_buffer_size = tu_htons(CMD_BUFFER_SIZE);
+			rep->msg_buffer_size = tu_htons(usb_can->tx_buffer_size);
 
 			// don't process any more messages
 			in_ptr = in_end;
@@ -406,7 +1127,7 @@ send_dev_info:
 				rep->id = SC_MSG_DEVICE_INFO;
 				rep->len = bytes;
 				rep->feat_perm = sc_board_can_feat_perm(index);
-				rep->feat_conf = sc_board_can_feat_conf(index);
+				rep->feat_conf = sc_can_feat_conf(index);
 				rep->fw_ver_major = SUPERCAN_VERSION_MAJOR;
 				rep->fw_ver_minor = SUPERCAN_VERSION_MINOR;
 				rep->fw_ver_patch = SUPERCAN_VERSION_PATCH;
@@ -473,7 +1194,9 @@ send_can_info:
 				rep->dtbt_tseg2_max = dt_bt->max.tseg2;
 				rep->tx_fifo_size = SC_BOARD_CAN_TX_FIFO_SIZE;
 				rep->rx_fifo_size = SC_BOARD_CAN_RX_FIFO_SIZE;
-				rep->msg_buffer_size = MSG_BUFFER_SIZE;
+				rep->msg_buffer_size = usb_can->tx_buffer_size;
+				rep->gen_count = SC_BOARD_CAN_GEN_COUNT;
+				rep->tx_queue_count = SC_BOARD_CAN_TX_QUEUE_COUNT;
 
 				LOG("ch%u clk=%u ", index, SC_BOARD_CAN_CLK_HZ);
 				LOG("nm brp=%u..%u sjw=%u..%u tseg1=%u..%u tseg2=%u..%u\n",
@@ -489,6 +1212,37 @@ send_can_info:
 				}
 			}
 		} break;
+		case SC_MSG_FILTER_INFO: {
+			LOG("ch%u SC_MSG_FILTER_INFO\n", index);
+			uint8_t bytes = sizeof(struct sc_msg_filter_info);
+
+			uint8_t *out_ptr;
+			uint8_t *out_end;
+
+send_filter_info:
+			out_ptr = usb_cmd->tx_buffers[usb_cmd->tx_bank] + usb_cmd->tx_offsets[usb_cmd->tx_bank];
+			out_end = usb_cmd->tx_buffers[usb_cmd->tx_bank] + CMD_BUFFER_SIZE;
+			if (out_end - out_ptr >= bytes) {
+				struct sc_msg_filter_info *rep = (struct sc_msg_filter_info *)out_ptr;
+
+				usb_cmd->tx_offsets[usb_cmd->tx_bank] += bytes;
+
+				rep->id = SC_MSG_FILTER_INFO;
+				rep->len = bytes;
+				rep->std_count = SC_BOARD_CAN_FILTER_STD_COUNT;
+				rep->ext_count = SC_BOARD_CAN_FILTER_EXT_COUNT;
+				rep->sw_count = SC_BOARD_CAN_SW_FILTER_COUNT;
+				rep->prio = SC_BOARD_CAN_RX_PRIO;
+				memset(rep->unused, 0, sizeof(rep->unused));
+			} else {
+				if (sc_cmd_bulk_in_ep_ready(index)) {
+					sc_cmd_bulk_in_submit(index);
+					goto send_filter_info;
+				} else {
+					LOG("no space for filter info reply\n");
+				}
+			}
+		} break;
 		case SC_MSG_NM_BITTIMING: {
 			LOG("ch%u SC_MSG_NM_BITTIMING\n", index);
 			int8_t error = SC_CAN_ERROR_NONE;
@@ -496,6 +1250,9 @@ send_can_info:
 			if (unlikely(msg->len < sizeof(*tmsg))) {
 				LOG("ch%u ERROR: msg too short\n", index);
 				error = SC_ERROR_SHORT;
+			} else if (sc_can_autobaud_busy(index)) {
+				LOG("ch%u ERROR: autobaud running\n", index);
+				error = SC_ERROR_BUSY;
 			} else {
 				sc_can_bit_timing_range const *nm_bt = sc_board_can_nm_bit_timing_range(index);
 				sc_can_bit_timing bt_target;
@@ -506,71 +1263,356 @@ send_can_info:
 				bt_target.tseg1 = tu_max16(nm_bt->min.tseg1, tu_min16(tmsg->tseg1, nm_bt->max.tseg1));
 				bt_target.tseg2 = tu_max8(nm_bt->min.tseg2, tu_min8(tmsg->tseg2, nm_bt->max.tseg2));
 
-				LOG("ch%u ", index);
-				sc_can_log_bit_timing(&bt_target, "nominal");
+				LOG("ch%u ", index);
+				sc_can_log_bit_timing(&bt_target, "nominal");
+
+				can->nm_bt = bt_target;
+				sc_board_can_nm_bit_timing_set(index, &bt_target);
+				sc_can_bus_stats_nm_bitrate_set(index, sc_bitrate(bt_target.brp, bt_target.tseg1, bt_target.tseg2));
+			}
+
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_DT_BITTIMING: {
+			LOG("ch%u SC_MSG_DT_BITTIMING\n", index);
+			int8_t error = SC_CAN_ERROR_NONE;
+			struct sc_msg_bittiming const *tmsg = (struct sc_msg_bittiming const *)msg;
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else if (sc_can_autobaud_busy(index)) {
+				LOG("ch%u ERROR: autobaud running\n", index);
+				error = SC_ERROR_BUSY;
+			} else {
+				sc_can_bit_timing_range const *dt_bt = sc_board_can_dt_bit_timing_range(index);
+				sc_can_bit_timing bt_target;
+
+				// clamp
+				bt_target.brp = tu_max16(dt_bt->min.brp, tu_min16(tmsg->brp, dt_bt->max.brp));
+				bt_target.sjw = tu_max8(dt_bt->min.sjw, tu_min8(tmsg->sjw, dt_bt->max.sjw));
+				bt_target.tseg1 = tu_max16(dt_bt->min.tseg1, tu_min16(tmsg->tseg1, dt_bt->max.tseg1));
+				bt_target.tseg2 = tu_max8(dt_bt->min.tseg2, tu_min8(tmsg->tseg2, dt_bt->max.tseg2));
+
+				LOG("ch%u ", index);
+				sc_can_log_bit_timing(&bt_target, "data");
+
+				can->dt_bt = bt_target;
+				sc_board_can_dt_bit_timing_set(index, &bt_target);
+				sc_can_bus_stats_dt_bitrate_set(index, sc_bitrate(bt_target.brp, bt_target.tseg1, bt_target.tseg2));
+			}
+
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_FEATURES: {
+			LOG("ch%u SC_MSG_FEATURES\n", index);
+			struct sc_msg_features const *tmsg = (struct sc_msg_features const *)msg;
+			int8_t error = SC_ERROR_NONE;
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else {
+				const uint16_t perm = sc_board_can_feat_perm(index);
+				const uint16_t conf = sc_can_feat_conf(index);
+
+				switch (tmsg->op) {
+				case SC_FEAT_OP_CLEAR:
+					can->features = perm;
+					LOG("ch%u CLEAR features to %#x\n", index, can->features);
+					break;
+				case SC_FEAT_OP_OR: {
+					uint32_t mode_bits = tmsg->arg & (SC_FEATURE_FLAG_MON_MODE | SC_FEATURE_FLAG_RES_MODE | SC_FEATURE_FLAG_EXT_LOOP_MODE);
+
+					if (__builtin_popcount(mode_bits) > 1) {
+						error = SC_ERROR_PARAM;
+						LOG("ch%u ERROR: attempt to activate more than one mode %08lx\n", index, mode_bits);
+					} else if (tmsg->arg & ~(perm | conf)) {
+						error = SC_ERROR_UNSUPPORTED;
+						LOG("ch%u ERROR: unsupported features %08lx\n", index, tmsg->arg);
+					} else {
+						can->features |= tmsg->arg;
+						LOG("ch%u OR features to %#x\n", index, can->features);
+					}
+				} break;
+				}
+			}
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_FLUSH_POLICY: {
+			LOG("ch%u SC_MSG_FLUSH_POLICY\n", index);
+			struct sc_msg_flush_policy const *tmsg = (struct sc_msg_flush_policy const *)msg;
+			int8_t error = SC_ERROR_NONE;
+
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else if (tmsg->fill_percent > 100 || tmsg->deadline_us > 1000000 || (tmsg->fill_percent && (!tmsg->deadline_us || tmsg->deadline_us % 1000))) {
+				LOG("ch%u ERROR: invalid flush policy fill=%u%% deadline=%lu [us]\n", index, tmsg->fill_percent, (unsigned long)tmsg->deadline_us);
+				error = SC_ERROR_PARAM;
+			} else {
+				while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
+
+				usb_can->flush_fill_percent = tmsg->fill_percent;
+				usb_can->flush_deadline_us = tmsg->deadline_us;
+
+				xSemaphoreGive(usb_can->mutex_handle);
+
+				LOG("ch%u flush at fill=%u%% deadline=%lu [us]\n", index, tmsg->fill_percent, (unsigned long)tmsg->deadline_us);
+
+				// re-evaluate buffered messages
+				xTaskNotifyGive(can->usb_task_handle);
+			}
+
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_TIME_SYNC_SET: {
+			LOG("ch%u SC_MSG_TIME_SYNC_SET\n", index);
+			struct sc_msg_time_sync_set const *tmsg = (struct sc_msg_time_sync_set const *)msg;
+			int8_t error = SC_ERROR_NONE;
+
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else if (tmsg->interval_ms > 60000) {
+				LOG("ch%u ERROR: invalid time sync interval %u [ms]\n", index, tmsg->interval_ms);
+				error = SC_ERROR_PARAM;
+			} else {
+				while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
+
+				can->time_sync_interval_ms = tmsg->interval_ms;
+
+				xSemaphoreGive(usb_can->mutex_handle);
+
+				LOG("ch%u time sync every %u [ms]\n", index, tmsg->interval_ms);
+
+				// schedule the next sync
+				xTaskNotifyGive(can->usb_task_handle);
+			}
+
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_BUS_STATS_SET: {
+			LOG("ch%u SC_MSG_BUS_STATS_SET\n", index);
+			struct sc_msg_bus_stats_set const *tmsg = (struct sc_msg_bus_stats_set const *)msg;
+			int8_t error = SC_ERROR_NONE;
+
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else if (tmsg->interval_ms > 60000) {
+				LOG("ch%u ERROR: invalid bus stats interval %u [ms]\n", index, tmsg->interval_ms);
+				error = SC_ERROR_PARAM;
+			} else {
+				while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
+
+				if (can->enabled) {
+					sc_can_bus_stats_enable(index, tmsg->interval_ms != 0);
+				}
+
+				can->bus_stats_interval_ms = tmsg->interval_ms;
+
+				xSemaphoreGive(usb_can->mutex_handle);
+
+				LOG("ch%u bus stats every %u [ms]\n", index, tmsg->interval_ms);
+
+				// schedule the next report
+				xTaskNotifyGive(can->usb_task_handle);
+			}
+
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_CAPTURE_SET: {
+			LOG("ch%u SC_MSG_CAPTURE_SET\n", index);
+			struct sc_msg_capture_set const *tmsg = (struct sc_msg_capture_set const *)msg;
+			int8_t error = SC_ERROR_NONE;
+
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else if (can->enabled) {
+				LOG("ch%u ERROR: capture can only be configured off bus\n", index);
+				error = SC_ERROR_BUSY;
+			} else if (tmsg->pre >= SC_BOARD_CAN_CAPTURE_FRAMES || ((tmsg->flags & SC_CAPTURE_FLAG_ENABLE) && !tmsg->triggers)) {
+				LOG("ch%u ERROR: invalid capture pre=%u post=%u triggers=%#x\n", index, tmsg->pre, tmsg->post, tmsg->triggers);
+				error = SC_ERROR_PARAM;
+			} else {
+				sc_can_capture_set(index, tmsg);
+
+				LOG("ch%u capture flags=%#x triggers=%#x pre=%u post=%u\n", index, tmsg->flags, tmsg->triggers, tmsg->pre, tmsg->post);
+			}
+
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_AUTOBAUD: {
+			LOG("ch%u SC_MSG_AUTOBAUD\n", index);
+			struct sc_msg_autobaud const *tmsg = (struct sc_msg_autobaud const *)msg;
+			uint16_t const feat = sc_board_can_feat_perm(index) | sc_board_can_feat_conf(index);
+			int8_t error = SC_ERROR_NONE;
+
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else if (can->enabled || sc_can_autobaud_busy(index)) {
+				LOG("ch%u ERROR: autobaud can only be run off bus\n", index);
+				error = SC_ERROR_BUSY;
+			} else if (!(feat & SC_FEATURE_FLAG_MON_MODE) || ((tmsg->flags & SC_AUTOBAUD_FLAG_FD) && !(feat & SC_FEATURE_FLAG_FDF))) {
+				LOG("ch%u ERROR: autobaud unsupported\n", index);
+				error = SC_ERROR_UNSUPPORTED;
+			} else if (tmsg->timeout_ms > AUTOBAUD_TIMEOUT_MS_MAX) {
+				LOG("ch%u ERROR: invalid autobaud timeout %u [ms]\n", index, tmsg->timeout_ms);
+				error = SC_ERROR_PARAM;
+			}
+
+			if (!error) {
+				while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
+
+				sc_can_autobaud_start(index, tmsg);
+
+				xSemaphoreGive(usb_can->mutex_handle);
+
+				// sweep runs in the CAN task
+				xTaskNotifyGive(can->usb_task_handle);
+			}
+
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_TXR_MODE: {
+			LOG("ch%u SC_MSG_TXR_MODE\n", index);
+			struct sc_msg_txr_mode const *tmsg = (struct sc_msg_txr_mode const *)msg;
+			int8_t error = SC_ERROR_NONE;
+
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else if (can->enabled) {
+				LOG("ch%u ERROR: txr mode can only be changed off bus\n", index);
+				error = SC_ERROR_BUSY;
+			} else if (tmsg->mode > SC_TXR_MODE_BITMAP) {
+				LOG("ch%u ERROR: invalid txr mode %u\n", index, tmsg->mode);
+				error = SC_ERROR_PARAM;
+			} else {
+				can->txr_mode = tmsg->mode;
+
+				LOG("ch%u txr mode %u\n", index, tmsg->mode);
+			}
+
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_FILTER_SET: {
+			LOG("ch%u SC_MSG_FILTER_SET\n", index);
+			struct sc_msg_filter_set const *tmsg = (struct sc_msg_filter_set const *)msg;
+			int8_t error = SC_ERROR_NONE;
+
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else if (can->enabled) {
+				LOG("ch%u ERROR: filters can only be changed off bus\n", index);
+				error = SC_ERROR_BUSY;
+			} else {
+				bool const ext = (tmsg->flags & SC_FILTER_FLAG_EXT) == SC_FILTER_FLAG_EXT;
+				uint32_t const id_mask = ext ? 0x1fffffff : 0x7ff;
+				uint8_t const count = ext ? SC_BOARD_CAN_FILTER_EXT_COUNT : SC_BOARD_CAN_FILTER_STD_COUNT;
+
+				if (tmsg->index >= count || (tmsg->can_id & ~id_mask) || (tmsg->mask & ~id_mask)) {
+					LOG("ch%u ERROR: invalid filter %s index=%u id=%lx mask=%lx\n", index, ext ? "ext" : "std", tmsg->index, (unsigned long)tmsg->can_id, (unsigned long)tmsg->mask);
+					error = SC_ERROR_PARAM;
+				} else {
+					sc_can_filter const filter = {
+						.can_id = tmsg->can_id,
+						.mask = tmsg->mask,
+						.enabled = (tmsg->flags & SC_FILTER_FLAG_ENABLE) == SC_FILTER_FLAG_ENABLE,
+						.prio = (tmsg->flags & SC_FILTER_FLAG_PRIO) == SC_FILTER_FLAG_PRIO,
+					};
+
+					LOG("ch%u filter %s index=%u id=%lx mask=%lx enabled=%u prio=%u\n", index, ext ? "ext" : "std", tmsg->index, (unsigned long)filter.can_id, (unsigned long)filter.mask, filter.enabled, filter.prio);
 
-				sc_board_can_nm_bit_timing_set(index, &bt_target);
+					sc_board_can_filter_set(index, ext, tmsg->index, &filter);
+				}
 			}
 
 			sc_cmd_place_error_reply(index, error);
 		} break;
-		case SC_MSG_DT_BITTIMING: {
-			LOG("ch%u SC_MSG_DT_BITTIMING\n", index);
-			int8_t error = SC_CAN_ERROR_NONE;
-			struct sc_msg_bittiming const *tmsg = (struct sc_msg_bittiming const *)msg;
+		case SC_MSG_SW_FILTER_SET: {
+			LOG("ch%u SC_MSG_SW_FILTER_SET\n", index);
+			struct sc_msg_sw_filter_set const *tmsg = (struct sc_msg_sw_filter_set const *)msg;
+			int8_t error = SC_ERROR_NONE;
+
 			if (unlikely(msg->len < sizeof(*tmsg))) {
 				LOG("ch%u ERROR: msg too short\n", index);
 				error = SC_ERROR_SHORT;
+			} else if (can->enabled) {
+				LOG("ch%u ERROR: filters can only be changed off bus\n", index);
+				error = SC_ERROR_BUSY;
 			} else {
-				sc_can_bit_timing_range const *dt_bt = sc_board_can_dt_bit_timing_range(index);
-				sc_can_bit_timing bt_target;
-
-				// clamp
-				bt_target.brp = tu_max16(dt_bt->min.brp, tu_min16(tmsg->brp, dt_bt->max.brp));
-				bt_target.sjw = tu_max8(dt_bt->min.sjw, tu_min8(tmsg->sjw, dt_bt->max.sjw));
-				bt_target.tseg1 = tu_max16(dt_bt->min.tseg1, tu_min16(tmsg->tseg1, dt_bt->max.tseg1));
-				bt_target.tseg2 = tu_max8(dt_bt->min.tseg2, tu_min8(tmsg->tseg2, dt_bt->max.tseg2));
+				uint32_t const id_max = (tmsg->flags & SC_FILTER_FLAG_EXT) ? 0x1fffffff : 0x7ff;
 
-				LOG("ch%u ", index);
-				sc_can_log_bit_timing(&bt_target, "data");
+				if (tmsg->index >= SC_BOARD_CAN_SW_FILTER_COUNT || tmsg->can_id_lo > tmsg->can_id_hi || tmsg->can_id_hi > id_max) {
+					LOG("ch%u ERROR: invalid sw filter index=%u id=%lx..%lx\n", index, tmsg->index, (unsigned long)tmsg->can_id_lo, (unsigned long)tmsg->can_id_hi);
+					error = SC_ERROR_PARAM;
+				} else {
+					LOG("ch%u sw filter index=%u flags=%#x id=%lx..%lx interval=%lu [us]\n", index, tmsg->index, tmsg->flags, (unsigned long)tmsg->can_id_lo, (unsigned long)tmsg->can_id_hi, (unsigned long)tmsg->interval_us);
 
-				sc_board_can_dt_bit_timing_set(index, &bt_target);
+					sc_can_sw_filter_set(index, tmsg->index, tmsg);
+				}
 			}
 
 			sc_cmd_place_error_reply(index, error);
 		} break;
-		case SC_MSG_FEATURES: {
-			LOG("ch%u SC_MSG_FEATURES\n", index);
-			struct sc_msg_features const *tmsg = (struct sc_msg_features const *)msg;
+		case SC_MSG_GEN_SET: {
+			LOG("ch%u SC_MSG_GEN_SET\n", index);
+			struct sc_msg_gen_set const *tmsg = (struct sc_msg_gen_set const *)msg;
 			int8_t error = SC_ERROR_NONE;
+
 			if (unlikely(msg->len < sizeof(*tmsg))) {
 				LOG("ch%u ERROR: msg too short\n", index);
 				error = SC_ERROR_SHORT;
 			} else {
-				const uint16_t perm = sc_board_can_feat_perm(index);
-				const uint16_t conf = sc_board_can_feat_conf(index);
+				bool const ext = (tmsg->can_flags & SC_CAN_FRAME_FLAG_EXT) == SC_CAN_FRAME_FLAG_EXT;
+				bool const fdf = (tmsg->can_flags & SC_CAN_FRAME_FLAG_FDF) == SC_CAN_FRAME_FLAG_FDF;
+				bool const rtr = (tmsg->can_flags & SC_CAN_FRAME_FLAG_RTR) == SC_CAN_FRAME_FLAG_RTR;
+				uint32_t const id_max = ext ? 0x1fffffff : 0x7ff;
+				uint8_t const can_frame_len = rtr ? 0 : dlc_to_len(tmsg->dlc);
+				bool valid = tmsg->index < SC_BOARD_CAN_GEN_COUNT && tmsg->period_us >= 1000 * portTICK_PERIOD_MS && tmsg->burst;
+
+				valid = valid && tmsg->can_id <= id_max && tmsg->dlc <= 15 && (fdf || tmsg->dlc <= 8) && !(fdf && rtr);
+				valid = valid && (!(tmsg->flags & SC_GEN_FLAG_COUNTER) || tmsg->counter_offset < can_frame_len);
+				valid = valid && (!(tmsg->flags & SC_GEN_FLAG_CHECKSUM) || tmsg->checksum_offset < can_frame_len);
+				valid = valid && ((tmsg->flags & (SC_GEN_FLAG_COUNTER | SC_GEN_FLAG_CHECKSUM)) != (SC_GEN_FLAG_COUNTER | SC_GEN_FLAG_CHECKSUM) || tmsg->counter_offset != tmsg->checksum_offset);
+
+				if (!valid) {
+					LOG("ch%u ERROR: invalid generator index=%u id=%lx dlc=%u period=%lu [us] burst=%u\n", index, tmsg->index, (unsigned long)tmsg->can_id, tmsg->dlc, (unsigned long)tmsg->period_us, tmsg->burst);
+					error = SC_ERROR_PARAM;
+				} else {
+					LOG("ch%u generator index=%u flags=%#x id=%lx period=%lu phase=%lu [us] count=%u burst=%u\n", index, tmsg->index, tmsg->flags, (unsigned long)tmsg->can_id, (unsigned long)tmsg->period_us, (unsigned long)tmsg->phase_us, tmsg->count, tmsg->burst);
 
-				switch (tmsg->op) {
-				case SC_FEAT_OP_CLEAR:
-					can->features = perm;
-					LOG("ch%u CLEAR features to %#x\n", index, can->features);
-					break;
-				case SC_FEAT_OP_OR: {
-					uint32_t mode_bits = tmsg->arg & (SC_FEATURE_FLAG_MON_MODE | SC_FEATURE_FLAG_RES_MODE | SC_FEATURE_FLAG_EXT_LOOP_MODE);
+					while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
+					sc_can_gen_set(index, tmsg);
+					xSemaphoreGive(usb_can->mutex_handle);
 
-					if (__builtin_popcount(mode_bits) > 1) {
-						error = SC_ERROR_PARAM;
-						LOG("ch%u ERROR: attempt to activate more than one mode %08lx\n", index, mode_bits);
-					} else if (tmsg->arg & ~(perm | conf)) {
-						error = SC_ERROR_UNSUPPORTED;
-						LOG("ch%u ERROR: unsupported features %08lx\n", index, tmsg->arg);
-					} else {
-						can->features |= tmsg->arg;
-						LOG("ch%u OR features to %#x\n", index, can->features);
-					}
-				} break;
+					// re-evaluate schedule
+					xTaskNotifyGive(can->usb_task_handle);
 				}
 			}
+
+			sc_cmd_place_error_reply(index, error);
+		} break;
+		case SC_MSG_GEN_DATA: {
+			LOG("ch%u SC_MSG_GEN_DATA\n", index);
+			struct sc_msg_gen_data const *tmsg = (struct sc_msg_gen_data const *)msg;
+			int8_t error = SC_ERROR_NONE;
+
+			if (unlikely(msg->len < sizeof(*tmsg))) {
+				LOG("ch%u ERROR: msg too short\n", index);
+				error = SC_ERROR_SHORT;
+			} else if (tmsg->index >= SC_BOARD_CAN_GEN_COUNT || tmsg->offset + (msg->len - sizeof(*tmsg)) > SC_CAN_GEN_DATA_MAX) {
+				LOG("ch%u ERROR: invalid generator data index=%u offset=%u len=%u\n", index, tmsg->index, tmsg->offset, msg->len);
+				error = SC_ERROR_PARAM;
+			} else {
+				while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
+				sc_can_gen_data(index, tmsg);
+				xSemaphoreGive(usb_can->mutex_handle);
+			}
+
 			sc_cmd_place_error_reply(index, error);
 		} break;
 		case SC_MSG_BUS: {
@@ -581,6 +1623,9 @@ send_can_info:
 			if (unlikely(msg->len < sizeof(*tmsg))) {
 				LOG("ERROR: msg too short\n");
 				error = SC_ERROR_SHORT;
+			} else if (sc_can_autobaud_busy(index)) {
+				LOG("ch%u ERROR: autobaud running\n", index);
+				error = SC_ERROR_BUSY;
 			} else {
 				bool was_enabled = can->enabled;
 				bool is_enabled = tmsg->arg != 0;
@@ -595,21 +1640,26 @@ send_can_info:
 
 					if (is_enabled) {
 						can_state_reset(index);
-						sc_board_can_feat_set(index, can->features);
+						sc_can_sw_filter_enable(index, (can->features & SC_FEATURE_FLAG_SWF) == SC_FEATURE_FLAG_SWF);
+						sc_can_bus_stats_enable(index, can->bus_stats_interval_ms != 0);
+						sc_can_capture_enable(index, true);
+						sc_can_gen_enable(index, (can->features & SC_FEATURE_FLAG_GEN) == SC_FEATURE_FLAG_GEN);
+						// captured frames are sent out of order, compact messages need the previous frame
+						sc_board_can_feat_set(index, sc_can_capture_active(index) ? can->features & ~SC_FEATURE_FLAG_CRX : can->features);
 						sc_board_can_go_bus(index, is_enabled);
 						sc_board_led_can_status_set(index, SC_CAN_LED_STATUS_ENABLED_ON_BUS_PASSIVE);
 					} else {
 						sc_board_can_go_bus(index, is_enabled);
 						can_state_reset(index);
+						sc_can_capture_enable(index, false);
 						sc_board_led_can_status_set(index, SC_CAN_LED_STATUS_ENABLED_OFF_BUS);
 #if SUPERCAN_DEBUG
 						uint8_t *ptr_begin = usb_can->tx_buffers[usb_can->tx_bank];
-						uint8_t *ptr_end = ptr_begin + TU_ARRAY_SIZE(usb_can->tx_buffers[usb_can->tx_bank]);
+						uint8_t *ptr_end = ptr_begin + usb_can->tx_buffer_size;
 						int error_retrieve = sc_board_can_retrieve(index, ptr_begin, ptr_end);
 						SC_ASSERT(-1 == error_retrieve); // expected impl to not have any messages queued
 #endif
-						SC_DEBUG_ASSERT(0 == usb_can->tx_offsets[0]);
-						SC_DEBUG_ASSERT(0 == usb_can->tx_offsets[1]);
+						SC_DEBUG_ASSERT(0 == usb_can->tx_offsets[usb_can->tx_bank]);
 					}
 
 					can->enabled = is_enabled;
@@ -635,66 +1685,109 @@ send_can_info:
 	}
 }
 
-SC_RAMFUNC static void sc_process_msg_can_tx(uint8_t index, struct sc_msg_header const *msg)
+SC_RAMFUNC static bool sc_can_tx_msg_valid(uint8_t index, struct sc_msg_header const *msg)
 {
-	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(usb.can));
 	SC_DEBUG_ASSERT(msg);
 	SC_DEBUG_ASSERT(SC_MSG_CAN_TX == msg->id);
 
-	struct can *can = &cans[index];
-	struct usb_can *usb_can = &usb.can[index];
-
 	// LOG("SC_MSG_CAN_TX %lx\n", __atomic_load_n(&can->sync_tscv, __ATOMIC_ACQUIRE));
 	struct sc_msg_can_tx const *tmsg = (struct sc_msg_can_tx const *)msg;
 	if (unlikely(msg->len < sizeof(*tmsg))) {
 		LOG("ch%u ERROR: SC_MSG_CAN_TX msg too short\n", index);
-		return;
+		return false;
 	}
 
 	const uint8_t can_frame_len = dlc_to_len(tmsg->dlc);
 	if (!(tmsg->flags & SC_CAN_FRAME_FLAG_RTR)) {
 		if (unlikely(msg->len < sizeof(*tmsg) + can_frame_len)) {
 			LOG("ch%u ERROR: SC_MSG_CAN_TX msg too short\n", index);
-			return;
+			return false;
 		}
 	}
 
-	if (unlikely(!sc_board_can_tx_queue(index, tmsg))) {
-		uint8_t *tx_beg = NULL;
-		uint8_t *tx_end = NULL;
-		uint8_t *tx_ptr = NULL;
-		struct sc_msg_can_txr* rep = NULL;
+	return true;
+}
+
+/* queue tx messages in one go, messages that don't fit are reported as dropped */
+SC_RAMFUNC static void sc_can_tx_msgs_queue(uint8_t index, struct sc_msg_can_tx const * const *msgs, uint8_t count)
+{
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(usb.can));
+
+	struct can *can = &cans[index];
+	struct usb_can *usb_can = &usb.can[index];
+	uint8_t queued = sc_board_can_tx_queue_n(index, msgs, count);
+
+	for (uint8_t i = 0; i < queued; ++i) {
+		sc_can_bus_stats_frame(index, msgs[i]->can_id, msgs[i]->flags, msgs[i]->dlc, true);
+	}
 
+	if (unlikely(queued < count)) {
 		sc_board_can_ts_request(index);
-		++can->tx_dropped;
+		uint32_t const ts = sc_board_can_ts_wait(index);
+
+		for (; queued < count; ++queued) {
+			struct sc_msg_can_tx const *tmsg = msgs[queued];
+			uint8_t *tx_beg = NULL;
+			uint8_t *tx_end = NULL;
+			uint8_t *tx_ptr = NULL;
+			int bytes = 0;
+
+			++can->tx_dropped;
 
 send_txr:
-		tx_beg = usb_can->tx_buffers[usb_can->tx_bank];
-		tx_end = tx_beg + TU_ARRAY_SIZE(usb_can->tx_buffers[usb_can->tx_bank]);
-		tx_ptr = tx_beg + usb_can->tx_offsets[usb_can->tx_bank];
-
-		if ((size_t)(tx_end - tx_ptr) >= sizeof(*rep)) {
-			usb_can->tx_offsets[usb_can->tx_bank] += sizeof(*rep);
-
-			rep = (struct sc_msg_can_txr*)tx_ptr;
-			rep->id = SC_MSG_CAN_TXR;
-			rep->len = sizeof(*rep);
-			rep->track_id = tmsg->track_id;
-			rep->flags = SC_CAN_FRAME_FLAG_DRP;
-			uint32_t ts = sc_board_can_ts_wait(index);
-			rep->timestamp_us = ts;
-		} else {
-			if (sc_can_bulk_in_ep_ready(index)) {
-				sc_can_bulk_in_submit(index, __func__);
-				goto send_txr;
+			tx_beg = usb_can->tx_buffers[usb_can->tx_bank];
+			tx_end = tx_beg + usb_can->tx_buffer_size;
+			tx_ptr = tx_beg + usb_can->tx_offsets[usb_can->tx_bank];
+			bytes = sc_can_txr_place(index, tx_ptr, tx_end, tmsg->track_id, SC_CAN_FRAME_FLAG_DRP, ts);
+
+			if (bytes >= 0) {
+				usb_can->tx_offsets[usb_can->tx_bank] += bytes;
 			} else {
-				LOG("ch%u: desync\n", index);
-				can->desync = true;
+				if (sc_can_bulk_in_ep_ready(index)) {
+					sc_can_bulk_in_submit(index, __func__);
+					goto send_txr;
+				} else {
+					LOG("ch%u: desync\n", index);
+					can->desync = true;
+					++usb_can->tx_banks_busy;
+				}
 			}
 		}
 	}
 }
 
+/* arm the OUT endpoint on the next free buffer
+ *
+ * Called by the USB task on transfer completion and by the CAN task after
+ * processing a buffer. rx_put_index only changes while rx_ep_armed is set.
+ */
+SC_RAMFUNC static void sc_can_bulk_out_arm(uint8_t index)
+{
+	struct usb_can *can = &usb.can[index];
+
+	for (;;) {
+		uint8_t pi = 0;
+
+		if (__atomic_exchange_n(&can->rx_ep_armed, true, __ATOMIC_ACQUIRE)) {
+			return;
+		}
+
+		pi = can->rx_put_index;
+
+		if ((uint8_t)(pi - __atomic_load_n(&can->rx_get_index, __ATOMIC_ACQUIRE)) < TU_ARRAY_SIZE(can->rx_buffers)) {
+			(void)dcd_edpt_xfer(usb.port, can->pipe, can->rx_buffers[pi % TU_ARRAY_SIZE(can->rx_buffers)], MSG_BUFFER_SIZE);
+			return;
+		}
+
+		__atomic_store_n(&can->rx_ep_armed, false, __ATOMIC_RELEASE);
+
+		// buffer freed in between?
+		if ((uint8_t)(pi - __atomic_load_n(&can->rx_get_index, __ATOMIC_ACQUIRE)) == TU_ARRAY_SIZE(can->rx_buffers)) {
+			return;
+		}
+	}
+}
+
 SC_RAMFUNC static void sc_can_bulk_out(uint8_t index, uint32_t xferred_bytes)
 {
 	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(usb.can));
@@ -702,37 +1795,45 @@ SC_RAMFUNC static void sc_can_bulk_out(uint8_t index, uint32_t xferred_bytes)
 
 	struct usb_can *usb_can = &usb.can[index];
 	struct can *can = &cans[index];
-	const uint8_t rx_bank = usb_can->rx_bank;
-	(void)rx_bank;
-	uint8_t *in_beg = usb_can->rx_buffers[usb_can->rx_bank];
-	uint8_t *in_ptr = in_beg;
-	uint8_t *in_end = in_ptr + xferred_bytes;
+	uint8_t const pi = usb_can->rx_put_index;
 
+	if (likely(xferred_bytes)) {
+		usb_can->rx_lens[pi % TU_ARRAY_SIZE(usb_can->rx_lens)] = xferred_bytes;
+		__atomic_store_n(&usb_can->rx_put_index, pi + 1, __ATOMIC_RELEASE);
+	}
 
-	// start new transfer right away
-	usb_can->rx_bank = !usb_can->rx_bank;
-	(void)dcd_edpt_xfer(usb.port, usb_can->pipe, usb_can->rx_buffers[usb_can->rx_bank], MSG_BUFFER_SIZE);
+	__atomic_store_n(&usb_can->rx_ep_armed, false, __ATOMIC_RELEASE);
 
-	if (unlikely(!xferred_bytes)) {
-		return;
-	}
+	// start new transfer right away if there is a free buffer
+	sc_can_bulk_out_arm(index);
 
-	while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
+	if (likely(xferred_bytes)) {
+		xTaskNotifyGive(can->usb_task_handle);
+	}
+}
 
-	// LOG("ch%u: bulk out %u bytes\n", index, (unsigned)(in_end - in_beg));
+/* process OUT buffers handed over by sc_can_bulk_out, CAN task */
+SC_RAMFUNC static void sc_can_tx_process(uint8_t index)
+{
+	struct usb_can *usb_can = &usb.can[index];
+	uint8_t const pi = __atomic_load_n(&usb_can->rx_put_index, __ATOMIC_ACQUIRE);
 
+	for (uint8_t gi = usb_can->rx_get_index; gi != pi; ++gi) {
+		uint8_t const rx_bank = gi % TU_ARRAY_SIZE(usb_can->rx_buffers);
+		uint8_t *in_beg = usb_can->rx_buffers[rx_bank];
+		uint8_t *in_ptr = in_beg;
+		uint8_t *in_end = in_ptr + usb_can->rx_lens[rx_bank];
+		struct sc_msg_can_tx const *tx_msgs[SC_BOARD_CAN_TX_FIFO_SIZE];
+		uint8_t tx_count = 0;
 
-	// LOG("ch%u %s: chunk %u\n", index, func, i);
-	// sc_dump_mem(data_ptr, data_size);
+		// LOG("ch%u: bulk out %u bytes\n", index, (unsigned)(in_end - in_beg));
 
-	// guard against CAN frames when disabled
-	if (likely(can->enabled)) {
 		// process messages
 		while (in_ptr + SC_MSG_HEADER_LEN <= in_end) {
 			struct sc_msg_header const *msg = (struct sc_msg_header const *)in_ptr;
 
 			if (in_ptr + msg->len > in_end) {
-				LOG("ch%u offset=%u len=%u exceeds buffer size=%u\n", index, (unsigned)(in_ptr - in_beg), msg->len, (unsigned)xferred_bytes);
+				LOG("ch%u offset=%u len=%u exceeds buffer size=%u\n", index, (unsigned)(in_ptr - in_beg), msg->len, (unsigned)(in_end - in_beg));
 				break;
 			}
 
@@ -747,7 +1848,14 @@ SC_RAMFUNC static void sc_can_bulk_out(uint8_t index, uint32_t xferred_bytes)
 
 			switch (msg->id) {
 			case SC_MSG_CAN_TX:
-				sc_process_msg_can_tx(index, msg);
+				if (likely(sc_can_tx_msg_valid(index, msg))) {
+					tx_msgs[tx_count++] = (struct sc_msg_can_tx const *)msg;
+
+					if (tx_count == TU_ARRAY_SIZE(tx_msgs)) {
+						sc_can_tx_msgs_queue(index, tx_msgs, tx_count);
+						tx_count = 0;
+					}
+				}
 				break;
 
 			default:
@@ -758,12 +1866,55 @@ SC_RAMFUNC static void sc_can_bulk_out(uint8_t index, uint32_t xferred_bytes)
 			}
 		}
 
-		if (sc_can_bulk_in_ep_ready(index) && usb_can->tx_offsets[usb_can->tx_bank]) {
-			sc_can_bulk_in_submit(index, __func__);
+		if (tx_count) {
+			sc_can_tx_msgs_queue(index, tx_msgs, tx_count);
 		}
+
+		__atomic_store_n(&usb_can->rx_get_index, gi + 1, __ATOMIC_RELEASE);
+		sc_can_bulk_out_arm(index);
 	}
+}
 
-	xSemaphoreGive(usb_can->mutex_handle);
+/* drop OUT buffers while off bus, CAN task */
+static void sc_can_tx_discard(uint8_t index)
+{
+	struct usb_can *usb_can = &usb.can[index];
+
+	__atomic_store_n(&usb_can->rx_get_index, __atomic_load_n(&usb_can->rx_put_index, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	sc_can_bulk_out_arm(index);
+}
+
+/* queue and submit SC_MSG_AUTOBAUD_RESULT, off bus, CAN task with lock
+ *
+ * return  false if all IN banks are in flight
+ */
+static bool sc_can_autobaud_place(uint8_t index)
+{
+	struct autobaud *a = &cans[index].autobaud;
+	struct usb_can *usb_can = &usb.can[index];
+	uint8_t *tx_ptr;
+	uint8_t *tx_end;
+
+send:
+	if (!sc_can_bulk_in_ep_ready(index)) {
+		return false;
+	}
+
+	tx_ptr = usb_can->tx_buffers[usb_can->tx_bank] + usb_can->tx_offsets[usb_can->tx_bank];
+	tx_end = usb_can->tx_buffers[usb_can->tx_bank] + usb_can->tx_buffer_size;
+
+	if ((size_t)(tx_end - tx_ptr) < sizeof(a->result)) {
+		sc_can_bulk_in_submit(index, __func__);
+		goto send;
+	}
+
+	memcpy(tx_ptr, &a->result, sizeof(a->result));
+	usb_can->tx_offsets[usb_can->tx_bank] += sizeof(a->result);
+	sc_can_bulk_in_submit(index, __func__);
+
+	__atomic_store_n(&a->state, AUTOBAUD_IDLE, __ATOMIC_RELEASE);
+
+	return true;
 }
 
 static void sc_cmd_bulk_in(uint8_t index)
@@ -789,17 +1940,28 @@ SC_RAMFUNC static void sc_can_bulk_in(uint8_t index)
 	struct can *can = &cans[index];
 	struct usb_can *usb_can = &usb.can[index];
 
-	while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
-
-	usb_can->tx_offsets[!usb_can->tx_bank] = 0;
+	// zero length transfers issued on SC_MSG_HELLO_DEVICE aren't queued
+	if (unlikely(usb_can->tx_zlp)) {
+		usb_can->tx_zlp = false;
+	} else if (likely(usb_can->tx_get_index != __atomic_load_n(&usb_can->tx_bank, __ATOMIC_ACQUIRE))) {
+		__atomic_store_n(&usb_can->tx_get_index, sc_can_bulk_in_bank_next(usb_can->tx_get_index), __ATOMIC_RELEASE);
+	}
 
-	if (usb_can->tx_offsets[usb_can->tx_bank]) {
-		sc_can_bulk_in_submit(index, __func__);
+	if (unlikely(usb_can->tx_zlp_due)) {
+		// SC_MSG_HELLO_DEVICE during the transfer, keep the endpoint
+		// claimed so the ZLP goes out ahead of any new bank
+		usb_can->tx_zlp_due = false;
+		usb_can->tx_zlp = true;
+		(void)dcd_edpt_xfer(usb.port, 0x80 | usb_can->pipe, usb_can->tx_buffers[usb_can->tx_get_index], 0);
+		return;
 	}
 
-	xTaskNotifyGive(can->usb_task_handle);
+	__atomic_store_n(&usb_can->tx_ep_busy, false, __ATOMIC_RELEASE);
 
-	xSemaphoreGive(usb_can->mutex_handle);
+	sc_can_bulk_in_start(index);
+
+	// bank freed, task submits the bank being filled if due
+	xTaskNotifyGive(can->usb_task_handle);
 }
 
 static void sc_cmd_place_error_reply(uint8_t index, int8_t error)
@@ -835,7 +1997,18 @@ SC_RAMFUNC static void can_usb_task(void* param);
 static inline void can_usb_disconnect(void)
 {
 	for (uint8_t i = 0; i < SC_BOARD_CAN_COUNT; ++i) {
+		struct usb_can *usb_can = &usb.can[i];
+
 		can_state_initial(i);
+
+		// transfers are gone with the bus
+		memset(usb_can->tx_offsets, 0, sizeof(usb_can->tx_offsets));
+		usb_can->tx_bank = 0;
+		usb_can->tx_get_index = 0;
+		usb_can->tx_zlp = false;
+		usb_can->tx_zlp_due = false;
+		__atomic_store_n(&usb_can->tx_ep_busy, false, __ATOMIC_RELEASE);
+
 		sc_board_led_can_status_set(i, SC_CAN_LED_STATUS_DISABLED);
 	}
 }
@@ -854,6 +2027,7 @@ int main(void)
 
 	(void) xTaskCreateStatic(&tusb_device_task, "tusb", TU_ARRAY_SIZE(usb_device_stack), NULL, SC_TASK_PRIORITY, usb_device_stack, &usb_device_task_mem);
 	(void) xTaskCreateStatic(&led_task, "led", TU_ARRAY_SIZE(led_task_stack), NULL, SC_TASK_PRIORITY, led_task_stack, &led_task_mem);
+	(void) xTaskCreateStatic(&sc_timebase_task, "timebase", TU_ARRAY_SIZE(sc_timebase_task_stack), NULL, SC_TIMEBASE_TASK_PRIORITY, sc_timebase_task_stack, &sc_timebase_task_mem);
 
 	usb.cmd[0].pipe = SC_M1_EP_CMD0_BULK_OUT;
 	usb.can[0].pipe = SC_M1_EP_MSG0_BULK_OUT;
@@ -878,6 +2052,10 @@ int main(void)
 	LOG("sc_board_init_end\n");
 	sc_board_init_end();
 
+#if SUPERCAN_ISR_CYCLES
+	sc_isr_cycles_init();
+#endif
+
 	LOG("vTaskStartScheduler\n");
 	vTaskStartScheduler();
 
@@ -1115,8 +2293,16 @@ static uint16_t sc_usb_open(uint8_t rhport, tusb_desc_interface_t const * desc_i
 		SC_ASSERT(success);
 	}
 
+	while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
+
+	usb_can->rx_put_index = 0;
+	usb_can->rx_get_index = 0;
+	usb_can->rx_ep_armed = true;
+
+	xSemaphoreGive(usb_can->mutex_handle);
+
 	bool success_cmd = dcd_edpt_xfer(rhport, usb_cmd->pipe, usb_cmd->rx_buffers[usb_cmd->rx_bank], CMD_BUFFER_SIZE);
-	bool success_can = dcd_edpt_xfer(rhport, usb_can->pipe, usb_can->rx_buffers[usb_can->rx_bank], MSG_BUFFER_SIZE);
+	bool success_can = dcd_edpt_xfer(rhport, usb_can->pipe, usb_can->rx_buffers[0], MSG_BUFFER_SIZE);
 	SC_ASSERT(success_cmd);
 	SC_ASSERT(success_can);
 
@@ -1246,11 +2432,15 @@ usbd_class_driver_t const* usbd_app_driver_get_cb(uint8_t* driver_count)
 	return &sc_usb_driver;
 }
 
+/* The task drains all queued events per wake up and clears the
+ * notification value on take, hence one notification suffices
+ * regardless of the number of events.
+ */
 SC_RAMFUNC extern void sc_can_notify_task_def(uint8_t index, uint32_t count)
 {
 	struct can *can = &cans[index];
 
-	for (uint32_t i = 0; i < count; ++i) {
+	if (likely(count)) {
 		xTaskNotifyGive(can->usb_task_handle);
 	}
 }
@@ -1261,10 +2451,6 @@ SC_RAMFUNC extern void sc_can_notify_task_isr(uint8_t index, uint32_t count)
 	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
 	if (likely(count)) {
-		for (uint32_t i = 0; i < count - 1; ++i) {
-			vTaskNotifyGiveFromISR(can->usb_task_handle, NULL);
-		}
-
 		// LOG("CAN%u notify\n", index);
 		vTaskNotifyGiveFromISR(can->usb_task_handle, &xHigherPriorityTaskWoken);
 		portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
@@ -1312,7 +2498,7 @@ SC_RAMFUNC static void can_usb_task(void *param)
 		while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
 
 		uint8_t * const tx_beg = usb_can->tx_buffers[usb_can->tx_bank];
-		uint8_t * const tx_end = tx_beg + TU_ARRAY_SIZE(usb_can->tx_buffers[usb_can->tx_bank]);
+		uint8_t * const tx_end = tx_beg + usb_can->tx_buffer_size;
 		uint8_t *tx_ptr = tx_beg + usb_can->tx_offsets[usb_can->tx_bank];
 
 		for (;;) {
@@ -1390,15 +2576,22 @@ SC_RAMFUNC static void can_usb_task(void *param)
 	TickType_t bus_activity_ts = 0;
 	TickType_t error_ts = 0;
 	TickType_t status_ts = 0;
+	TickType_t time_sync_ts = 0;
+	TickType_t bus_stats_ts = 0;
+	TickType_t wait = portMAX_DELAY;
+	uint32_t gen_wait_us = SC_TS_MAX;
 	bool send_can_status = 0;
-	bool yield = false;
+	bool send_time_sync = false;
+	bool in_busy = false; // data pending but all IN banks in flight
 
 
 	while (42) {
 		// LOG("CAN%u task wait\n", index);
-		const uint32_t pre = ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+		const uint32_t pre = ulTaskNotifyTake(pdTRUE, wait);
 
-		if (likely(pre > 0)) {
+		// buffered messages with a flush deadline wake the task without notification
+		if (likely(pre > 0 || portMAX_DELAY != wait)) {
+			wait = portMAX_DELAY;
 
 			// LOG("CAN%u task loop\n", index);
 			while (pdTRUE != xSemaphoreTake(usb_can->mutex_handle, portMAX_DELAY));
@@ -1412,6 +2605,8 @@ SC_RAMFUNC static void can_usb_task(void *param)
 				rx_errors = 0;
 				previous_led_state = SC_CAN_LED_STATUS_ENABLED_ON_BUS_PASSIVE;
 				current_led_state = SC_CAN_LED_STATUS_ENABLED_ON_BUS_PASSIVE;
+				send_time_sync = true;
+				bus_stats_ts = xTaskGetTickCount();
 	// #if SUPERCAN_DEBUG
 	// 			rx_ts_last = 0;
 	// 			tx_ts_last = 0;
@@ -1420,11 +2615,38 @@ SC_RAMFUNC static void can_usb_task(void *param)
 				// clear out notifications
 				ulTaskNotifyTake(pdTRUE, 0);
 
-				// ensure we don't spin b/c e.g. a CAN interrupt handler generates events
-				yield = true;
+				// drop CAN frames while disabled
+				if (usb.mounted) {
+					sc_can_tx_discard(index);
+				}
+
+				if (unlikely(usb.mounted && AUTOBAUD_IDLE != can->autobaud.state)) {
+					if (AUTOBAUD_RUNNING == can->autobaud.state && !sc_can_autobaud_step(index)) {
+						// next probe step on the next tick
+						wait = 1;
+					}
 
-				LOG("ch%u usb state reset\n", index);
+					if (AUTOBAUD_DONE == can->autobaud.state && !sc_can_autobaud_place(index)) {
+						// sc_can_bulk_in notifies once a bank is free
+						in_busy = true;
+					}
+				} else {
+					LOG("ch%u usb state reset\n", index);
+				}
 			} else {
+				if (sc_can_bus_stats_active(index)) {
+					sc_board_can_ts_request(index);
+					sc_can_bus_stats_tick(index, sc_board_can_ts_wait(index));
+				}
+
+				sc_can_tx_process(index);
+
+				if (sc_can_gen_active(index)) {
+					sc_board_can_ts_request(index);
+					gen_wait_us = sc_can_gen_run(index, sc_board_can_ts_wait(index));
+				} else {
+					gen_wait_us = SC_TS_MAX;
+				}
 
 				for (bool done = false; !done; ) {
 					done = true;
@@ -1446,14 +2668,15 @@ SC_RAMFUNC static void can_usb_task(void *param)
 		// 			}
 		// #endif
 					uint8_t * const tx_beg = usb_can->tx_buffers[usb_can->tx_bank];
-					uint8_t * const tx_end = tx_beg + TU_ARRAY_SIZE(usb_can->tx_buffers[usb_can->tx_bank]);
+					uint8_t * const tx_end = tx_beg + usb_can->tx_buffer_size;
 					uint8_t *tx_ptr = tx_beg + usb_can->tx_offsets[usb_can->tx_bank];
 					int retrieved = 0;
 
 					if (send_can_status) {
 						struct sc_msg_can_status *msg = NULL;
+						uint8_t const sw_filter_bytes = sc_can_sw_filter_status_size(index);
 
-						if ((size_t)(tx_end - tx_ptr) >= sizeof(*msg)) {
+						if ((size_t)(tx_end - tx_ptr) >= sizeof(*msg) + sw_filter_bytes) {
 							done = false;
 							send_can_status = 0;
 							status_ts = now;
@@ -1463,30 +2686,37 @@ SC_RAMFUNC static void can_usb_task(void *param)
 							usb_can->tx_offsets[usb_can->tx_bank] += sizeof(*msg);
 							tx_ptr += sizeof(*msg);
 
-							// sc_board_can_status_fill(index, msg);
+							memset(msg->tx_queue_size, 0, sizeof(msg->tx_queue_size));
+							sc_board_can_status_fill(index, msg);
 
 							uint16_t tx_dropped = can->tx_dropped;
 							can->tx_dropped = 0;
 							uint16_t rx_lost = can->rx_lost;
 							can->rx_lost = 0;
+							uint16_t usb_in_busy = usb_can->tx_banks_busy;
+							usb_can->tx_banks_busy = 0;
 
 							msg->id = SC_MSG_CAN_STATUS;
 							msg->len = sizeof(*msg);
 							msg->bus_status = current_bus_status;
 							msg->tx_dropped = tx_dropped;
 							msg->rx_lost = rx_lost;
-							msg->tx_fifo_size = 0;
-							msg->rx_fifo_size = 0;
 							msg->tx_errors = tx_errors;
 							msg->rx_errors = rx_errors;
+							msg->usb_in_busy = usb_in_busy;
 							msg->flags = __sync_fetch_and_and(&can->int_comm_flags, 0);
 
 							if (can->desync) {
 								msg->flags |= SC_CAN_STATUS_FLAG_TXR_DESYNC;
 							}
 
-							msg->timestamp_us = sc_board_can_ts_wait(index);
+							msg->timestamp_us = sc_timebase_map(sc_board_can_ts_wait(index));
 
+							if (sw_filter_bytes) {
+								sc_can_sw_filter_status_place(index, tx_ptr, msg->timestamp_us);
+								usb_can->tx_offsets[usb_can->tx_bank] += sw_filter_bytes;
+								tx_ptr += sw_filter_bytes;
+							}
 
 							// LOG("status store %u bytes\n", (unsigned)sizeof(*msg));
 							// sc_dump_mem(msg, sizeof(*msg));
@@ -1496,7 +2726,70 @@ SC_RAMFUNC static void can_usb_task(void *param)
 								sc_can_bulk_in_submit(index, __func__);
 								continue;
 							} else {
-								yield = true;
+								++usb_can->tx_banks_busy;
+								in_busy = true;
+							}
+						}
+					}
+
+					if (can->time_sync_interval_ms && (send_time_sync || now - time_sync_ts >= pdMS_TO_TICKS(can->time_sync_interval_ms))) {
+						struct sc_msg_time_sync *msg = NULL;
+
+						if ((size_t)(tx_end - tx_ptr) >= sizeof(*msg)) {
+							uint16_t frame_index = 0;
+							uint32_t ts = 0;
+							// sampled by the timebase task, don't wait for a frame boundary here
+							bool const sof = sc_timebase_sof(&frame_index, &ts);
+
+							done = false;
+							send_time_sync = false;
+							time_sync_ts = now;
+
+							msg = (struct sc_msg_time_sync *)tx_ptr;
+							usb_can->tx_offsets[usb_can->tx_bank] += sizeof(*msg);
+							tx_ptr += sizeof(*msg);
+
+							msg->id = SC_MSG_TIME_SYNC;
+							msg->len = sizeof(*msg);
+							msg->flags = sof ? SC_TIME_SYNC_FLAG_SOF : 0;
+							msg->unused = 0;
+							msg->frame_index = frame_index;
+							msg->unused2 = 0;
+							msg->timestamp_us = ts;
+							msg->timestamp_us_hi = (uint32_t)(sc_timebase_extend(ts) >> 32);
+						} else {
+							if (sc_can_bulk_in_ep_ready(index)) {
+								done = false;
+								sc_can_bulk_in_submit(index, __func__);
+								continue;
+							} else {
+								++usb_can->tx_banks_busy;
+								in_busy = true;
+							}
+						}
+					}
+
+					if (can->bus_stats_interval_ms && now - bus_stats_ts >= pdMS_TO_TICKS(can->bus_stats_interval_ms)) {
+						uint8_t const bytes = sc_can_bus_stats_size(index);
+
+						if ((size_t)(tx_end - tx_ptr) >= bytes) {
+							uint32_t ts = 0;
+
+							done = false;
+							bus_stats_ts = now;
+							sc_board_can_ts_request(index);
+							ts = sc_board_can_ts_wait(index);
+							sc_can_bus_stats_place(index, tx_ptr, ts, sc_timebase_map(ts));
+							usb_can->tx_offsets[usb_can->tx_bank] += bytes;
+							tx_ptr += bytes;
+						} else {
+							if (sc_can_bulk_in_ep_ready(index)) {
+								done = false;
+								sc_can_bulk_in_submit(index, __func__);
+								continue;
+							} else {
+								++usb_can->tx_banks_busy;
+								in_busy = true;
 							}
 						}
 					}
@@ -1511,6 +2804,11 @@ SC_RAMFUNC static void can_usb_task(void *param)
 						switch (s->type) {
 						case SC_CAN_STATUS_FIFO_TYPE_BUS_STATUS: {
 							bus_activity_ts = now;
+
+							if (s->bus_state != current_bus_status) {
+								sc_can_capture_event(index, SC_CAPTURE_TRIGGER_BUS_STATE, sc_timebase_map(s->timestamp_us));
+							}
+
 							current_bus_status = s->bus_state;
 							LOG("ch%u bus status %#x\n", index, current_bus_status);
 							send_can_status = 1;
@@ -1523,6 +2821,8 @@ SC_RAMFUNC static void can_usb_task(void *param)
 
 							if (likely(s->bus_error.code)) {
 								error_ts = now;
+								sc_can_bus_stats_error(index);
+								sc_can_capture_event(index, SC_CAPTURE_TRIGGER_ERROR, sc_timebase_map(s->timestamp_us));
 							}
 
 							if ((size_t)(tx_end - tx_ptr) >= sizeof(*msg)) {
@@ -1534,7 +2834,7 @@ SC_RAMFUNC static void can_usb_task(void *param)
 								msg->id = SC_MSG_CAN_ERROR;
 								msg->len = sizeof(*msg);
 								msg->error = s->bus_error.code;
-								msg->timestamp_us = s->timestamp_us;
+								msg->timestamp_us = sc_timebase_map(s->timestamp_us);
 								msg->flags = 0;
 								if (s->bus_error.tx) {
 									msg->flags |= SC_CAN_ERROR_FLAG_RXTX_TX;
@@ -1551,7 +2851,8 @@ SC_RAMFUNC static void can_usb_task(void *param)
 									continue;
 								} else {
 									// LOG("ch%u dropped CAN bus error msg\n", index);
-									yield = true;
+									++usb_can->tx_banks_busy;
+									in_busy = true;
 								}
 							}
 						} break;
@@ -1580,6 +2881,30 @@ SC_RAMFUNC static void can_usb_task(void *param)
 						__atomic_store_n(&can->status_get_index, can->status_get_index+1, __ATOMIC_RELEASE);
 					}
 
+					if (sc_can_capture_active(index)) {
+						int const captured = sc_can_capture_place(index, tx_ptr, tx_end);
+
+						switch (captured) {
+						case -1:
+							break;
+						case 0:
+							if (sc_can_bulk_in_ep_ready(index)) {
+								done = false;
+								sc_can_bulk_in_submit(index, __func__);
+								continue;
+							} else {
+								++usb_can->tx_banks_busy;
+								in_busy = true;
+							}
+							break;
+						default:
+							done = false;
+							usb_can->tx_offsets[usb_can->tx_bank] += captured;
+							tx_ptr += captured;
+							break;
+						}
+					}
+
 					retrieved = sc_board_can_retrieve(index, tx_ptr, tx_end);
 					// LOG("r=%d\n", retrieved);
 
@@ -1593,7 +2918,8 @@ SC_RAMFUNC static void can_usb_task(void *param)
 							done = false;
 							sc_can_bulk_in_submit(index, __func__);
 						} else {
-							yield = true;
+							++usb_can->tx_banks_busy;
+							in_busy = true;
 						}
 						break;
 					default:
@@ -1602,23 +2928,70 @@ SC_RAMFUNC static void can_usb_task(void *param)
 
 						done = false;
 						SC_DEBUG_ASSERT(retrieved > 0);
-						SC_DEBUG_ASSERT((size_t)retrieved + usb_can->tx_offsets[usb_can->tx_bank] <= TU_ARRAY_SIZE(usb_can->tx_buffers[usb_can->tx_bank]));
+						SC_DEBUG_ASSERT((size_t)retrieved + usb_can->tx_offsets[usb_can->tx_bank] <= usb_can->tx_buffer_size);
+
+						if (sc_can_capture_active(index)) {
+							// frames are sent by sc_can_capture_place
+							retrieved = sc_can_capture_rx(index, tx_ptr, retrieved);
+						}
+
 						usb_can->tx_offsets[usb_can->tx_bank] += retrieved;
 						tx_ptr += retrieved;
 						bus_activity_ts = now;
+
+						if (unlikely(usb_can->flush_now) && sc_can_bulk_in_ep_ready(index)) {
+							// priority frames don't wait for the bank to fill up
+							sc_can_bulk_in_submit(index, __func__);
+						}
 						break;
 					}
 				}
 
 
 				if (usb_can->tx_offsets[usb_can->tx_bank]) {
+					if (usb_can->flush_fill_percent && !usb_can->tx_bank_ts_valid) {
+						// first message placed this round, the deadline runs from here
+						// even if the endpoint is busy
+						sc_board_can_ts_request(index);
+						usb_can->tx_bank_ts_us = sc_board_can_ts_wait(index);
+						usb_can->tx_bank_ts_valid = true;
+					}
+
 					if (sc_can_bulk_in_ep_ready(index)) {
-						sc_can_bulk_in_submit(index, __func__);
+						uint32_t const delay_us = sc_can_bulk_in_flush_delay_us(index);
+
+						if (delay_us) {
+							wait = tu_max32(1, pdMS_TO_TICKS((delay_us + 999) / 1000));
+						} else {
+							sc_can_bulk_in_submit(index, __func__);
+						}
 					} else {
-						yield = true;
+						in_busy = true;
 					}
 				}
 
+				if (SC_TS_MAX != gen_wait_us) {
+					// 0: tx fifo full, try again next tick
+					// long waits are split, the schedule is re-evaluated on wake up
+					gen_wait_us = tu_min32(gen_wait_us, 1000000);
+					wait = tu_min32(wait, tu_max32(1, pdMS_TO_TICKS((gen_wait_us + 999) / 1000)));
+				}
+
+
+				if (can->time_sync_interval_ms) {
+					TickType_t const period = pdMS_TO_TICKS(can->time_sync_interval_ms);
+					TickType_t const elapsed = xTaskGetTickCount() - time_sync_ts;
+
+					wait = tu_min32(wait, elapsed >= period ? 1 : period - elapsed);
+				}
+
+				if (can->bus_stats_interval_ms) {
+					TickType_t const period = pdMS_TO_TICKS(can->bus_stats_interval_ms);
+					TickType_t const elapsed = xTaskGetTickCount() - bus_stats_ts;
+
+					wait = tu_min32(wait, elapsed >= period ? 1 : period - elapsed);
+				}
+
 
 				const bool has_bus_activity = xTaskGetTickCount() - bus_activity_ts < pdMS_TO_TICKS(SC_BUS_ACTIVITY_TIMEOUT_MS);
 				const bool has_bus_error = xTaskGetTickCount() - error_ts < pdMS_TO_TICKS(SC_BUS_ACTIVITY_TIMEOUT_MS);
@@ -1648,18 +3021,20 @@ SC_RAMFUNC static void can_usb_task(void *param)
 			}
 
 			xSemaphoreGive(usb_can->mutex_handle);
-		} else {
-			yield = true;
 		}
 
 		// LOG("|");
 
-		if (yield) {
-			// yield to prevent this task from eating up the CPU
-			// when the USB buffers are full/busy.
-			yield = false;
-			// taskYIELD();
-			vTaskDelay(pdMS_TO_TICKS(1)); // 1ms for USB FS
+		// No need to poll while the IN banks are busy, sc_can_bulk_in
+		// notifies this task as soon as a transfer completes.
+		if (in_busy) {
+			in_busy = false;
+#if SUPERCAN_LATENCY_HIST
+			latency_hist_blocked(index);
+#endif
+#if SUPERCAN_CAN_TASK_BACKOFF_MS
+			vTaskDelay(pdMS_TO_TICKS(SUPERCAN_CAN_TASK_BACKOFF_MS));
+#endif
 		}
 	}
 }
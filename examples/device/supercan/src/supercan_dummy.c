@@ -73,9 +73,17 @@ static const sc_can_bit_timing_range dt_range = {
 };
 
 static struct can {
+	struct sc_dummy_can_frame rx_frames[SC_BOARD_CAN_RX_FIFO_SIZE];
+	sc_can_filter rx_filters_std[SC_BOARD_CAN_FILTER_STD_COUNT];
+	sc_can_filter rx_filters_ext[SC_BOARD_CAN_FILTER_EXT_COUNT];
+	sc_can_bit_timing nm, dt;
+	uint16_t features;
 	uint8_t txr_buffer[SC_BOARD_CAN_TX_FIFO_SIZE];
 	uint8_t txr_get_index; // NOT an index, uses full range of type
 	uint8_t txr_put_index; // NOT an index, uses full range of typ
+	uint8_t rx_get_index; // NOT an index, uses full range of type
+	uint8_t rx_put_index; // NOT an index, uses full range of type
+	bool enabled;
 } cans[SC_BOARD_CAN_COUNT];
 
 extern void sc_board_led_set(uint8_t index, bool on)
@@ -95,6 +103,11 @@ extern void sc_board_init_begin(void)
 	board_init();
 
 	memset(cans, 0, sizeof(cans));
+
+	for (uint8_t i = 0; i < TU_ARRAY_SIZE(cans); ++i) {
+		cans[i].nm = nm_range.min;
+		cans[i].dt = dt_range.min;
+	}
 }
 
 extern void sc_board_init_end(void)
@@ -121,29 +134,50 @@ extern uint16_t sc_board_can_feat_conf(uint8_t index)
 	return CAN_FEAT_CONF;
 }
 
-SC_RAMFUNC extern bool sc_board_can_tx_queue(uint8_t index, struct sc_msg_can_tx const * msg)
+static void can_off(uint8_t index)
+{
+	struct can *can = &cans[index];
+
+	__atomic_store_n(&can->enabled, false, __ATOMIC_RELEASE);
+	can->rx_get_index = __atomic_load_n(&can->rx_put_index, __ATOMIC_ACQUIRE);
+	can->txr_get_index = __atomic_load_n(&can->txr_put_index, __ATOMIC_ACQUIRE);
+}
+
+SC_RAMFUNC extern uint8_t sc_board_can_tx_queue_n(uint8_t index, struct sc_msg_can_tx const * const *msgs, uint8_t count)
 {
 	struct can *can = &cans[index];
 	uint8_t pi = can->txr_put_index;
 	uint8_t gi = __atomic_load_n(&can->txr_get_index, __ATOMIC_ACQUIRE);
 	uint8_t used = pi - gi;
-	bool available = used < TU_ARRAY_SIZE(can->txr_buffer);
+	uint8_t queued = 0;
+
+	count = tu_min8(count, TU_ARRAY_SIZE(can->txr_buffer) - used);
 
-	if (available) {
+	for (; queued < count; ++queued, ++pi) {
 		uint8_t txr_put_index = pi % TU_ARRAY_SIZE(can->txr_buffer);
 
 		// store
-		can->txr_buffer[txr_put_index] = msg->track_id;
+		can->txr_buffer[txr_put_index] = msgs[queued]->track_id;
 
-		// mark available
-		__atomic_store_n(&can->txr_put_index, pi + 1, __ATOMIC_RELEASE);
+		LOG("ch%u queued TXR %u\n", index, msgs[queued]->track_id);
+	}
 
-		LOG("ch%u queued TXR %u\n", index, msg->track_id);
+	if (queued) {
+		// mark available
+		__atomic_store_n(&can->txr_put_index, pi, __ATOMIC_RELEASE);
 
 		sc_can_notify_task_def(index, 1);
 	}
 
-	return available;
+	return queued;
+}
+
+SC_RAMFUNC extern void sc_board_can_status_fill(uint8_t index, struct sc_msg_can_status *msg)
+{
+	struct can *can = &cans[index];
+
+	msg->rx_fifo_size = __atomic_load_n(&can->rx_put_index, __ATOMIC_ACQUIRE) - can->rx_get_index;
+	msg->tx_fifo_size = can->txr_put_index - __atomic_load_n(&can->txr_get_index, __ATOMIC_ACQUIRE);
 }
 
 
@@ -155,33 +189,69 @@ SC_RAMFUNC extern int sc_board_can_retrieve(uint8_t index, uint8_t *tx_ptr, uint
 
 	for (bool done = false; !done; ) {
 		done = true;
-		uint8_t txr_pi = __atomic_load_n(&can->txr_put_index, __ATOMIC_ACQUIRE);
+		uint8_t rx_pi = __atomic_load_n(&can->rx_put_index, __ATOMIC_ACQUIRE);
 
-		if (can->txr_get_index != txr_pi) {
-			struct sc_msg_can_txr *txr = NULL;
-			uint8_t const bytes = sizeof(*txr);
+		if (can->rx_get_index != rx_pi) {
+			uint8_t const rx_get_index = can->rx_get_index % TU_ARRAY_SIZE(can->rx_frames);
+			struct sc_dummy_can_frame const *frame = &can->rx_frames[rx_get_index];
+			uint8_t const can_frame_len = (frame->flags & SC_CAN_FRAME_FLAG_RTR) ? 0 : dlc_to_len(frame->dlc);
+			uint8_t const swf = sc_can_sw_filter_eval(index, frame->can_id, frame->flags, frame->timestamp_us);
+
+			if (unlikely(swf & SC_SW_FILTER_DROP)) {
+				// dropped by software filter
+				done = false;
+				sc_can_sw_filter_commit(index, swf, frame->timestamp_us);
+				sc_can_bus_stats_frame(index, frame->can_id, frame->flags, frame->dlc, false);
+				__atomic_store_n(&can->rx_get_index, can->rx_get_index+1, __ATOMIC_RELEASE);
+			} else {
+				uint8_t *data = NULL;
+				uint8_t const bytes = sc_can_rx_msg_place(
+					index,
+					can->features & SC_FEATURE_FLAG_CRX,
+					tx_ptr,
+					tx_end,
+					frame->can_id,
+					frame->dlc,
+					frame->flags,
+					frame->timestamp_us,
+					can_frame_len,
+					&data);
+
+				have_data_to_place = true;
+
+				if (bytes) {
+					done = false;
+
+					tx_ptr += bytes;
+					result += bytes;
+
+					memcpy(data, frame->data, can_frame_len);
+					sc_can_sw_filter_commit(index, swf, frame->timestamp_us);
+					sc_can_bus_stats_frame(index, frame->can_id, frame->flags, frame->dlc, false);
+
+					__atomic_store_n(&can->rx_get_index, can->rx_get_index+1, __ATOMIC_RELEASE);
+				}
+			}
+		}
 
-			have_data_to_place = true;
+		uint8_t txr_pi = __atomic_load_n(&can->txr_put_index, __ATOMIC_ACQUIRE);
 
+		if (can->txr_get_index != txr_pi) {
+			uint8_t const txr_get_index = can->txr_get_index % TU_ARRAY_SIZE(can->txr_buffer);
+			uint8_t const track_id = can->txr_buffer[txr_get_index];
+			int const bytes = sc_can_txr_place(index, tx_ptr, tx_end, track_id, 0, sc_board_can_ts_wait(index));
 
-			if ((size_t)(tx_end - tx_ptr) >= bytes) {
-				uint8_t const txr_get_index = can->txr_get_index % TU_ARRAY_SIZE(can->txr_buffer);
+			if (bytes >= 0) {
 				done = false;
 
-				txr = (struct sc_msg_can_txr *)tx_ptr;
-
 				tx_ptr += bytes;
 				result += bytes;
 
-				txr->flags = 0;
-				txr->id = SC_MSG_CAN_TXR;
-				txr->len = bytes;
-				txr->track_id = cans->txr_buffer[txr_get_index];
-				txr->timestamp_us = sc_board_can_ts_wait(index);
-
 				__atomic_store_n(&can->txr_get_index, can->txr_get_index+1, __ATOMIC_RELEASE);
 
-				LOG("ch%u retrievd TXR %u\n", index, txr->track_id);
+				LOG("ch%u retrievd TXR %u\n", index, track_id);
+			} else {
+				have_data_to_place = true;
 			}
 		}
 	}
@@ -193,6 +263,92 @@ SC_RAMFUNC extern int sc_board_can_retrieve(uint8_t index, uint8_t *tx_ptr, uint
 	return have_data_to_place - 1;
 }
 
+extern bool sc_dummy_can_on_bus(uint8_t index, uint32_t *nm_bitrate, uint32_t *dt_bitrate)
+{
+	struct can *can = &cans[index];
+
+	if (!__atomic_load_n(&can->enabled, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+
+	*nm_bitrate = sc_bitrate(can->nm.brp, can->nm.tseg1, can->nm.tseg2);
+	*dt_bitrate = sc_bitrate(can->dt.brp, can->dt.tseg1, can->dt.tseg2);
+
+	return true;
+}
+
+/* software version of the controller acceptance filters */
+static bool can_rx_filter_match(struct can const *can, struct sc_dummy_can_frame const *frame)
+{
+	sc_can_filter const *filters = can->rx_filters_std;
+	size_t count = TU_ARRAY_SIZE(can->rx_filters_std);
+
+	if (frame->flags & SC_CAN_FRAME_FLAG_EXT) {
+		filters = can->rx_filters_ext;
+		count = TU_ARRAY_SIZE(can->rx_filters_ext);
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (filters[i].enabled && ((frame->can_id ^ filters[i].can_id) & filters[i].mask) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+extern unsigned sc_dummy_can_rx(uint8_t index, struct sc_dummy_can_frame const *frames, unsigned count)
+{
+	struct can *can = &cans[index];
+	uint8_t pi = can->rx_put_index;
+	uint8_t gi = __atomic_load_n(&can->rx_get_index, __ATOMIC_ACQUIRE);
+	bool const filter = (can->features & SC_FEATURE_FLAG_FLT) == SC_FEATURE_FLAG_FLT;
+	unsigned accepted = 0;
+	unsigned lost = 0;
+	unsigned events = 0;
+
+	if (unlikely(!__atomic_load_n(&can->enabled, __ATOMIC_ACQUIRE))) {
+		return 0;
+	}
+
+	for (unsigned i = 0; i < count; ++i) {
+		if (filter && !can_rx_filter_match(can, &frames[i])) {
+			continue;
+		}
+
+		if ((uint8_t)(pi - gi) == TU_ARRAY_SIZE(can->rx_frames)) {
+			++lost;
+			continue;
+		}
+
+		can->rx_frames[pi % TU_ARRAY_SIZE(can->rx_frames)] = frames[i];
+		++pi;
+		++accepted;
+	}
+
+	events = accepted;
+
+	__atomic_store_n(&can->rx_put_index, pi, __ATOMIC_RELEASE);
+
+	while (lost) {
+		uint8_t chunk = tu_min32(lost, UINT8_MAX);
+		sc_can_status status = {
+			.type = SC_CAN_STATUS_FIFO_TYPE_RX_LOST,
+			.timestamp_us = sc_board_can_ts_wait(index),
+			.rx_lost = chunk,
+		};
+
+		sc_can_status_queue(index, &status);
+		lost -= chunk;
+		++events;
+	}
+
+	if (events) {
+		sc_can_notify_task_def(index, events);
+	}
+
+	return accepted;
+}
 
 extern sc_can_bit_timing_range const* sc_board_can_nm_bit_timing_range(uint8_t index)
 {
@@ -210,14 +366,12 @@ extern sc_can_bit_timing_range const* sc_board_can_dt_bit_timing_range(uint8_t i
 
 extern void sc_board_can_feat_set(uint8_t index, uint16_t features)
 {
-	(void)index;
-	(void)features;
+	cans[index].features = features;
 }
 
 extern void sc_board_can_go_bus(uint8_t index, bool on)
 {
-	(void)index;
-	(void)on;
+	struct can *can = &cans[index];
 
 	if (on) {
 		const sc_can_status status = {
@@ -228,19 +382,32 @@ extern void sc_board_can_go_bus(uint8_t index, bool on)
 
 		sc_can_status_queue(index, &status);
 		sc_can_notify_task_def(index, 1);
+
+		__atomic_store_n(&can->enabled, true, __ATOMIC_RELEASE);
+	} else {
+		can_off(index);
+	}
+}
+
+extern void sc_board_can_filter_set(uint8_t index, bool ext, uint8_t element, sc_can_filter const *filter)
+{
+	struct can *can = &cans[index];
+
+	if (ext) {
+		can->rx_filters_ext[element] = *filter;
+	} else {
+		can->rx_filters_std[element] = *filter;
 	}
 }
 
 extern void sc_board_can_nm_bit_timing_set(uint8_t index, sc_can_bit_timing const *bt)
 {
-	(void)index;
-	(void)bt;
+	cans[index].nm = *bt;
 }
 
 extern void sc_board_can_dt_bit_timing_set(uint8_t index, sc_can_bit_timing const *bt)
 {
-	(void)index;
-	(void)bt;
+	cans[index].dt = *bt;
 }
 
 extern uint32_t sc_board_identifier(void)
@@ -250,7 +417,12 @@ extern uint32_t sc_board_identifier(void)
 
 extern void sc_board_can_reset(uint8_t index)
 {
-	(void)index;
+	struct can *can = &cans[index];
+
+	can_off(index);
+
+	memset(can->rx_filters_std, 0, sizeof(can->rx_filters_std));
+	memset(can->rx_filters_ext, 0, sizeof(can->rx_filters_ext));
 }
 
 #endif // #if SUPERCAN_DUMMY
@@ -109,9 +109,11 @@ static void can_init_module(void)
 		struct same5x_can *can = &same5x_cans[j];
 		can->features = CAN_FEAT_PERM;
 
+#if !SAME5X_CAN_RX_SINGLE_COPY
 		for (size_t i = 0; i < TU_ARRAY_SIZE(same5x_cans[0].rx_fifo); ++i) {
 			SC_DEBUG_ASSERT(can->rx_frames[i].ts == 0);
 		}
+#endif
 
 		for (size_t i = 0; i < TU_ARRAY_SIZE(same5x_cans[0].tx_fifo); ++i) {
 			SC_DEBUG_ASSERT(can->tx_frames[i].ts == 0);
@@ -10,6 +10,9 @@
 
 #include <supercan_debug.h>
 
+#include <FreeRTOS.h>
+#include <task.h>
+
 #include <m_can.h>
 #include <sam_crc32.h>
 #include <mcu.h>
@@ -57,6 +60,36 @@ static const sc_can_bit_timing_range dt_range = {
 
 struct same5x_can same5x_cans[SC_BOARD_CAN_COUNT];
 
+#if SAME5X_CAN_RX_DMA
+/* DMAC channel n serves CAN channel n, one descriptor per rx fifo element */
+static DmacDescriptor dmac_descriptors[SC_BOARD_CAN_COUNT] __attribute__((aligned(16)));
+static DmacDescriptor dmac_writeback[SC_BOARD_CAN_COUNT] __attribute__((aligned(16)));
+static DmacDescriptor dmac_rx_descriptors[SC_BOARD_CAN_COUNT][SC_BOARD_CAN_RX_FIFO_SIZE-1] __attribute__((aligned(16)));
+
+static void dmac_init(void)
+{
+	MCLK->AHBMASK.bit.DMAC_ = 1;
+
+	DMAC->CTRL.bit.DMAENABLE = 0;
+	DMAC->CTRL.bit.SWRST = 1;
+	while (DMAC->CTRL.bit.SWRST);
+
+	DMAC->BASEADDR.reg = (uint32_t)dmac_descriptors;
+	DMAC->WRBADDR.reg = (uint32_t)dmac_writeback;
+
+	for (uint8_t i = 0; i < SC_BOARD_CAN_COUNT; ++i) {
+		// software trigger, one trigger runs all linked descriptors
+		DMAC->Channel[i].CHCTRLA.reg = DMAC_CHCTRLA_TRIGSRC(0) | DMAC_CHCTRLA_TRIGACT_TRANSACTION;
+		DMAC->Channel[i].CHINTENSET.reg = DMAC_CHINTENSET_TCMPL | DMAC_CHINTENSET_TERR;
+
+		NVIC_SetPriority(DMAC_0_IRQn + i, SC_ISR_PRIORITY);
+		NVIC_EnableIRQ(DMAC_0_IRQn + i);
+	}
+
+	DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+}
+#endif
+
 void same5x_can_init(void)
 {
 	memset(same5x_cans, 0, sizeof(same5x_cans));
@@ -68,6 +101,10 @@ void same5x_can_init(void)
 		can->nm = sc_board_can_nm_bit_timing_range((uint8_t)i)->min;
 		can->dt = sc_board_can_dt_bit_timing_range((uint8_t)i)->min;
 	}
+
+#if SAME5X_CAN_RX_DMA
+	dmac_init();
+#endif
 }
 
 void same5x_can_configure(uint8_t index)
@@ -123,9 +160,16 @@ void same5x_can_configure(uint8_t index)
 	// reset default TSCV.TSS = 0 (= value always 0)
 	//can->TSCC.reg = CAN_TSCC_TSS_ZERO; // time stamp counter in CAN bittime
 
+#if SC_BOARD_CAN_HW_TS
+	// External timestamp counter is the 16 bit count of TC0,
+	// i.e. the low half of the 1 MHz counter. Frames are
+	// stamped at start of frame.
+	can->TSCC.reg = CAN_TSCC_TSS_EXT;
+#else
 	// NOTE: this needs to be on, else we might actually wrap TC0/1
 	// which would lead to mistallying of time on the host
 	can->TSCC.reg = CAN_TSCC_TSS_INC;
+#endif
 	// reset default TOCC.ETOC = 0 (disabled)
 	// can->TOCC.reg = CAN_TOCC_TOP(0xffff) | CAN_TOCC_TOS(0); // Timeout Counter disabled, Reset-default
 	can->NBTP.reg = CAN_NBTP_NSJW(c->nm.sjw-1)
@@ -144,8 +188,8 @@ void same5x_can_configure(uint8_t index)
 	can->TDCR.bit.TDCF = tu_min8((1 + c->dt.tseg1 + c->dt.tseg2 / 2), M_CAN_TDCR_TDCO_MAX);
 
 
-	// tx fifo
-	can->TXBC.reg = CAN_TXBC_TBSA((uint32_t) c->tx_fifo) | CAN_TXBC_TFQS(SC_BOARD_CAN_TX_FIFO_SIZE);
+	// dedicated tx buffers followed by the tx fifo
+	can->TXBC.reg = CAN_TXBC_TBSA((uint32_t) c->tx_fifo) | CAN_TXBC_NDTB(CAN_TX_BUFFER_COUNT) | CAN_TXBC_TFQS(CAN_TX_FIFO_QUEUE_SIZE);
 
 	can->TXESC.reg = CAN_TXESC_TBDS_DATA64;
 
@@ -156,7 +200,22 @@ void same5x_can_configure(uint8_t index)
 	// rx fifo0
 	can->RXF0C.reg = CAN_RXF0C_F0SA((uint32_t) c->rx_fifo) | CAN_RXF0C_F0S(SC_BOARD_CAN_RX_FIFO_SIZE);
 	//  | CAN_RXF0C_F0OM; // FIFO 0 overwrite mode
-	can->RXESC.reg = CAN_RXESC_RBDS_DATA64 + CAN_RXESC_F0DS_DATA64;
+
+	// rx fifo1, priority lane
+	can->RXF1C.reg = CAN_RXF1C_F1SA((uint32_t) c->rx_prio_fifo) | CAN_RXF1C_F1S(CAN_RX_PRIO_FIFO_SIZE);
+	can->RXESC.reg = CAN_RXESC_RBDS_DATA64 + CAN_RXESC_F0DS_DATA64 + CAN_RXESC_F1DS_DATA64;
+
+	// rx filters
+	if (c->features & SC_FEATURE_FLAG_FLT) {
+		can->SIDFC.reg = CAN_SIDFC_FLSSA((uint32_t) c->rx_std_filters) | CAN_SIDFC_LSS(SC_BOARD_CAN_FILTER_STD_COUNT);
+		can->XIDFC.reg = CAN_XIDFC_FLESA((uint32_t) c->rx_ext_filters) | CAN_XIDFC_LSE(SC_BOARD_CAN_FILTER_EXT_COUNT);
+		can->GFC.reg = CAN_GFC_ANFS(CAN_GFC_ANFS_REJECT_Val) | CAN_GFC_ANFE(CAN_GFC_ANFE_REJECT_Val);
+	} else {
+		// no filter elements, accept all frames into rx fifo0
+		can->SIDFC.reg = 0;
+		can->XIDFC.reg = 0;
+		can->GFC.reg = 0;
+	}
 
 	// enable interrupt line 0
 	can->ILE.reg = CAN_ILE_EINT0;
@@ -171,6 +230,8 @@ void same5x_can_configure(uint8_t index)
 		| CAN_IE_EPE    // error passive
 		| CAN_IE_RF0NE  // new message in rx fifo0
 		| CAN_IE_RF0LE  // message lost b/c fifo0 was full
+		| CAN_IE_RF1NE  // new message in rx fifo1
+		| CAN_IE_RF1LE  // message lost b/c fifo1 was full
 		| CAN_IE_PEAE   // proto error in arbitration phase
 		| CAN_IE_PEDE   // proto error in data phase
 		// | CAN_IE_ELOE   // error logging overflow
@@ -201,6 +262,7 @@ SC_RAMFUNC static inline uint8_t can_map_m_can_ec(uint8_t value)
 }
 
 SC_RAMFUNC static void can_poll(uint8_t index, uint32_t * const events, uint32_t tsc);
+SC_RAMFUNC static void can_poll_prio(uint8_t index, uint32_t * const events, uint32_t tsc);
 
 
 
@@ -383,12 +445,12 @@ SC_RAMFUNC void same5x_can_int(uint8_t index)
 	// is ready right away.
 	const uint32_t tsc = same5x_counter_1MHz_wait_for_current_value();
 
-	if (unlikely(ir.bit.RF0L)) {
+	if (unlikely(ir.bit.RF0L | ir.bit.RF1L)) {
 		sc_can_status status;
 
 		status.type = SC_CAN_STATUS_FIFO_TYPE_RX_LOST;
 		status.timestamp_us = tsc;
-		status.rx_lost = 1;
+		status.rx_lost = ir.bit.RF0L + ir.bit.RF1L;
 
 		sc_can_status_queue(index, &status);
 		++events;
@@ -396,15 +458,16 @@ SC_RAMFUNC void same5x_can_int(uint8_t index)
 
 	can_int_update_status(index, &events, tsc);
 
+	if (ir.reg & CAN_IR_RF1N) {
+		can_poll_prio(index, &events, tsc);
+	}
+
 	if (ir.reg & (CAN_IR_TEFN | CAN_IR_RF0N)) {
 
 		// LOG("CAN%u RX/TX\n", index);
 		can_poll(index, &events, tsc);
 	}
 
-	// msg->tx_fifo_size = SC_BOARD_CAN_TX_FIFO_SIZE - can->m_can->TXFQS.bit.TFFL;
-	// msg->rx_fifo_size = can->m_can->RXF0S.bit.F0FL;
-
 	if (likely(events)) {
 		// LOG(">");
 		sc_can_notify_task_isr(index, events);
@@ -447,7 +510,11 @@ static inline void can_reset_task_state_unsafe(uint8_t index)
 
 
 #if SUPERCAN_DEBUG
+#if SAME5X_CAN_RX_SINGLE_COPY
+	memset(can->rx_ts, 0, sizeof(can->rx_ts));
+#else
 	memset(can->rx_frames, 0, sizeof(can->rx_frames));
+#endif
 	memset(can->tx_frames, 0, sizeof(can->tx_frames));
 #endif
 
@@ -462,6 +529,8 @@ static inline void can_reset_task_state_unsafe(uint8_t index)
 	// since we won't get any further interrupts
 	can->rx_get_index = 0;
 	can->rx_put_index = 0;
+	can->rx_prio_get_index = 0;
+	can->rx_prio_put_index = 0;
 	can->tx_get_index = 0;
 	can->tx_put_index = 0;
 
@@ -481,6 +550,15 @@ static inline void can_off(uint8_t index)
 	// go bus off
 	can_set_state1(can->m_can, can->interrupt_id, false);
 
+#if SAME5X_CAN_RX_DMA
+	// drop any transfer in progress, the frames are discarded anyway
+	DMAC->Channel[index].CHCTRLA.bit.ENABLE = 0;
+	while (DMAC->Channel[index].CHCTRLA.bit.ENABLE);
+	DMAC->Channel[index].CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+	NVIC_ClearPendingIRQ(DMAC_0_IRQn + index);
+	can->rx_dma_busy = false;
+#endif
+
 	can_reset_task_state_unsafe(index);
 }
 
@@ -591,6 +669,10 @@ static inline void can_reset(uint8_t index)
 	can->features = CAN_FEAT_PERM;
 	can->nm = nm_range.min;
 	can->dt = dt_range.min;
+
+	// disable all filter elements
+	memset((void*)can->rx_std_filters, 0, sizeof(can->rx_std_filters));
+	memset((void*)can->rx_ext_filters, 0, sizeof(can->rx_ext_filters));
 }
 
 static uint32_t device_identifier;
@@ -655,17 +737,44 @@ extern uint16_t sc_board_can_feat_conf(uint8_t index)
 	return CAN_FEAT_CONF;
 }
 
-SC_RAMFUNC extern bool sc_board_can_tx_queue(uint8_t index, struct sc_msg_can_tx const * msg)
+SC_RAMFUNC extern uint8_t sc_board_can_tx_queue_n(uint8_t index, struct sc_msg_can_tx const * const *msgs, uint8_t count)
 {
 	struct same5x_can *can = &same5x_cans[index];
-	bool available = can->m_can->TXFQS.bit.TFQPI - can->m_can->TXFQS.bit.TFGI < SC_BOARD_CAN_TX_FIFO_SIZE;
-
-	if (available) {
+	CAN_TXFQS_Type const txfqs = can->m_can->TXFQS;
+	uint8_t fifo_put_index = txfqs.bit.TFQPI;
+	uint8_t fifo_free = txfqs.bit.TFFL;
+	uint32_t buffers_busy = can->m_can->TXBRP.reg & CAN_TX_BUFFER_MASK;
+	uint32_t txbar = 0;
+	uint8_t queued = 0;
+
+	for (; queued < count; ++queued) {
+		struct sc_msg_can_tx const *msg = msgs[queued];
 		uint32_t id = msg->can_id;
-		uint8_t put_index = can->m_can->TXFQS.bit.TFQPI;
+		uint8_t put_index = 0;
 		CAN_TXBE_0_Type t0;
 		CAN_TXBE_1_Type t1;
 
+		if (sc_can_tx_queue(msg)) {
+			// dedicated tx buffers take part in arbitration alongside the fifo head
+			if (buffers_busy == CAN_TX_BUFFER_MASK) {
+				break;
+			}
+
+			put_index = __builtin_ctz(~buffers_busy);
+			buffers_busy |= UINT32_C(1) << put_index;
+		} else {
+			if (!fifo_free) {
+				break;
+			}
+
+			--fifo_free;
+			put_index = fifo_put_index;
+
+			if (++fifo_put_index == SC_BOARD_CAN_TX_FIFO_SIZE) {
+				fifo_put_index = CAN_TX_BUFFER_COUNT;
+			}
+		}
+
 		t0.reg = (((msg->flags & SC_CAN_FRAME_FLAG_ESI) == SC_CAN_FRAME_FLAG_ESI) << CAN_TXBE_0_ESI_Pos)
 			| (((msg->flags & SC_CAN_FRAME_FLAG_RTR) == SC_CAN_FRAME_FLAG_RTR) << CAN_TXBE_0_RTR_Pos)
 			| (((msg->flags & SC_CAN_FRAME_FLAG_EXT) == SC_CAN_FRAME_FLAG_EXT) << CAN_TXBE_0_XTD_Pos)
@@ -696,7 +805,7 @@ SC_RAMFUNC extern bool sc_board_can_tx_queue(uint8_t index, struct sc_msg_can_tx
 			}
 		}
 
-		can->m_can->TXBAR.reg = UINT32_C(1) << put_index;
+		txbar |= UINT32_C(1) << put_index;
 #if SUPERCAN_DEBUG && SAME5X_DEBUG_TXR
 		SC_DEBUG_ASSERT(!(can->txr & (UINT32_C(1) << msg->track_id)));
 
@@ -704,7 +813,103 @@ SC_RAMFUNC extern bool sc_board_can_tx_queue(uint8_t index, struct sc_msg_can_tx
 #endif
 	}
 
-	return available;
+	if (txbar) {
+		// one request for all elements, the put index advances past all of them
+		can->m_can->TXBAR.reg = txbar;
+	}
+
+	return queued;
+}
+
+SC_RAMFUNC extern void sc_board_can_status_fill(uint8_t index, struct sc_msg_can_status *msg)
+{
+	struct same5x_can *can = &same5x_cans[index];
+
+	msg->rx_fifo_size = __atomic_load_n(&can->rx_put_index, __ATOMIC_ACQUIRE) - can->rx_get_index;
+	msg->tx_fifo_size = CAN_TX_FIFO_QUEUE_SIZE - can->m_can->TXFQS.bit.TFFL;
+	msg->tx_queue_size[0] = __builtin_popcount(can->m_can->TXBRP.reg & CAN_TX_BUFFER_MASK);
+}
+
+SC_RAMFUNC static inline void can_rx_pop(struct same5x_can *can, uint8_t get_index)
+{
+#if SAME5X_CAN_RX_SINGLE_COPY
+	// release the element to M_CAN before the index update, see can_poll
+	can->m_can->RXF0A.reg = CAN_RXF0A_F0AI(get_index);
+#else
+	(void)get_index;
+#endif
+
+	__atomic_store_n(&can->rx_get_index, can->rx_get_index+1, __ATOMIC_RELEASE);
+}
+
+/* Serializes a received frame.
+ *
+ * return  bytes placed, 0 if out of space, -1 if dropped by the software filter
+ */
+SC_RAMFUNC static int can_rx_place(
+	uint8_t index,
+	CAN_RXF0E_0_Type r0,
+	CAN_RXF0E_1_Type r1,
+	uint8_t const *frame_data,
+	uint32_t ts,
+	uint8_t *tx_ptr,
+	uint8_t *tx_end)
+{
+	struct same5x_can *can = &same5x_cans[index];
+	uint8_t can_frame_len = dlc_to_len(r1.bit.DLC);
+	uint8_t flags = 0;
+	uint32_t id = r0.bit.ID;
+	uint8_t *data = NULL;
+	uint8_t bytes = 0;
+	uint8_t swf = 0;
+
+	if (r0.bit.XTD) {
+		flags |= SC_CAN_FRAME_FLAG_EXT;
+	} else {
+		id >>= 18;
+	}
+
+	if (r1.bit.FDF) {
+		flags |= SC_CAN_FRAME_FLAG_FDF;
+		if (r1.bit.BRS) {
+			flags |= SC_CAN_FRAME_FLAG_BRS;
+		}
+	} else if (r0.bit.RTR) {
+		flags |= SC_CAN_FRAME_FLAG_RTR;
+		can_frame_len = 0;
+	}
+
+	swf = sc_can_sw_filter_eval(index, id, flags, ts);
+
+	if (unlikely(swf & SC_SW_FILTER_DROP)) {
+		// dropped by software filter
+		sc_can_sw_filter_commit(index, swf, ts);
+		sc_can_bus_stats_frame(index, id, flags, r1.bit.DLC, false);
+		return -1;
+	}
+
+	bytes = sc_can_rx_msg_place(
+		index,
+		can->features & SC_FEATURE_FLAG_CRX,
+		tx_ptr,
+		tx_end,
+		id,
+		r1.bit.DLC,
+		flags,
+		ts,
+		can_frame_len,
+		&data);
+
+	if (bytes) {
+		memcpy(data, frame_data, can_frame_len);
+		sc_can_sw_filter_commit(index, swf, ts);
+		sc_can_bus_stats_frame(index, id, flags, r1.bit.DLC, false);
+
+		// LOG("rx store %u bytes\n", bytes);
+		// sc_dump_mem(msg, bytes);
+	}
+
+	return bytes;
 }
 
 SC_RAMFUNC extern int sc_board_can_retrieve(uint8_t index, uint8_t *tx_ptr, uint8_t *tx_end)
@@ -716,174 +921,120 @@ SC_RAMFUNC extern int sc_board_can_retrieve(uint8_t index, uint8_t *tx_ptr, uint
 	for (bool done = false; !done; ) {
 		done = true;
 
-		uint8_t rx_put_index = __atomic_load_n(&can->rx_put_index, __ATOMIC_ACQUIRE);
-
-		if (can->rx_get_index != rx_put_index) {
-			have_data_to_place = true;
-			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint8_t rx_put_index;
+		uint8_t rx_prio_put_index;
+		bool rx_pending = false;
+
+		// snapshot both lanes at once, a frame published in between
+		// could be older than the one picked
+		taskENTER_CRITICAL();
+		rx_put_index = __atomic_load_n(&can->rx_put_index, __ATOMIC_ACQUIRE);
+		rx_prio_put_index = __atomic_load_n(&can->rx_prio_put_index, __ATOMIC_ACQUIRE);
+#if SAME5X_CAN_RX_DMA
+		// FIFO0 frames in flight may be older than any priority frame
+		rx_pending = can->rx_dma_busy;
+#endif
+		taskEXIT_CRITICAL();
 
+		bool const have_rx = can->rx_get_index != rx_put_index;
+		bool const have_rx_prio = can->rx_prio_get_index != rx_prio_put_index;
 
+		if (have_rx || (have_rx_prio && !rx_pending)) {
 			uint8_t get_index = can->rx_get_index & (SC_BOARD_CAN_RX_FIFO_SIZE-1);
-			uint8_t bytes = sizeof(struct sc_msg_can_rx);
-			CAN_RXF0E_0_Type r0 = can->rx_frames[get_index].R0;
-			CAN_RXF0E_1_Type r1 = can->rx_frames[get_index].R1;
-			uint8_t can_frame_len = dlc_to_len(r1.bit.DLC);
+#if SAME5X_CAN_RX_SINGLE_COPY
+			struct can_rx_fifo_element const *e = &can->rx_fifo[get_index];
+			uint32_t const ts = can->rx_ts[get_index];
+#else
+			struct rx_frame const *e = &can->rx_frames[get_index];
+			uint32_t const ts = e->ts;
+#endif
+			struct rx_frame const *f = &can->rx_prio_frames[can->rx_prio_get_index & (CAN_RX_PRIO_FIFO_SIZE-1)];
+			// merge the lanes by timestamp to keep rx timestamps monotonic,
+			// the priority lane wins ties
+			bool const prio = have_rx_prio && (!have_rx || (int32_t)(f->ts - ts) <= 0);
+			int bytes = 0;
 
 			SC_DEBUG_ASSERT(rx_put_index - can->rx_get_index <= SC_BOARD_CAN_RX_FIFO_SIZE);
 
-			if (!r0.bit.RTR) {
-				bytes += can_frame_len;
-			}
+			have_data_to_place = true;
 
-			// align
-			if (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1)) {
-				bytes += SC_MSG_CAN_LEN_MULTIPLE - (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1));
+			if (prio) {
+				bytes = can_rx_place(index, f->R0, f->R1, f->data, f->ts, tx_ptr, tx_end);
+			} else {
+				bytes = can_rx_place(index, e->R0, e->R1, e->data, ts, tx_ptr, tx_end);
 			}
 
-
-			if ((size_t)(tx_end - tx_ptr) >= bytes) {
+			if (bytes) {
 				done = false;
 
-				// LOG("rx %u bytes\n", bytes);
-				struct sc_msg_can_rx *msg = (struct sc_msg_can_rx *)tx_ptr;
-				// usb_can->tx_offsets[usb_can->tx_bank] += bytes;
-				tx_ptr += bytes;
-				result += bytes;
-
-
-				msg->id = SC_MSG_CAN_RX;
-				msg->len = bytes;
-				msg->dlc = r1.bit.DLC;
-				msg->flags = 0;
-				uint32_t id = r0.bit.ID;
-				if (r0.bit.XTD) {
-					msg->flags |= SC_CAN_FRAME_FLAG_EXT;
-				} else {
-					id >>= 18;
+				if (bytes > 0) {
+					// usb_can->tx_offsets[usb_can->tx_bank] += bytes;
+					tx_ptr += bytes;
+					result += bytes;
 				}
-				msg->can_id = id;
-
-
-				uint32_t ts = can->rx_frames[get_index].ts;
-	// #if SUPERCAN_DEBUG
-	// 					uint32_t delta = (ts - rx_ts_last) & SC_TS_MAX;
-	// 					bool rx_ts_ok = delta <= SC_TS_MAX / 4;
-	// 					if (unlikely(!rx_ts_ok)) {
-	// 						taskDISABLE_INTERRUPTS();
-	// 						// SC_BOARD_CAN_init_begin(can);
-	// 						LOG("ch%u rx gi=%u ts=%lx prev=%lx\n", index, get_index, ts, rx_ts_last);
-	// 						for (unsigned i = 0; i < CAN_RX_FIFO_SIZE; ++i) {
-	// 							LOG("ch%u rx gi=%u ts=%lx\n", index, i, can->rx_frames[i].ts);
-	// 						}
-
-	// 					}
-	// 					SC_ASSERT(rx_ts_ok);
-	// 					// LOG("ch%u rx gi=%u d=%lx\n", index, get_index, ts - rx_ts_last);
-	// 					rx_ts_last = ts;
-	// #endif
-
-				msg->timestamp_us = ts;
-
-				// LOG("ch%u rx ts %lu\n", index, msg->timestamp_us);
-
-				if (r1.bit.FDF) {
-					msg->flags |= SC_CAN_FRAME_FLAG_FDF;
-					if (r1.bit.BRS) {
-						msg->flags |= SC_CAN_FRAME_FLAG_BRS;
+
+				if (prio) {
+					if (bytes > 0) {
+						sc_can_bulk_in_flush_now(index);
 					}
 
-					memcpy(msg->data, can->rx_frames[get_index].data, can_frame_len);
+					__atomic_store_n(&can->rx_prio_get_index, can->rx_prio_get_index+1, __ATOMIC_RELEASE);
 				} else {
-					if (r0.bit.RTR) {
-						msg->flags |= SC_CAN_FRAME_FLAG_RTR;
-					} else {
-						memcpy(msg->data, can->rx_frames[get_index].data, can_frame_len);
-					}
+					can_rx_pop(can, get_index);
 				}
-
-				// LOG("rx store %u bytes\n", bytes);
-				// sc_dump_mem(msg, bytes);
-
-				__atomic_store_n(&can->rx_get_index, can->rx_get_index+1, __ATOMIC_RELEASE);
 			}
 		}
 
 		uint8_t tx_put_index = __atomic_load_n(&can->tx_put_index, __ATOMIC_ACQUIRE);
 		if (can->tx_get_index != tx_put_index) {
-			have_data_to_place = true;
 			SC_DEBUG_ASSERT(tx_put_index - can->tx_get_index <= SC_BOARD_CAN_TX_FIFO_SIZE);
 
 			uint8_t get_index = can->tx_get_index & (SC_BOARD_CAN_TX_FIFO_SIZE-1);
-			struct sc_msg_can_txr *msg = NULL;
-			if ((size_t)(tx_end - tx_ptr) >= sizeof(*msg)) {
-				// LOG("1\n");
-				__atomic_thread_fence(__ATOMIC_ACQUIRE);
-				done = false;
-
-
-				msg = (struct sc_msg_can_txr *)tx_ptr;
-				// usb_can->tx_offsets[usb_can->tx_bank] += sizeof(*msg);
-				tx_ptr += sizeof(*msg);
-				result += sizeof(*msg);
+			CAN_TXEFE_0_Type t0 = can->tx_frames[get_index].T0;
+			CAN_TXEFE_1_Type t1 = can->tx_frames[get_index].T1;
+			uint8_t const track_id = t1.bit.MM;
+			uint8_t flags = 0;
+			int bytes = 0;
+
+			// Report the available flags back so host code
+			// needs to store less information.
+			if (t0.bit.XTD) {
+				flags |= SC_CAN_FRAME_FLAG_EXT;
+			}
 
-				CAN_TXEFE_0_Type t0 = can->tx_frames[get_index].T0;
-				CAN_TXEFE_1_Type t1 = can->tx_frames[get_index].T1;
+			if (t1.bit.FDF) {
+				flags |= SC_CAN_FRAME_FLAG_FDF;
 
-				msg->id = SC_MSG_CAN_TXR;
-				msg->len = sizeof(*msg);
-				msg->track_id = t1.bit.MM;
-#if SUPERCAN_DEBUG && SAME5X_DEBUG_TXR
-				SC_DEBUG_ASSERT(can->txr & (UINT32_C(1) << msg->track_id));
+				if (t0.bit.ESI) {
+					flags |= SC_CAN_FRAME_FLAG_ESI;
+				}
 
-				can->txr &= ~(UINT32_C(1) << msg->track_id);
-#endif
-				uint32_t ts = can->tx_frames[get_index].ts;
-	// #if SUPERCAN_DEBUG
-	// 					// bool tx_ts_ok = ts >= tx_ts_last || (TS_HI(tx_ts_last) == 0xffff && TS_HI(ts) == 0);
-	// 					uint32_t delta = (ts - tx_ts_last) & SC_TS_MAX;
-	// 					bool tx_ts_ok = delta <= SC_TS_MAX / 4;
-	// 					if (unlikely(!tx_ts_ok)) {
-	// 						taskDISABLE_INTERRUPTS();
-	// 						// SC_BOARD_CAN_init_begin(can);
-	// 						LOG("ch%u tx gi=%u ts=%lx prev=%lx\n", index, get_index, ts, tx_ts_last);
-	// 						for (unsigned i = 0; i < SC_BOARD_CAN_TX_FIFO_SIZE; ++i) {
-	// 							LOG("ch%u tx gi=%u ts=%lx\n", index, i, can->tx_frames[i].ts);
-	// 						}
-
-	// 					}
-	// 					SC_ASSERT(tx_ts_ok);
-	// 					// LOG("ch%u tx gi=%u d=%lx\n", index, get_index, ts - tx_ts_last);
-	// 					tx_ts_last = ts;
-	// #endif
-				msg->timestamp_us = ts;
-				msg->flags = 0;
-
-				// Report the available flags back so host code
-				// needs to store less information.
-				if (t0.bit.XTD) {
-					msg->flags |= SC_CAN_FRAME_FLAG_EXT;
+				if (t1.bit.BRS) {
+					flags |= SC_CAN_FRAME_FLAG_BRS;
+				}
+			} else {
+				if (t0.bit.RTR) {
+					flags |= SC_CAN_FRAME_FLAG_RTR;
 				}
+			}
 
-				if (t1.bit.FDF) {
-					msg->flags |= SC_CAN_FRAME_FLAG_FDF;
+			bytes = sc_can_txr_place(index, tx_ptr, tx_end, track_id, flags, can->tx_frames[get_index].ts);
 
-					if (t0.bit.ESI) {
-						msg->flags |= SC_CAN_FRAME_FLAG_ESI;
-					}
+			if (bytes >= 0) {
+				done = false;
 
-					if (t1.bit.BRS) {
-						msg->flags |= SC_CAN_FRAME_FLAG_BRS;
-					}
-				} else {
-					if (t0.bit.RTR) {
-						msg->flags |= SC_CAN_FRAME_FLAG_RTR;
-					}
-				}
+				// usb_can->tx_offsets[usb_can->tx_bank] += bytes;
+				tx_ptr += bytes;
+				result += bytes;
+#if SUPERCAN_DEBUG && SAME5X_DEBUG_TXR
+				SC_DEBUG_ASSERT(can->txr & (UINT32_C(1) << track_id));
 
-				// LOG("2\n");
+				can->txr &= ~(UINT32_C(1) << track_id);
+#endif
 
 				__atomic_store_n(&can->tx_get_index, can->tx_get_index+1, __ATOMIC_RELEASE);
-				// LOG("3\n");
+			} else {
+				have_data_to_place = true;
 			}
 		}
 	}
@@ -896,174 +1047,196 @@ SC_RAMFUNC extern int sc_board_can_retrieve(uint8_t index, uint8_t *tx_ptr, uint
 }
 
 
-SC_RAMFUNC static inline void can_frame_bits(
-	uint32_t xtd,
-	uint32_t rtr,
-	uint32_t fdf,
-	uint32_t brs,
-	uint8_t dlc,
-	uint32_t* nmbr_bits,
-	uint32_t* dtbr_bits)
+SC_RAMFUNC static inline uint32_t can_frame_time_us(
+	uint8_t index,
+	uint32_t nm,
+	uint32_t dt)
 {
-	uint32_t payload_bits = dlc_to_len(dlc) * UINT32_C(8); /* payload */
+	struct same5x_can *can = &same5x_cans[index];
+	return can->nm_us_per_bit * nm + ((can->dt_us_per_bit_factor_shift8 * dt) >> 8);
+}
 
-	/* For SOF / interframe spacing, see ISO 11898-1:2015(E) 10.4.2.2 SOF
-	 *
-	 * Since the third bit (if dominant) in the interframe space marks
-	 * SOF, there could be sitiuations in which the IFS is only 2 bit times
-	 * long. The solution adopted here is to compute including 1 bit time SOF and shorted
-	 * IFS to 2.
-	 */
+#if SC_BOARD_CAN_HW_TS
+/* extends a 16 bit frame timestamp captured before tsc was read */
+SC_RAMFUNC static inline uint32_t can_hw_ts(uint32_t tsc, uint16_t ts)
+{
+	return tsc - (uint16_t)((uint16_t)tsc - ts); // must be in type!
+}
+#endif
 
-	if (fdf) {
-		// FD frames have a 3 bit stuff count field and a 1 bit parity field prior to the actual checksum
-		// There is a stuff bit at the begin of the stuff count field (always) and then at fixed positions
-		// every 4 bits.
-		uint32_t crc_bits = dlc <= 10 ? (17+4+5) : (21+4+6);
-
-		if (brs) {
-			*dtbr_bits =
-				1 /* ESI */
-				+ 4 /* DLC */
-				+ payload_bits
-				+ crc_bits; /* CRC */
-
-			if (xtd) {
-				*nmbr_bits =
-					1 /* SOF? */
-					+ 11 /* ID */
-					+ 1 /* SRR */
-					+ 1 /* IDE */
-					+ 18 /* ID */
-					+ 1 /* reserved 0 */
-					+ 1 /* EDL */
-					+ 1 /* reserved 0 */
-					+ 1 /* BRS */
-					// + 1 /* ESI */
-					// + 4 /* DLC */
-					// + dlc_to_len(dlc) * UINT32_C(8) /* payload */
-					// + /* CRC */
-					+ 1 /* CRC delimiter */
-					+ 1 /* ACK slot */
-					+ 1 /* ACK delimiter */
-					+ 7 /* EOF */
-					+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
+#if SUPERCAN_ISR_CYCLES
+static struct sc_isr_cycles isr_cycles[TU_ARRAY_SIZE(same5x_cans)];
+#endif
 
-			} else {
-				*nmbr_bits =
-					1 /* SOF */
-					+ 11 /* ID */
-					+ 1 /* reserved 1 */
-					+ 1 /* IDE */
-					+ 1 /* EDL */
-					+ 1 /* reserved 0 */
-					+ 1 /* BRS */
-					// + 1 /* ESI */
-					// + 4 /* DLC */
-					// + dlc_to_len(dlc) * UINT32_C(8) /* payload */
-					// + /* CRC */
-					+ 1 /* CRC delimiter */
-					+ 1 /* ACK slot */
-					+ 1 /* ACK delimiter */
-					+ 7 /* EOF */
-					+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
-			}
-		} else {
-			*dtbr_bits = 0;
-
-			if (xtd) {
-				*nmbr_bits =
-					1 /* SOF */
-					+ 11 /* ID */
-					+ 1 /* SRR */
-					+ 1 /* IDE */
-					+ 18 /* ID */
-					+ 1 /* reserved 0 */
-					+ 1 /* EDL */
-					+ 1 /* reserved 0 */
-					+ 1 /* BRS */
-					+ 1 /* ESI */
-					+ 4 /* DLC */
-					+ payload_bits
-					+ crc_bits /* CRC */
-					+ 1 /* CRC delimiter */
-					+ 1 /* ACK slot */
-					+ 1 /* ACK delimiter */
-					+ 7 /* EOF */
-					+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
-			} else {
-				*nmbr_bits =
-					1 /* SOF */
-					+ 11 /* ID */
-					+ 1 /* reserved 1 */
-					+ 1 /* IDE */
-					+ 1 /* EDL */
-					+ 1 /* reserved 0 */
-					+ 1 /* BRS */
-					+ 1 /* ESI */
-					+ 4 /* DLC */
-					+ payload_bits
-					+ crc_bits /* CRC */
-					+ 1 /* CRC delimiter */
-					+ 1 /* ACK slot */
-					+ 1 /* ACK delimiter */
-					+ 7 /* EOF */
-					+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
-			}
-		}
-	} else {
-		*dtbr_bits = 0;
-
-		if (xtd) {
-			*nmbr_bits =
-				1 /* SOF */
-				+ 11 /* non XTD identifier part */
-				+ 1 /* SRR */
-				+ 1 /* IDE */
-				+ 18 /* XTD identifier part */
-				+ 1 /* RTR */
-				+ 2 /* reserved */
-				+ 4 /* DLC */
-				+ (!rtr) * payload_bits
-				+ 15 /* CRC */
-				+ 1 /* CRC delimiter */
-				+ 1 /* ACK slot */
-				+ 1 /* ACK delimiter */
-				+ 7 /* EOF */
-				+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
-		} else {
-			*nmbr_bits =
-				1 /* SOF */
-				+ 11 /* ID */
-				+ 1 /* RTR */
-				+ 1 /* IDE */
-				+ 1 /* reserved */
-				+ 4 /* DLC */
-				+ (!rtr) * payload_bits
-				+ 15 /* CRC */
-				+ 1 /* CRC delimiter */
-				+ 1 /* ACK slot */
-				+ 1 /* ACK delimiter */
-				+ 7 /* EOF */
-				+ 2; /* INTERFRAME SPACE: INTERMISSION (3) + (SUSPEND TRANSMISSION)? + (BUS IDLE)? */
-		}
+#if SAME5X_CAN_RX_DMA
+SC_RAMFUNC static inline DmacDescriptor *can_rx_dma_desc(uint8_t index, uint8_t n)
+{
+	return n ? &dmac_rx_descriptors[index][n-1] : &dmac_descriptors[index];
+}
+
+SC_RAMFUNC static inline void can_rx_dma_add(uint8_t index, uint8_t n, void const *src, void *dst, uint32_t bytes)
+{
+	DmacDescriptor *d = can_rx_dma_desc(index, n);
+	uint32_t const words = (bytes + 3) / 4;
+
+	// addresses point to the end of the block for incrementing transfers
+	d->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_WORD | DMAC_BTCTRL_SRCINC | DMAC_BTCTRL_DSTINC;
+	d->BTCNT.reg = words;
+	d->SRCADDR.reg = (uint32_t)src + words * 4;
+	d->DSTADDR.reg = (uint32_t)dst + words * 4;
+	d->DESCADDR.reg = 0;
+
+	if (n) {
+		can_rx_dma_desc(index, n - 1)->DESCADDR.reg = (uint32_t)d;
 	}
 }
 
-SC_RAMFUNC static inline uint32_t can_frame_time_us(
-	uint8_t index,
-	uint32_t nm,
-	uint32_t dt)
+SC_RAMFUNC static inline void can_rx_dma_start(uint8_t index, uint8_t count, uint8_t get_index, uint8_t put_index)
 {
 	struct same5x_can *can = &same5x_cans[index];
-	return can->nm_us_per_bit * nm + ((can->dt_us_per_bit_factor_shift8 * dt) >> 8);
+
+	can_rx_dma_desc(index, count - 1)->BTCTRL.reg |= DMAC_BTCTRL_BLOCKACT_INT;
+
+	can->rx_dma_get_index = get_index;
+	can->rx_dma_put_index = put_index;
+	can->rx_dma_count = count;
+	can->rx_dma_busy = true;
+
+	__DMB(); // descriptors written before the DMAC fetches them
+
+	DMAC->Channel[index].CHCTRLA.bit.ENABLE = 1;
+	DMAC->SWTRIGCTRL.reg = UINT32_C(1) << index;
+}
+
+/* runs at the same priority as the CAN interrupt, never concurrently */
+SC_RAMFUNC static void can_rx_dma_int(uint8_t index)
+{
+	struct same5x_can *can = &same5x_cans[index];
+	uint8_t const flags = DMAC->Channel[index].CHINTFLAG.reg;
+
+	DMAC->Channel[index].CHINTFLAG.reg = flags;
+
+	if (unlikely(!can->rx_dma_busy)) {
+		// transfer dropped by can_off
+		return;
+	}
+
+	SC_ISR_ASSERT(!(flags & DMAC_CHINTFLAG_TERR));
+
+	can->rx_dma_busy = false;
+
+	// removes frames from rx fifo
+	can->m_can->RXF0A.reg = CAN_RXF0A_F0AI(can->rx_dma_get_index);
+
+	// atomic update of rx put index
+	__atomic_store_n(&can->rx_put_index, can->rx_dma_put_index, __ATOMIC_RELEASE);
+
+	sc_can_notify_task_isr(index, can->rx_dma_count);
+
+	if (can->m_can->RXF0S.bit.F0FL) {
+		// frames arrived during the transfer
+		NVIC_SetPendingIRQ(can->interrupt_id);
+	}
 }
 
+SC_RAMFUNC void DMAC_0_Handler(void)
+{
+	can_rx_dma_int(0);
+}
+
+SC_RAMFUNC void DMAC_1_Handler(void)
+{
+	can_rx_dma_int(1);
+}
+#endif
+
 #ifdef SUPERCAN_DEBUG
 static volatile uint32_t rx_lost_reported[TU_ARRAY_SIZE(same5x_cans)];
 // static volatile uint32_t rx_ts_last[TU_ARRAY_SIZE(same5x_cans)];
 #endif
 
+/* Copies frames of the priority lane (rx fifo1). Timestamps are
+ * reconstructed the same way as in can_poll, but only across fifo1.
+ */
+SC_RAMFUNC static void can_poll_prio(
+	uint8_t index,
+	uint32_t* const events,
+	uint32_t tsc)
+{
+	struct same5x_can *can = &same5x_cans[index];
+	CAN_RXF1S_Type const rxf1s = can->m_can->RXF1S;
+	uint8_t const count = rxf1s.bit.F1FL;
+	uint8_t get_index = 0;
+	uint8_t pi = can->rx_prio_put_index;
+	unsigned rx_lost = 0;
+#if !SC_BOARD_CAN_HW_TS
+	uint32_t tsv[CAN_RX_PRIO_FIFO_SIZE];
+	uint32_t ts = tsc;
+
+	for (uint8_t i = 0; i < count; ++i) {
+		struct can_rx_fifo_element const *e = NULL;
+		uint32_t nmbr_bits, dtbr_bits;
+
+		get_index = (rxf1s.bit.F1GI + count - 1 - i) & (CAN_RX_PRIO_FIFO_SIZE-1);
+		e = &can->rx_prio_fifo[get_index];
+		tsv[get_index] = ts;
+
+		sc_can_frame_bits(e->R0.bit.XTD, e->R0.bit.RTR, e->R1.bit.FDF, e->R1.bit.BRS, e->R1.bit.DLC, &nmbr_bits, &dtbr_bits);
+
+		ts -= can_frame_time_us(index, nmbr_bits, dtbr_bits);
+	}
+#endif
+
+	for (uint8_t i = 0; i < count; ++i) {
+		uint8_t const used = pi - __atomic_load_n(&can->rx_prio_get_index, __ATOMIC_ACQUIRE);
+
+		get_index = (rxf1s.bit.F1GI + i) & (CAN_RX_PRIO_FIFO_SIZE-1);
+
+		if (unlikely(used == CAN_RX_PRIO_FIFO_SIZE)) {
+			++rx_lost;
+		} else {
+			struct can_rx_fifo_element const *e = &can->rx_prio_fifo[get_index];
+			struct rx_frame *f = &can->rx_prio_frames[pi & (CAN_RX_PRIO_FIFO_SIZE-1)];
+			CAN_RXF0E_0_Type const r0 = e->R0;
+			CAN_RXF0E_1_Type const r1 = e->R1;
+
+			f->R0 = r0;
+			f->R1 = r1;
+#if SC_BOARD_CAN_HW_TS
+			f->ts = can_hw_ts(tsc, r1.bit.RXTS);
+#else
+			f->ts = tsv[get_index];
+#endif
+
+			if (likely(!r0.bit.RTR)) {
+				memcpy(f->data, e->data, dlc_to_len(r1.bit.DLC));
+			}
+
+			++pi;
+			++*events;
+		}
+	}
+
+	if (count) {
+		// removes frames from rx fifo1
+		can->m_can->RXF1A.reg = CAN_RXF1A_F1AI(get_index);
+
+		// atomic update of rx priority put index
+		__atomic_store_n(&can->rx_prio_put_index, pi, __ATOMIC_RELEASE);
+	}
+
+	if (unlikely(rx_lost)) {
+		sc_can_status status;
+
+		status.type = SC_CAN_STATUS_FIFO_TYPE_RX_LOST;
+		status.timestamp_us = tsc;
+		status.rx_lost = rx_lost;
+
+		sc_can_status_queue(index, &status);
+		++*events;
+	}
+}
+
 SC_RAMFUNC static void can_poll(
 	uint8_t index,
 	uint32_t* const events,
@@ -1071,30 +1244,71 @@ SC_RAMFUNC static void can_poll(
 {
 	struct same5x_can *can = &same5x_cans[index];
 
+#if !SC_BOARD_CAN_HW_TS
 	uint32_t tsv[SC_BOARD_CAN_RX_FIFO_SIZE];
+#endif
+#if SUPERCAN_ISR_CYCLES
+	uint32_t const cycles_start = sc_isr_cycles_now();
+	uint32_t frames = 0;
+#endif
 	uint8_t count = 0;
 	unsigned rx_lost = 0;
 	uint8_t pi = 0;
-
+	uint8_t rx_gi = 0;
+
+#if SAME5X_CAN_RX_SINGLE_COPY
+	{
+		// Frames stay in the rx fifo until the CAN task has serialized
+		// them. M_CAN's put index tells which ones are new. The fifo
+		// runs in blocking mode, frames that don't fit are dropped by
+		// M_CAN and reported through RF0L.
+		CAN_RXF0S_Type const rxf0s = can->m_can->RXF0S;
+
+		rx_gi = can->rx_put_index;
+		count = (rxf0s.bit.F0PI - rx_gi) & (SC_BOARD_CAN_RX_FIFO_SIZE-1);
+
+		if (unlikely(!count && rxf0s.bit.F0F && rx_gi == __atomic_load_n(&can->rx_get_index, __ATOMIC_ACQUIRE))) {
+			// full of frames not yet published
+			count = SC_BOARD_CAN_RX_FIFO_SIZE;
+		}
+	}
+#else
 	count = can->m_can->RXF0S.bit.F0FL;
+	rx_gi = can->m_can->RXF0S.bit.F0GI;
+#endif
+
+#if SAME5X_CAN_RX_DMA
+	if (can->rx_dma_busy) {
+		// picked up when the transfer completes
+		count = 0;
+	}
+#endif
 
 	if (count) {
+		uint8_t get_index;
+#if SAME5X_CAN_RX_DMA
+		uint8_t dma_count = 0;
+#endif
 // #ifdef SUPERCAN_DEBUG
 // 		uint32_t us = tsc - rx_ts_last[index];
 // 		rx_ts_last[index] = tsc;
 // 		LOG("ch%u rx dt=%lu\n", index, (unsigned long)us);
 // #endif
+#if SUPERCAN_ISR_CYCLES
+		frames += count;
+#endif
+#if !SC_BOARD_CAN_HW_TS
 		// reverse loop reconstructs timestamps
 		uint32_t ts = tsc;
-		uint8_t get_index;
-		for (uint8_t i = 0, gio = can->m_can->RXF0S.bit.F0GI; i < count; ++i) {
-			get_index = (gio + count - 1 - i) & (SC_BOARD_CAN_RX_FIFO_SIZE-1);
+
+		for (uint8_t i = 0; i < count; ++i) {
+			get_index = (rx_gi + count - 1 - i) & (SC_BOARD_CAN_RX_FIFO_SIZE-1);
 			// LOG("ch%u ts rx count=%u gi=%u\n", index, count, get_index);
 
 			tsv[get_index] = ts & SC_TS_MAX;
 
 			uint32_t nmbr_bits, dtbr_bits;
-			can_frame_bits(
+			sc_can_frame_bits(
 				can->rx_fifo[get_index].R0.bit.XTD,
 				can->rx_fifo[get_index].R0.bit.RTR,
 				can->rx_fifo[get_index].R1.bit.FDF,
@@ -1114,12 +1328,29 @@ SC_RAMFUNC static void can_poll(
 
 			ts -= can_frame_time_us(index, nmbr_bits, dtbr_bits);
 		}
+#endif
+
+#if SAME5X_CAN_RX_SINGLE_COPY
+		for (uint8_t i = 0; i < count; ++i) {
+			get_index = (rx_gi + i) & (SC_BOARD_CAN_RX_FIFO_SIZE-1);
+
+#if SC_BOARD_CAN_HW_TS
+			can->rx_ts[get_index] = can_hw_ts(tsc, can->rx_fifo[get_index].R1.bit.RXTS);
+#else
+			can->rx_ts[get_index] = tsv[get_index];
+#endif
+		}
 
+		// frames are acknowledged by the CAN task once serialized
+		__atomic_store_n(&can->rx_put_index, (uint8_t)(rx_gi + count), __ATOMIC_RELEASE);
+
+		*events += count;
+#else
 		// forward loop stores frames and notifies usb task
 		pi = can->rx_put_index;
 
-		for (uint8_t i = 0, gio = can->m_can->RXF0S.bit.F0GI; i < count; ++i) {
-			get_index = (gio + i) & (SC_BOARD_CAN_RX_FIFO_SIZE-1);
+		for (uint8_t i = 0; i < count; ++i) {
+			get_index = (rx_gi + i) & (SC_BOARD_CAN_RX_FIFO_SIZE-1);
 
 			uint8_t rx_get_index = __atomic_load_n(&can->rx_get_index, __ATOMIC_ACQUIRE);
 			uint8_t used = pi - rx_get_index;
@@ -1133,7 +1364,7 @@ SC_RAMFUNC static void can_poll(
 				{
 					if (rx_lost_reported[index] + UINT32_C(1000000) <= tsc) {
 						rx_lost_reported[index] = tsc;
-						LOG("ch%u rx lost %lx pi=%u gi=%u\n", index, ts, pi, rx_get_index);
+						LOG("ch%u rx lost %lx pi=%u gi=%u\n", index, tsc, pi, rx_get_index);
 					}
 				}
 #endif
@@ -1142,15 +1373,29 @@ SC_RAMFUNC static void can_poll(
 				CAN_RXF0E_0_Type const r0 = can->rx_fifo[get_index].R0;
 				CAN_RXF0E_1_Type const r1 = can->rx_fifo[get_index].R1;
 
+#if SC_BOARD_CAN_HW_TS
+				can->rx_frames[put_index].ts = can_hw_ts(tsc, r1.bit.RXTS);
+#else
+				can->rx_frames[put_index].ts = tsv[get_index];
+#endif
+#if SAME5X_CAN_RX_DMA
+				can_rx_dma_add(
+					index,
+					dma_count++,
+					&can->rx_fifo[get_index],
+					&can->rx_frames[put_index],
+					offsetof(struct rx_frame, data) + (!r0.bit.RTR) * dlc_to_len(r1.bit.DLC));
+#else
 				can->rx_frames[put_index].R0 = r0;
 				can->rx_frames[put_index].R1 = r1;
-				can->rx_frames[put_index].ts = tsv[get_index];
+
 				if (likely(!r0.bit.RTR)) {
 					uint8_t can_frame_len = dlc_to_len(r1.bit.DLC);
 					if (likely(can_frame_len)) {
 						memcpy(can->rx_frames[put_index].data, can->rx_fifo[get_index].data, can_frame_len);
 					}
 				}
+#endif
 
 				++pi;
 
@@ -1162,22 +1407,39 @@ SC_RAMFUNC static void can_poll(
 				// BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 				// vTaskNotifyGiveFromISR(can->usb_task_handle, &xHigherPriorityTaskWoken);
 				// portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+#if !SAME5X_CAN_RX_DMA
 				++*events;
+#endif
 			}
 		}
 
+#if SAME5X_CAN_RX_DMA
+		if (likely(dma_count)) {
+			can_rx_dma_start(index, dma_count, get_index, pi);
+		} else {
+			// all frames lost
+			can->m_can->RXF0A.reg = CAN_RXF0A_F0AI(get_index);
+		}
+#else
 		// removes frames from rx fifo
 		can->m_can->RXF0A.reg = CAN_RXF0A_F0AI(get_index);
 
 		// atomic update of rx put index
 		__atomic_store_n(&can->rx_put_index, pi, __ATOMIC_RELEASE);
+#endif
+#endif // SAME5X_CAN_RX_SINGLE_COPY
 	}
 
 	count = can->m_can->TXEFS.bit.EFFL;
 	if (count) {
+		uint8_t get_index;
+
+#if SUPERCAN_ISR_CYCLES
+		frames += count;
+#endif
+#if !SC_BOARD_CAN_HW_TS
 		// reverse loop reconstructs timestamps
 		uint32_t ts = tsc;
-		uint8_t get_index;
 		uint32_t txp = can->m_can->CCCR.bit.TXP * 2;
 		for (uint8_t i = 0, gio = can->m_can->TXEFS.bit.EFGI; i < count; ++i) {
 			get_index = (gio + count - 1 - i) & (SC_BOARD_CAN_TX_FIFO_SIZE-1);
@@ -1186,7 +1448,7 @@ SC_RAMFUNC static void can_poll(
 			tsv[get_index] = ts & SC_TS_MAX;
 
 			uint32_t nmbr_bits, dtbr_bits;
-			can_frame_bits(
+			sc_can_frame_bits(
 				can->tx_event_fifo[get_index].T0.bit.XTD,
 				can->tx_event_fifo[get_index].T0.bit.RTR,
 				can->tx_event_fifo[get_index].T1.bit.FDF,
@@ -1197,6 +1459,7 @@ SC_RAMFUNC static void can_poll(
 
 			ts -= can_frame_time_us(index, nmbr_bits + txp, dtbr_bits);
 		}
+#endif
 
 		// forward loop stores frames and notifies usb task
 		pi = can->tx_put_index;
@@ -1210,7 +1473,11 @@ SC_RAMFUNC static void can_poll(
 			// } else {
 				can->tx_frames[put_index].T0 = can->tx_event_fifo[get_index].T0;
 				can->tx_frames[put_index].T1 = can->tx_event_fifo[get_index].T1;
+#if SC_BOARD_CAN_HW_TS
+				can->tx_frames[put_index].ts = can_hw_ts(tsc, can->tx_frames[put_index].T1.bit.TXTS);
+#else
 				can->tx_frames[put_index].ts = tsv[get_index];
+#endif
 				// LOG("ch%u tx place MM %u @ index %u\n", index, can->tx_frames[put_index].T1.bit.MM, put_index);
 
 				//__atomic_store_n(&can->tx_put_index, target_put_index, __ATOMIC_RELEASE);
@@ -1243,6 +1510,10 @@ SC_RAMFUNC static void can_poll(
 		sc_can_status_queue(index, &status);
 		++*events;
 	}
+
+#if SUPERCAN_ISR_CYCLES
+	sc_isr_cycles_account(index, &isr_cycles[index], cycles_start, frames);
+#endif
 }
 
 extern sc_can_bit_timing_range const* sc_board_can_nm_bit_timing_range(uint8_t index)
@@ -1275,6 +1546,28 @@ extern void sc_board_can_go_bus(uint8_t index, bool on)
 	}
 }
 
+extern void sc_board_can_filter_set(uint8_t index, bool ext, uint8_t element, sc_can_filter const *filter)
+{
+	struct same5x_can *can = &same5x_cans[index];
+
+	// classic filter: ID1 = filter, ID2 = mask
+	if (ext) {
+		struct can_ext_filter_element *e = &can->rx_ext_filters[element];
+
+		e->F0.reg = CAN_XIDFE_0_EFID1(filter->can_id)
+			| CAN_XIDFE_0_EFEC(filter->enabled ? (filter->prio ? CAN_XIDFE_0_EFEC_STF1M_Val : CAN_XIDFE_0_EFEC_STF0M_Val) : CAN_XIDFE_0_EFEC_DISABLE_Val);
+		e->F1.reg = CAN_XIDFE_1_EFID2(filter->mask)
+			| CAN_XIDFE_1_EFT(CAN_XIDFE_1_EFT_CLASSIC_Val);
+	} else {
+		struct can_std_filter_element *e = &can->rx_std_filters[element];
+
+		e->S0.reg = CAN_SIDFE_0_SFID1(filter->can_id)
+			| CAN_SIDFE_0_SFID2(filter->mask)
+			| CAN_SIDFE_0_SFEC(filter->enabled ? (filter->prio ? CAN_SIDFE_0_SFEC_STF1M_Val : CAN_SIDFE_0_SFEC_STF0M_Val) : CAN_SIDFE_0_SFEC_DISABLE_Val)
+			| CAN_SIDFE_0_SFT(CAN_SIDFE_0_SFT_CLASSIC_Val);
+	}
+}
+
 extern void sc_board_can_nm_bit_timing_set(uint8_t index, sc_can_bit_timing const *bt)
 {
 	struct same5x_can *can = &same5x_cans[index];
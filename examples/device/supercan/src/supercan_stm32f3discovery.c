@@ -46,6 +46,8 @@ static struct can {
 	struct rx_frame rx_fifo[SC_BOARD_CAN_RX_FIFO_SIZE];
 	struct tx_frame tx_fifo[SC_BOARD_CAN_TX_FIFO_SIZE];
 	struct txr txr_fifo[SC_BOARD_CAN_TX_FIFO_SIZE];
+	sc_can_filter rx_filters_std[SC_BOARD_CAN_FILTER_STD_COUNT];
+	sc_can_filter rx_filters_ext[SC_BOARD_CAN_FILTER_EXT_COUNT];
 	uint32_t nm_us_per_bit;
 #if SUPERCAN_DEBUG
 	volatile uint32_t txr; // volatile b/c of use in interrupt handler
@@ -67,6 +69,8 @@ static struct can {
 	uint8_t tx_mailbox_used_get_index; // NOT an index, uses full range of type
 	uint8_t tx_mailbox_used_put_index; // NOT an index, uses full range of type
 	uint8_t notify; // keep notifying main loop for busy light
+	bool rx_compact;
+	bool rx_filter;
 } stm32_cans[SC_BOARD_CAN_COUNT];
 
 struct led {
@@ -346,15 +350,18 @@ extern uint16_t sc_board_can_feat_conf(uint8_t index)
 	return CAN_FEAT_CONF;
 }
 
-SC_RAMFUNC extern bool sc_board_can_tx_queue(uint8_t index, struct sc_msg_can_tx const * msg)
+SC_RAMFUNC extern uint8_t sc_board_can_tx_queue_n(uint8_t index, struct sc_msg_can_tx const * const *msgs, uint8_t count)
 {
 	struct can *can = &stm32_cans[index];
 	uint8_t const tx_gi = __atomic_load_n(&can->tx_get_index, __ATOMIC_ACQUIRE);
 	uint8_t tx_pi = can->tx_put_index;
 	uint8_t used = tx_pi - tx_gi;
-	bool available = used < TU_ARRAY_SIZE(can->tx_fifo);
+	uint8_t queued = 0;
 
-	if (available) {
+	count = tu_min8(count, TU_ARRAY_SIZE(can->tx_fifo) - used);
+
+	for (; queued < count; ++queued, ++tx_pi) {
+		struct sc_msg_can_tx const *msg = msgs[queued];
 		uint8_t const tx_pi_mod = tx_pi % TU_ARRAY_SIZE(can->tx_fifo);
 		struct tx_frame *txf = &can->tx_fifo[tx_pi_mod];
 
@@ -389,15 +396,25 @@ SC_RAMFUNC extern bool sc_board_can_tx_queue(uint8_t index, struct sc_msg_can_tx
 		}
 
 		txf->track_id = msg->track_id;
+	}
 
+	if (queued) {
 		// mark available
-		__atomic_store_n(&can->tx_put_index, tx_pi + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&can->tx_put_index, tx_pi, __ATOMIC_RELEASE);
 
 		// flag interrupt to handle actual transmit
 		NVIC_SetPendingIRQ(CAN_TX_IRQn);
 	}
 
-	return available;
+	return queued;
+}
+
+SC_RAMFUNC extern void sc_board_can_status_fill(uint8_t index, struct sc_msg_can_status *msg)
+{
+	struct can *can = &stm32_cans[index];
+
+	msg->rx_fifo_size = __atomic_load_n(&can->rx_put_index, __ATOMIC_ACQUIRE) - can->rx_get_index;
+	msg->tx_fifo_size = can->tx_put_index - __atomic_load_n(&can->tx_get_index, __ATOMIC_ACQUIRE);
 }
 
 
@@ -416,83 +433,88 @@ SC_RAMFUNC extern int sc_board_can_retrieve(uint8_t index, uint8_t *tx_ptr, uint
 		done = true;
 
 		if (txr_gi != txr_pi) {
-			struct sc_msg_can_txr *txr = NULL;
-			uint8_t const bytes = sizeof(*txr);
-
-			have_data_to_place = true;
-
+			uint8_t const txr_gi_mod = txr_gi % TU_ARRAY_SIZE(can->txr_fifo);
+			uint8_t const track_id = can->txr_fifo[txr_gi_mod].track_id;
+			int const bytes = sc_can_txr_place(index, tx_ptr, tx_end, track_id, 0, can->txr_fifo[txr_gi_mod].ts);
 
-			if ((size_t)(tx_end - tx_ptr) >= bytes) {
-				uint8_t const txr_gi_mod = txr_gi % TU_ARRAY_SIZE(can->txr_fifo);
+			if (bytes >= 0) {
 				done = false;
 
-				txr = (struct sc_msg_can_txr *)tx_ptr;
-
 				tx_ptr += bytes;
 				result += bytes;
 
-				txr->flags = 0;
-				txr->id = SC_MSG_CAN_TXR;
-				txr->len = bytes;
-				txr->track_id = can->txr_fifo[txr_gi_mod].track_id;
-				txr->timestamp_us = can->txr_fifo[txr_gi_mod].ts;
-
 				__atomic_store_n(&can->txr_get_index, txr_gi+1, __ATOMIC_RELEASE);
 
 #if SUPERCAN_DEBUG
-				SC_DEBUG_ASSERT(txr->track_id < 32);
-				SC_DEBUG_ASSERT(can->txr & (UINT32_C(1) << txr->track_id));
-				can->txr &= ~(UINT32_C(1) << txr->track_id);
+				SC_DEBUG_ASSERT(track_id < 32);
+				SC_DEBUG_ASSERT(can->txr & (UINT32_C(1) << track_id));
+				can->txr &= ~(UINT32_C(1) << track_id);
 #endif
 
-				// LOG("ch%u retrievd TXR %u\n", index, txr->track_id);
+				// LOG("ch%u retrievd TXR %u\n", index, track_id);
+			} else {
+				have_data_to_place = true;
 			}
 		}
 
 		if (rx_gi != rx_pi) {
-			struct sc_msg_can_rx *rx = NULL;
 			uint8_t const rx_gi_mod = rx_gi % TU_ARRAY_SIZE(can->rx_fifo);
 			struct rx_frame *rxf = &can->rx_fifo[rx_gi_mod];
 			uint8_t const dlc = (rxf->RDTR & CAN_RDT0R_DLC_Msk) >> CAN_RDT0R_DLC_Pos;
-			uint8_t bytes = sizeof(*rx) + dlc;
-
-			if (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1)) {
-				bytes += SC_MSG_CAN_LEN_MULTIPLE - (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1));
-			}
+			uint8_t can_frame_len = dlc;
+			uint32_t can_id = 0;
+			uint8_t flags = 0;
+			uint8_t *data = NULL;
+			uint8_t bytes = 0;
+			uint8_t swf = 0;
 
 			have_data_to_place = true;
 
+			if (rxf->RIR & CAN_RI0R_IDE) {
+				can_id = (rxf->RIR & (CAN_RI0R_EXID_Msk | CAN_RI0R_STID_Msk)) >> CAN_RI0R_EXID_Pos;
+				flags |= SC_CAN_FRAME_FLAG_EXT;
+			} else {
+				can_id = (rxf->RIR & CAN_RI0R_STID_Msk) >> CAN_RI0R_STID_Pos;
+			}
 
-			if ((size_t)(tx_end - tx_ptr) >= bytes) {
-				done = false;
-
-				rx = (struct sc_msg_can_rx *)tx_ptr;
-
-				tx_ptr += bytes;
-				result += bytes;
-
-				rx->id = SC_MSG_CAN_RX;
-				rx->len = bytes;
-				rx->dlc = dlc;
-				rx->flags = 0;
-				rx->timestamp_us = rxf->ts;
-
-				if (rxf->RIR & CAN_RI0R_IDE) {
-					rx->can_id = (rxf->RIR & (CAN_RI0R_EXID_Msk | CAN_RI0R_STID_Msk)) >> CAN_RI0R_EXID_Pos;
-					rx->flags |= SC_CAN_FRAME_FLAG_EXT;
-				} else {
-					rx->can_id = (rxf->RIR & CAN_RI0R_STID_Msk) >> CAN_RI0R_STID_Pos;
-				}
-
-				if (rxf->RIR & CAN_RI0R_RTR) {
-					rx->flags |= SC_CAN_FRAME_FLAG_RTR;
-				} else {
-					uint8_t const *d = (uint8_t const *)&rxf->RDLR;
+			if (rxf->RIR & CAN_RI0R_RTR) {
+				flags |= SC_CAN_FRAME_FLAG_RTR;
+				can_frame_len = 0;
+			}
 
-					memcpy(rx->data, d, dlc);
-				}
+			swf = sc_can_sw_filter_eval(index, can_id, flags, rxf->ts);
 
+			if (unlikely(swf & SC_SW_FILTER_DROP)) {
+				// dropped by software filter
+				done = false;
+				sc_can_sw_filter_commit(index, swf, rxf->ts);
+				sc_can_bus_stats_frame(index, can_id, flags, dlc, false);
 				__atomic_store_n(&can->rx_get_index, rx_gi+1, __ATOMIC_RELEASE);
+			} else {
+				bytes = sc_can_rx_msg_place(
+					index,
+					can->rx_compact,
+					tx_ptr,
+					tx_end,
+					can_id,
+					dlc,
+					flags,
+					rxf->ts,
+					can_frame_len,
+					&data);
+
+				if (bytes) {
+					done = false;
+
+					tx_ptr += bytes;
+					result += bytes;
+
+					memcpy(data, (uint8_t const *)&rxf->RDLR, can_frame_len);
+					sc_can_sw_filter_commit(index, swf, rxf->ts);
+					sc_can_bus_stats_frame(index, can_id, flags, dlc, false);
+
+					__atomic_store_n(&can->rx_get_index, rx_gi+1, __ATOMIC_RELEASE);
+				}
 			}
 		}
 	}
@@ -536,7 +558,10 @@ extern sc_can_bit_timing_range const* sc_board_can_dt_bit_timing_range(uint8_t i
 
 extern void sc_board_can_feat_set(uint8_t index, uint16_t features)
 {
-	(void)index;
+	struct can* can = &stm32_cans[index];
+
+	can->rx_compact = (features & SC_FEATURE_FLAG_CRX) != 0;
+	can->rx_filter = (features & SC_FEATURE_FLAG_FLT) != 0;
 
 	if (features & SC_FEATURE_FLAG_DAR) {
 		CAN->MCR |= CAN_MCR_NART;
@@ -551,6 +576,51 @@ extern void sc_board_can_feat_set(uint8_t index, uint16_t features)
 	}
 }
 
+/* One filter bank per element in 32-bit identifier mask mode, standard
+ * elements first. The bank layout matches CAN_RIxR.
+ */
+static void can_configure_filters(uint8_t index)
+{
+	struct can* can = &stm32_cans[index];
+	uint32_t active = 0;
+
+	TU_VERIFY_STATIC(SC_BOARD_CAN_FILTER_STD_COUNT + SC_BOARD_CAN_FILTER_EXT_COUNT <= 14, "bxCAN has 14 filter banks");
+
+	CAN->FMR |= CAN_FMR_FINIT;
+	CAN->FA1R = 0;
+
+	if (can->rx_filter) {
+		for (uint8_t i = 0; i < TU_ARRAY_SIZE(can->rx_filters_std); ++i) {
+			sc_can_filter const *f = &can->rx_filters_std[i];
+
+			if (f->enabled) {
+				CAN->sFilterRegister[i].FR1 = f->can_id << CAN_RI0R_STID_Pos;
+				CAN->sFilterRegister[i].FR2 = (f->mask << CAN_RI0R_STID_Pos) | CAN_RI0R_IDE;
+				active |= UINT32_C(1) << i;
+			}
+		}
+
+		for (uint8_t i = 0; i < TU_ARRAY_SIZE(can->rx_filters_ext); ++i) {
+			sc_can_filter const *f = &can->rx_filters_ext[i];
+			uint8_t const bank = SC_BOARD_CAN_FILTER_STD_COUNT + i;
+
+			if (f->enabled) {
+				CAN->sFilterRegister[bank].FR1 = (f->can_id << CAN_RI0R_EXID_Pos) | CAN_RI0R_IDE;
+				CAN->sFilterRegister[bank].FR2 = (f->mask << CAN_RI0R_EXID_Pos) | CAN_RI0R_IDE;
+				active |= UINT32_C(1) << bank;
+			}
+		}
+	} else {
+		// accept everything
+		CAN->sFilterRegister[0].FR1 = 0;
+		CAN->sFilterRegister[0].FR2 = 0;
+		active = 1;
+	}
+
+	CAN->FA1R = active;
+	CAN->FMR &= ~CAN_FMR_FINIT;
+}
+
 static void can_off(uint8_t index)
 {
 	struct can* can = &stm32_cans[index];
@@ -576,6 +646,8 @@ extern void sc_board_can_go_bus(uint8_t index, bool on)
 	struct can* can = &stm32_cans[index];
 
 	if (on) {
+		can_configure_filters(index);
+
 		NVIC_EnableIRQ(CAN_TX_IRQn);
 		NVIC_EnableIRQ(CAN_RX0_IRQn);
 		NVIC_EnableIRQ(CAN_SCE_IRQn);
@@ -588,6 +660,17 @@ extern void sc_board_can_go_bus(uint8_t index, bool on)
 	}
 }
 
+extern void sc_board_can_filter_set(uint8_t index, bool ext, uint8_t element, sc_can_filter const *filter)
+{
+	struct can* can = &stm32_cans[index];
+
+	if (ext) {
+		can->rx_filters_ext[element] = *filter;
+	} else {
+		can->rx_filters_std[element] = *filter;
+	}
+}
+
 extern void sc_board_can_nm_bit_timing_set(uint8_t index, sc_can_bit_timing const *bt)
 {
 	struct can* can = &stm32_cans[index];
@@ -624,11 +707,15 @@ extern uint32_t sc_board_identifier(void)
 
 extern void sc_board_can_reset(uint8_t index)
 {
-	// struct can* can = &stm32_cans[index];
+	struct can* can = &stm32_cans[index];
 
 	// disable CAN units, reset configuration & status
 	can_off(index);
 
+	memset(can->rx_filters_std, 0, sizeof(can->rx_filters_std));
+	memset(can->rx_filters_ext, 0, sizeof(can->rx_filters_ext));
+	can->rx_filter = false;
+
 }
 
 SC_RAMFUNC static inline uint8_t can_map_bxcan_ec(uint8_t value)
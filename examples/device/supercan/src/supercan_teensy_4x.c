@@ -44,6 +44,7 @@ enum {
 	// 14 requires 2 ram regions
 	RX_MAILBOX_COUNT = 14-TX_MAILBOX_COUNT,
 	// RX_MAILBOX_COUNT = 7-TX_MAILBOX_COUNT,
+	RX_MAILBOX_MASK = ((1 << RX_MAILBOX_COUNT) - 1) << TX_MAILBOX_COUNT,
 	MB_RX_INACTIVE = 0b0000,
 	MB_RX_EMPTY = 0b0100,
 	MB_RX_FULL = 0b0010,
@@ -58,6 +59,8 @@ enum {
 	MB_STEP_CAN = 0x10,
 	MB_STEP_CANFD = 0x48,
 
+	RXIMR_IDE_MASK = UINT32_C(1) << 30, // compare IDE, requires CTRL2[EACEN]
+
 	//MB_RX_CS_EMPTY_MUX = CAN_CS_CODE(MB_RX_EMPTY) | CAN_CS_IDE_MASK,
 	MB_RX_CS_EMPTY_MUX = CAN_CS_CODE(MB_RX_EMPTY),
 };
@@ -146,6 +149,8 @@ struct can {
 	struct rx_fifo_element rx_fifo[SC_BOARD_CAN_RX_FIFO_SIZE];
 	struct tx_fifo_element tx_fifo[SC_BOARD_CAN_TX_FIFO_SIZE];
 	struct txr_fifo_element txr_fifo[SC_BOARD_CAN_TX_FIFO_SIZE];
+	sc_can_filter rx_filters_std[SC_BOARD_CAN_FILTER_STD_COUNT];
+	sc_can_filter rx_filters_ext[SC_BOARD_CAN_FILTER_EXT_COUNT];
 	StaticTimer_t timer_mem;
 	TimerHandle_t timer_handle;
 	CAN_Type* const flex_can;
@@ -158,6 +163,8 @@ struct can {
 	uint8_t int_tx_track_id;
 	const bool fd_capable;
 	bool fd_enabled;
+	bool rx_compact;
+	bool rx_filter;
 	bool enabled;
 	bool int_tx_box_busy;
 
@@ -263,9 +270,11 @@ extern uint16_t sc_board_can_feat_conf(uint8_t index)
 					// | SC_FEATURE_FLAG_TXP
 					| SC_FEATURE_FLAG_EHD
 					| SC_FEATURE_FLAG_MON_MODE
+					| SC_FEATURE_FLAG_CRX
+					| SC_FEATURE_FLAG_FLT
 					;
 	case 1: // FlexCAN1
-		return SC_FEATURE_FLAG_MON_MODE;
+		return SC_FEATURE_FLAG_MON_MODE | SC_FEATURE_FLAG_CRX | SC_FEATURE_FLAG_FLT;
 	}
 
 	__unreachable();
@@ -273,9 +282,73 @@ extern uint16_t sc_board_can_feat_conf(uint8_t index)
 }
 
 
+/* Filter elements are implemented with the individual masks of the rx
+ * mailboxes. The mailboxes are distributed round robin over the active
+ * elements. Since FlexCAN stores a frame in the first free matching mailbox
+ * (MCR[IRMQ]) each element gets a queue of one or more mailboxes.
+ */
+static void init_rx_mailbox_filters(uint8_t index, uint32_t *ids, uint32_t *css)
+{
+	struct can *can = &cans[index];
+	sc_can_filter const *active[SC_BOARD_CAN_FILTER_STD_COUNT + SC_BOARD_CAN_FILTER_EXT_COUNT];
+	bool active_ext[TU_ARRAY_SIZE(active)];
+	uint8_t active_count = 0;
+
+	TU_VERIFY_STATIC(TU_ARRAY_SIZE(active) <= RX_MAILBOX_COUNT, "one mailbox per filter element");
+
+	for (uint8_t i = 0; i < TU_ARRAY_SIZE(can->rx_filters_std); ++i) {
+		if (can->rx_filters_std[i].enabled) {
+			active_ext[active_count] = false;
+			active[active_count++] = &can->rx_filters_std[i];
+		}
+	}
+
+	for (uint8_t i = 0; i < TU_ARRAY_SIZE(can->rx_filters_ext); ++i) {
+		if (can->rx_filters_ext[i].enabled) {
+			active_ext[active_count] = true;
+			active[active_count++] = &can->rx_filters_ext[i];
+		}
+	}
+
+	for (uint8_t i = 0; i < RX_MAILBOX_COUNT; ++i) {
+		uint8_t const box = TX_MAILBOX_COUNT + i;
+
+		if (active_count) {
+			uint8_t const k = i % active_count;
+
+			if (active_ext[k]) {
+				ids[i] = CAN_ID_EXT(active[k]->can_id);
+				css[i] = MB_RX_CS_EMPTY_MUX | CAN_CS_IDE_MASK;
+				can->flex_can->RXIMR[box] = CAN_ID_EXT(active[k]->mask) | RXIMR_IDE_MASK;
+			} else {
+				ids[i] = CAN_ID_STD(active[k]->can_id);
+				css[i] = MB_RX_CS_EMPTY_MUX;
+				can->flex_can->RXIMR[box] = CAN_ID_STD(active[k]->mask) | RXIMR_IDE_MASK;
+			}
+		} else {
+			// no active elements, don't receive
+			ids[i] = 0;
+			css[i] = CAN_CS_CODE(MB_RX_INACTIVE);
+			can->flex_can->RXIMR[box] = 0;
+		}
+	}
+}
+
 static void init_mailboxes(uint8_t index)
 {
 	struct can *can = &cans[index];
+	uint32_t rx_ids[RX_MAILBOX_COUNT];
+	uint32_t rx_css[RX_MAILBOX_COUNT];
+
+	if (can->rx_filter) {
+		init_rx_mailbox_filters(index, rx_ids, rx_css);
+	} else {
+		for (uint8_t i = 0; i < RX_MAILBOX_COUNT; ++i) {
+			rx_ids[i] = 0;
+			rx_css[i] = MB_RX_CS_EMPTY_MUX;
+			can->flex_can->RXIMR[TX_MAILBOX_COUNT + i] = 0; // don't care
+		}
+	}
 
 	if (can->fd_enabled) {
 		for (uint8_t i = 0; i < TX_MAILBOX_COUNT; ++i) {
@@ -283,9 +356,9 @@ static void init_mailboxes(uint8_t index)
 			can->flex_can->MB_64B[i].CS = CAN_CS_CODE(MB_TX_INACTIVE);
 		}
 
-		for (uint8_t i = TX_MAILBOX_COUNT; i < TX_MAILBOX_COUNT + RX_MAILBOX_COUNT; ++i) {
-			can->flex_can->MB_64B[i].ID = 0;
-			can->flex_can->MB_64B[i].CS = MB_RX_CS_EMPTY_MUX;
+		for (uint8_t i = 0; i < RX_MAILBOX_COUNT; ++i) {
+			can->flex_can->MB_64B[TX_MAILBOX_COUNT + i].ID = rx_ids[i];
+			can->flex_can->MB_64B[TX_MAILBOX_COUNT + i].CS = rx_css[i];
 		}
 	} else {
 		for (uint8_t i = 0; i < TX_MAILBOX_COUNT; ++i) {
@@ -293,9 +366,9 @@ static void init_mailboxes(uint8_t index)
 			can->flex_can->MB_8B[i].CS = CAN_CS_CODE(MB_TX_INACTIVE);
 		}
 
-		for (uint8_t i = TX_MAILBOX_COUNT; i < TX_MAILBOX_COUNT + RX_MAILBOX_COUNT; ++i) {
-			can->flex_can->MB_8B[i].ID = 0;
-			can->flex_can->MB_8B[i].CS = MB_RX_CS_EMPTY_MUX;
+		for (uint8_t i = 0; i < RX_MAILBOX_COUNT; ++i) {
+			can->flex_can->MB_8B[TX_MAILBOX_COUNT + i].ID = rx_ids[i];
+			can->flex_can->MB_8B[TX_MAILBOX_COUNT + i].CS = rx_css[i];
 		}
 	}
 }
@@ -401,6 +474,10 @@ extern void sc_board_can_reset(uint8_t index)
 	// set rx individual mask to 'don't care'
 	memset((void*)can->flex_can->RXIMR, 0, sizeof(can->flex_can->RXIMR));
 
+	memset(can->rx_filters_std, 0, sizeof(can->rx_filters_std));
+	memset(can->rx_filters_ext, 0, sizeof(can->rx_filters_ext));
+	can->rx_filter = false;
+
 	can_reset_state(index);
 
 	dump_can_regs(index);
@@ -742,6 +819,17 @@ extern void sc_board_can_dt_bit_timing_set(uint8_t index, sc_can_bit_timing cons
 	dump_can_regs(index);
 }
 
+extern void sc_board_can_filter_set(uint8_t index, bool ext, uint8_t element, sc_can_filter const *filter)
+{
+	struct can *can = &cans[index];
+
+	if (ext) {
+		can->rx_filters_ext[element] = *filter;
+	} else {
+		can->rx_filters_std[element] = *filter;
+	}
+}
+
 extern void sc_board_can_go_bus(uint8_t index, bool on)
 {
 	struct can *can = &cans[index];
@@ -806,72 +894,84 @@ SC_RAMFUNC static inline void copy_swap_data_words(volatile uint32_t* dst, volat
 	}
 }
 
-SC_RAMFUNC extern bool sc_board_can_tx_queue(uint8_t index, struct sc_msg_can_tx const * msg)
+SC_RAMFUNC extern uint8_t sc_board_can_tx_queue_n(uint8_t index, struct sc_msg_can_tx const * const *msgs, uint8_t count)
 {
 	struct can *can = &cans[index];
-	struct tx_fifo_element *e = NULL;
 	uint8_t gi = __atomic_load_n(&can->tx_gi, __ATOMIC_ACQUIRE);
 	uint8_t pi = can->tx_pi;
 	uint8_t used = pi - gi;
-	uint8_t mailbox_index = 0;
-	uint32_t id = 0;
-	uint32_t cs = CAN_CS_DLC(msg->dlc) | CAN_CS_SRR_MASK;
-	const unsigned len = dlc_to_len(msg->dlc);
-	unsigned words = len;
+	uint8_t queued = 0;
 
+	count = tu_min8(count, TU_ARRAY_SIZE(can->tx_fifo) - used);
 
-	if (unlikely(used == TU_ARRAY_SIZE(can->tx_fifo))) {
-		return false;
-	}
+	for (; queued < count; ++queued, ++pi) {
+		struct sc_msg_can_tx const *msg = msgs[queued];
+		struct tx_fifo_element *e = NULL;
+		uint8_t mailbox_index = 0;
+		uint32_t id = 0;
+		uint32_t cs = CAN_CS_DLC(msg->dlc) | CAN_CS_SRR_MASK;
+		const unsigned len = dlc_to_len(msg->dlc);
+		unsigned words = len;
 
-	if (words & 3) {
-		words += 4 - (words & 3);
-	}
+		if (words & 3) {
+			words += 4 - (words & 3);
+		}
 
-	words /= 4;
-	// LOG("dlc=%u len=%u words=%u\n", msg->dlc, len, words);
+		words /= 4;
+		// LOG("dlc=%u len=%u words=%u\n", msg->dlc, len, words);
 
 
-	mailbox_index = pi % TU_ARRAY_SIZE(can->tx_fifo);
-	SC_ASSERT(mailbox_index < TU_ARRAY_SIZE(can->tx_fifo));
-	e = &can->tx_fifo[mailbox_index];
-	e->track_id = msg->track_id;
+		mailbox_index = pi % TU_ARRAY_SIZE(can->tx_fifo);
+		SC_ASSERT(mailbox_index < TU_ARRAY_SIZE(can->tx_fifo));
+		e = &can->tx_fifo[mailbox_index];
+		e->track_id = msg->track_id;
 
-	if (can->fd_enabled && (msg->flags & SC_CAN_FRAME_FLAG_FDF)) {
-		copy_swap_data_words(e->box.WORD, (uint32_t*)msg->data, words);
-		e->len = len;
-		cs |= CAN_CS_CODE(MB_TX_DATA) | CAN_CS_EDL_MASK;
-		if (msg->flags & SC_CAN_FRAME_FLAG_BRS) {
-			cs |= CAN_CS_BRS_MASK;
+		if (can->fd_enabled && (msg->flags & SC_CAN_FRAME_FLAG_FDF)) {
+			copy_swap_data_words(e->box.WORD, (uint32_t*)msg->data, words);
+			e->len = len;
+			cs |= CAN_CS_CODE(MB_TX_DATA) | CAN_CS_EDL_MASK;
+			if (msg->flags & SC_CAN_FRAME_FLAG_BRS) {
+				cs |= CAN_CS_BRS_MASK;
+			}
+			if (msg->flags & SC_CAN_FRAME_FLAG_ESI) {
+				cs |= CAN_CS_ESI_MASK;
+			}
+		} else if (unlikely(msg->flags & SC_CAN_FRAME_FLAG_RTR)) {
+			e->len = 0;
+			cs |= CAN_CS_CODE(MB_TX_REMOTE) | CAN_CS_RTR_MASK;
+		} else {
+			copy_swap_data_words(e->box.WORD, (uint32_t*)msg->data, words);
+			e->len = len;
+			cs |= CAN_CS_CODE(MB_TX_DATA);
 		}
-		if (msg->flags & SC_CAN_FRAME_FLAG_ESI) {
-			cs |= CAN_CS_ESI_MASK;
+
+		if (msg->flags & SC_CAN_FRAME_FLAG_EXT) {
+			id = msg->can_id;
+			cs |= CAN_CS_IDE_MASK;
+		} else {
+			id = CAN_ID_STD(msg->can_id);
 		}
-	} else if (unlikely(msg->flags & SC_CAN_FRAME_FLAG_RTR)) {
-		e->len = 0;
-		cs |= CAN_CS_CODE(MB_TX_REMOTE) | CAN_CS_RTR_MASK;
-	} else {
-		copy_swap_data_words(e->box.WORD, (uint32_t*)msg->data, words);
-		e->len = len;
-		cs |= CAN_CS_CODE(MB_TX_DATA);
-	}
 
-	if (msg->flags & SC_CAN_FRAME_FLAG_EXT) {
-		id = msg->can_id;
-		cs |= CAN_CS_IDE_MASK;
-	} else {
-		id = CAN_ID_STD(msg->can_id);
+		e->box.ID = id;
+		e->box.CS = cs;
 	}
 
-	e->box.ID = id;
-	e->box.CS = cs;
+	if (queued) {
+		__atomic_store_n(&can->tx_pi, pi, __ATOMIC_RELEASE);
 
-	__atomic_store_n(&can->tx_pi, pi + 1, __ATOMIC_RELEASE);
+		// trigger interrupt once for all frames
+		NVIC->STIR = can->tx_queue_irq;
+	}
 
-	// trigger interrupt
-	NVIC->STIR = can->tx_queue_irq;
+	return queued;
+}
 
-	return true;
+SC_RAMFUNC extern void sc_board_can_status_fill(uint8_t index, struct sc_msg_can_status *msg)
+{
+	struct can *can = &cans[index];
+
+	msg->rx_fifo_size = (uint8_t)(can->rx_pi - can->rx_gi);
+	msg->tx_fifo_size = (uint8_t)(can->tx_pi - can->tx_gi);
 }
 
 SC_RAMFUNC extern int sc_board_can_retrieve(uint8_t index, uint8_t *tx_ptr, uint8_t *tx_end)
@@ -886,27 +986,20 @@ SC_RAMFUNC extern int sc_board_can_retrieve(uint8_t index, uint8_t *tx_ptr, uint
 		const uint8_t txr_pi = __atomic_load_n(&can->txr_pi, __ATOMIC_ACQUIRE);
 
 		if (txr_pi != txr_gi) {
-			struct sc_msg_can_txr *txr = (struct sc_msg_can_txr *)tx_ptr;
-			have_data_to_send = true;
+			const uint8_t txr_index = txr_gi % TU_ARRAY_SIZE(can->txr_fifo);
+			SC_DEBUG_ASSERT(txr_index < TU_ARRAY_SIZE(can->txr_fifo));
+			struct txr_fifo_element *e = &can->txr_fifo[txr_index];
+			int const bytes = sc_can_txr_place(index, tx_ptr, tx_end, e->track_id, e->flags, e->timestamp_us);
 			// LOG("ch%u have txr\n", index);
 
-			if (tx_ptr + sizeof(*txr) <= tx_end) {
-				const uint8_t txr_index = txr_gi % TU_ARRAY_SIZE(can->txr_fifo);
-				SC_DEBUG_ASSERT(txr_index < TU_ARRAY_SIZE(can->txr_fifo));
-				struct txr_fifo_element *e = &can->txr_fifo[txr_index];
-
+			if (bytes >= 0) {
 				// LOG("ch%u place txr %u\n", index, e->track_id);
-				result += sizeof(*txr);
-				tx_ptr += sizeof(*txr);
-
-				txr->id = SC_MSG_CAN_TXR;
-				txr->len = sizeof(*txr);
-				txr->flags = e->flags;
-				txr->track_id = e->track_id;
-				txr->timestamp_us = e->timestamp_us;
+				result += bytes;
+				tx_ptr += bytes;
 
 				++txr_gi;
 			} else {
+				have_data_to_send = true;
 				break;
 			}
 		} else {
@@ -931,66 +1024,71 @@ SC_RAMFUNC extern int sc_board_can_retrieve(uint8_t index, uint8_t *tx_ptr, uint
 			const uint32_t cs = e->box.CS;
 			const uint8_t dlc = (cs & CAN_CS_DLC_MASK) >> CAN_CS_DLC_SHIFT;
 			const bool rtr = (cs & CAN_CS_RTR_MASK) >> CAN_CS_RTR_SHIFT;
-			const uint8_t can_frame_len = dlc_to_len(dlc);
-			struct sc_msg_can_rx *msg = (struct sc_msg_can_rx *)tx_ptr;
-			uint8_t bytes = sizeof(*msg);
-
-			if (!rtr) {
-				bytes += can_frame_len;
-			}
+			uint8_t can_frame_len = dlc_to_len(dlc);
+			uint32_t id = e->box.ID;
+			uint8_t flags = 0;
+			uint8_t *data = NULL;
+			uint8_t bytes = 0;
+			uint8_t swf = 0;
 
-			// align
-			if (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1)) {
-				bytes += SC_MSG_CAN_LEN_MULTIPLE - (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1));
+			if (cs & CAN_CS_IDE_MASK) {
+				id &= ~CAN_ID_PRIO_MASK;
+				flags |= SC_CAN_FRAME_FLAG_EXT;
+			} else {
+				id &= CAN_ID_STD_MASK;
+				id >>= CAN_ID_STD_SHIFT;
 			}
 
-			if ((size_t)(tx_end - tx_ptr) >= bytes) {
-				uint32_t id = e->box.ID;
-
-				tx_ptr += bytes;
-				result += bytes;
-
-				msg->id = SC_MSG_CAN_RX;
-				msg->len = bytes;
-				msg->dlc = dlc;
-				msg->flags = 0;
+			if (cs & CAN_CS_EDL_MASK) {
+				flags |= SC_CAN_FRAME_FLAG_FDF;
 
-				if (cs & CAN_CS_IDE_MASK) {
-					id &= ~CAN_ID_PRIO_MASK;
-					msg->flags |= SC_CAN_FRAME_FLAG_EXT;
-				} else {
-					id &= CAN_ID_STD_MASK;
-					id >>= CAN_ID_STD_SHIFT;
+				if (cs & CAN_CS_BRS_MASK) {
+					flags |= SC_CAN_FRAME_FLAG_BRS;
 				}
-				msg->can_id = id;
-				msg->timestamp_us = e->timestamp_us;
-				// LOG("ch%u rx ts=%lx\n", index, msg->timestamp_us);
-
-				if (cs & CAN_CS_EDL_MASK) {
-					msg->flags |= SC_CAN_FRAME_FLAG_FDF;
-
-					if (cs & CAN_CS_BRS_MASK) {
-						msg->flags |= SC_CAN_FRAME_FLAG_BRS;
-					}
-
-					if (cs & CAN_CS_ESI_MASK) {
-						msg->flags |= SC_CAN_FRAME_FLAG_ESI;
-					}
 
-					memcpy(msg->data, (void*)e->box.WORD, can_frame_len);
-				} else {
-					if (rtr) {
-						msg->flags |= SC_CAN_FRAME_FLAG_RTR;
-					} else {
-						memcpy(msg->data, (void*)e->box.WORD, can_frame_len);
-					}
+				if (cs & CAN_CS_ESI_MASK) {
+					flags |= SC_CAN_FRAME_FLAG_ESI;
 				}
+			} else if (rtr) {
+				flags |= SC_CAN_FRAME_FLAG_RTR;
+				can_frame_len = 0;
+			}
 
+			swf = sc_can_sw_filter_eval(index, id, flags, e->timestamp_us);
+
+			if (unlikely(swf & SC_SW_FILTER_DROP)) {
+				// dropped by software filter
+				sc_can_sw_filter_commit(index, swf, e->timestamp_us);
+				sc_can_bus_stats_frame(index, id, flags, dlc, false);
 				++rx_gi;
-				// LOG("ch%u placed rx\n", index);
 			} else {
-				// LOG("ch%u full\n", index);
-				break;
+				bytes = sc_can_rx_msg_place(
+					index,
+					can->rx_compact,
+					tx_ptr,
+					tx_end,
+					id,
+					dlc,
+					flags,
+					e->timestamp_us,
+					can_frame_len,
+					&data);
+
+				if (bytes) {
+					tx_ptr += bytes;
+					result += bytes;
+
+					// LOG("ch%u rx ts=%lx\n", index, e->timestamp_us);
+					memcpy(data, (void*)e->box.WORD, can_frame_len);
+					sc_can_sw_filter_commit(index, swf, e->timestamp_us);
+					sc_can_bus_stats_frame(index, id, flags, dlc, false);
+
+					++rx_gi;
+					// LOG("ch%u placed rx\n", index);
+				} else {
+					// LOG("ch%u full\n", index);
+					break;
+				}
 			}
 		} else {
 			break;
@@ -1257,8 +1355,12 @@ SC_RAMFUNC static void can_int_update_status(
 	}
 }
 
+#if SUPERCAN_ISR_CYCLES
+static struct sc_isr_cycles isr_cycles[TU_ARRAY_SIZE(cans)];
+#endif
+
 SC_RAMFUNC static void can_int_rx(
-	uint8_t index, uint32_t* const events, uint32_t tsc)
+	uint8_t index, uint32_t* const events, uint32_t tsc, uint32_t iflag1)
 {
 	const uint16_t TS_WRAP_THRESHOLD = 0x8000;
 	struct can *can = &cans[index];
@@ -1270,29 +1372,55 @@ SC_RAMFUNC static void can_int_rx(
 	uint16_t rx_timestamps[RX_MAILBOX_COUNT];
 	uint8_t rx_indices[RX_MAILBOX_COUNT];
 	uint8_t rx_count = 0;
+#if SUPERCAN_ISR_CYCLES
+	const uint32_t cycles_start = sc_isr_cycles_now();
+#endif
+#if SC_BOARD_CAN_HW_TS
+	// Sample the free running timer right before the 1 MHz counter
+	// to relate mailbox time stamps to the counter. Reading the
+	// timer also releases any mailbox lock, harmless here.
+	const uint16_t timer = can->flex_can->TIMER;
 
-	for (uint32_t i = 0, mask = ((uint32_t)1) << TX_MAILBOX_COUNT, k = TX_MAILBOX_COUNT; i < RX_MAILBOX_COUNT; ++i, ++k, mask <<= 1) {
-		// if (iflag1 & mask) {
+	tsc = GPT2->CNT;
+#endif
+
+	// Only visit mailboxes that flagged a frame. Frames are inserted
+	// in time stamp order as they are collected. Typically there are
+	// one or two, so the cost no longer grows with the mailbox count.
+	//
+	// The filtered scan hasn't been measured on hardware yet. Until it
+	// has, fall back to visiting every rx mailbox if the flags led to
+	// no frame or a mailbox overran.
+	for (uint32_t scan = iflag1 & RX_MAILBOX_MASK; ; scan = RX_MAILBOX_MASK) {
+		rx_count = 0;
+		rx_lost = 0;
+
+		for (uint32_t pending = scan; pending; pending &= pending - 1) {
+			const unsigned k = __builtin_ctz(pending);
 			struct flexcan_mailbox *box = (struct flexcan_mailbox *)(box_mem + step * k);
 			unsigned cs = box->CS;
 			unsigned code = (cs & CAN_CS_CODE_MASK) >> CAN_CS_CODE_SHIFT;
 
 			if (likely(code == MB_RX_FULL || code == MB_RX_OVERRUN)) {
-				rx_indices[rx_count] = k;
-				rx_timestamps[rx_count] = (cs & CAN_CS_TIME_STAMP_MASK) >> CAN_CS_TIME_STAMP_SHIFT;
+				const uint16_t ts = (cs & CAN_CS_TIME_STAMP_MASK) >> CAN_CS_TIME_STAMP_SHIFT;
+				unsigned i = rx_count;
+
+				for (; i > 0 && rx_timestamps[i - 1] > ts; --i) {
+					rx_timestamps[i] = rx_timestamps[i - 1];
+					rx_indices[i] = rx_indices[i - 1];
+				}
+
+				rx_timestamps[i] = ts;
+				rx_indices[i] = k;
 
 				++rx_count;
 				rx_lost += code == MB_RX_OVERRUN;
-
-				// box->CS = CAN_CS_CODE(MB_RX_EMPTY);
 			}
-		// }
+		}
 
-		// struct flexcan_mailbox *box = (struct flexcan_mailbox *)(box_mem + step * k);
-		// unsigned code = (box->CS & CAN_CS_CODE_MASK) >> CAN_CS_CODE_SHIFT;
-		// if (code == MB_RX_FULL || code == MB_RX_OVERRUN) {
-		// 	LOG("rx in mailbox index %u\n", k);
-		// }
+		if (likely(rx_count && !rx_lost) || scan == RX_MAILBOX_MASK) {
+			break;
+		}
 	}
 
 	// LOG("rx count=%u\n", rx_count);
@@ -1300,33 +1428,6 @@ SC_RAMFUNC static void can_int_rx(
 	unsigned rx_end = 0;
 
 	if (unlikely(rx_count > 1)) {
-
-		// LOG("unsorted\n");
-		// for (unsigned i = 0; i < rx_count; ++i) {
-		// 	LOG("bit=%u ts=%x\n", rx_indices[i], rx_timestamps[i]);
-		// }
-
-		// selection sort
-
-		for (unsigned i = 0; i < rx_count; ++i) {
-			unsigned best = i;
-
-			for (unsigned j = i + 1; j < rx_count; ++j) {
-				if (rx_timestamps[j] < rx_timestamps[best]) {
-					best = j;
-				}
-			}
-
-			uint16_t best_ts = rx_timestamps[best];
-			uint8_t best_index = rx_indices[best];
-
-			rx_timestamps[best] = rx_timestamps[i];
-			rx_indices[best] = rx_indices[i];
-
-			rx_timestamps[i] = best_ts;
-			rx_indices[i] = best_index;
-		}
-
 		// LOG("sorted\n");
 		// for (unsigned i = 0; i < rx_count; ++i) {
 		// 	LOG("bit=%u ts=%x\n", rx_indices[i], rx_timestamps[i]);
@@ -1361,12 +1462,18 @@ SC_RAMFUNC static void can_int_rx(
 			uint8_t rx_gi = __atomic_load_n(&can->rx_gi, __ATOMIC_ACQUIRE);
 			uint8_t used = rx_pi - rx_gi;
 
+			const uint32_t cs = box->CS;
+
 			if (likely(used < TU_ARRAY_SIZE(can->rx_fifo))) {
 				const uint8_t rx_fifo_index = rx_pi % TU_ARRAY_SIZE(can->rx_fifo);
 				struct rx_fifo_element *e = &can->rx_fifo[rx_fifo_index];
-				const uint32_t cs = box->CS;
 				const unsigned len = dlc_to_len((cs & CAN_CS_DLC_MASK) >> CAN_CS_DLC_SHIFT);
+#if SC_BOARD_CAN_HW_TS
+				const uint16_t delta_ts = timer - rx_timestamps[rx_index]; // must be in type!
+				(void)rx_end;
+#else
 				const uint16_t delta_ts = rx_timestamps[rx_end] - rx_timestamps[rx_index]; // must be in type!
+#endif
 				unsigned words = len;
 
 				if (words & 3) {
@@ -1389,7 +1496,8 @@ SC_RAMFUNC static void can_int_rx(
 				++rx_lost;
 			}
 
-			box->CS = MB_RX_CS_EMPTY_MUX;
+			// keep IDE, part of the mailbox filter
+			box->CS = MB_RX_CS_EMPTY_MUX | (cs & CAN_CS_IDE_MASK);
 		}
 
 		__atomic_store_n(&can->rx_pi, rx_pi, __ATOMIC_RELEASE);
@@ -1407,6 +1515,10 @@ SC_RAMFUNC static void can_int_rx(
 		sc_can_status_queue(index, &status);
 		++*events;
 	}
+
+#if SUPERCAN_ISR_CYCLES
+	sc_isr_cycles_account(index, &isr_cycles[index], cycles_start, rx_count);
+#endif
 }
 
 SC_RAMFUNC static void can_int(uint8_t index)
@@ -1435,7 +1547,7 @@ SC_RAMFUNC static void can_int(uint8_t index)
 	// if (iflag1 || iflag2) { // rx frames
 	if (iflag1) { // rx frames
 
-		can_int_rx(index, &events, tsc);
+		can_int_rx(index, &events, tsc, iflag1);
 	}
 
 	can_int_update_status(index, &events, tsc);
@@ -1508,6 +1620,9 @@ extern void sc_board_can_feat_set(uint8_t index, uint16_t features)
 {
 	struct can *can = &cans[index];
 
+	can->rx_compact = (features & SC_FEATURE_FLAG_CRX) != 0;
+	can->rx_filter = (features & SC_FEATURE_FLAG_FLT) != 0;
+
 	if (can->fd_capable) {
 		if (features & SC_FEATURE_FLAG_FDF) {
 			LOG("ch%u CAN-FD enabled\n", index);
@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* Software rx filter stage
+ *
+ * Runs in the CAN task before frames are placed into the USB buffer. 11 bit
+ * ids are rejected through a bitmap of the ids covered by active elements,
+ * frames passing the bitmap and all 29 bit frames are matched against the
+ * element ranges for the counters and decimation.
+ *
+ * Boards may evaluate a frame more than once when the USB buffer is full.
+ * Evaluation is therefore free of side effects, counters and decimation
+ * state change only once the frame is placed or dropped.
+ */
+
+#include <string.h>
+
+#include <supercan_debug.h>
+#include <sw_filter.h>
+
+#include <tusb.h>
+
+
+enum {
+	SW_FILTER_STD_IDS = 0x800,
+};
+
+struct sw_filter_element {
+	uint32_t lo;
+	uint32_t hi;
+	uint32_t interval_us;
+	uint32_t last_us;
+	uint16_t hits;
+	uint16_t decimated;
+	bool enabled;
+	bool ext;
+	bool last_valid;
+};
+
+static struct sw_filter {
+	uint32_t std_bitmap[SW_FILTER_STD_IDS / 32];
+	struct sw_filter_element elements[SC_BOARD_CAN_SW_FILTER_COUNT];
+	uint16_t rejected;
+	bool active;
+} sw_filters[SC_BOARD_CAN_COUNT];
+
+
+SC_RAMFUNC static inline void sw_filter_count(uint16_t *counter)
+{
+	if (likely(*counter != UINT16_MAX)) {
+		++*counter;
+	}
+}
+
+SC_RAMFUNC static uint8_t sw_filter_match(struct sw_filter const *f, uint32_t can_id, uint8_t flags, uint32_t timestamp_us)
+{
+	bool const ext = (flags & SC_CAN_FRAME_FLAG_EXT) == SC_CAN_FRAME_FLAG_EXT;
+
+	if (!ext && !(f->std_bitmap[(can_id & (SW_FILTER_STD_IDS-1)) / 32] & (UINT32_C(1) << (can_id & 31)))) {
+		return SC_SW_FILTER_DROP | SC_SW_FILTER_NONE;
+	}
+
+	for (size_t i = 0; i < TU_ARRAY_SIZE(f->elements); ++i) {
+		struct sw_filter_element const *e = &f->elements[i];
+
+		if (!e->enabled || e->ext != ext || can_id - e->lo > e->hi - e->lo) {
+			continue;
+		}
+
+		if (e->interval_us && e->last_valid && timestamp_us - e->last_us < e->interval_us) {
+			return SC_SW_FILTER_DROP | i;
+		}
+
+		return i;
+	}
+
+	return SC_SW_FILTER_DROP | SC_SW_FILTER_NONE;
+}
+
+SC_RAMFUNC extern uint8_t sc_can_sw_filter_eval(uint8_t index, uint32_t can_id, uint8_t flags, uint32_t timestamp_us)
+{
+	struct sw_filter const *f = &sw_filters[index];
+
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(sw_filters));
+
+	if (likely(!f->active)) {
+		return SC_SW_FILTER_NONE;
+	}
+
+	return sw_filter_match(f, can_id, flags, timestamp_us);
+}
+
+SC_RAMFUNC extern void sc_can_sw_filter_commit(uint8_t index, uint8_t result, uint32_t timestamp_us)
+{
+	struct sw_filter *f = &sw_filters[index];
+	uint8_t const i = result & ~SC_SW_FILTER_DROP;
+
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(sw_filters));
+
+	if (SC_SW_FILTER_NONE == i) {
+		if (result & SC_SW_FILTER_DROP) {
+			sw_filter_count(&f->rejected);
+		}
+	} else {
+		struct sw_filter_element *e = &f->elements[i];
+
+		SC_DEBUG_ASSERT(i < TU_ARRAY_SIZE(f->elements));
+
+		if (result & SC_SW_FILTER_DROP) {
+			sw_filter_count(&e->decimated);
+		} else {
+			e->last_us = timestamp_us;
+			e->last_valid = true;
+			sw_filter_count(&e->hits);
+		}
+	}
+}
+
+static void sw_filter_std_bitmap_update(struct sw_filter *f)
+{
+	memset(f->std_bitmap, 0, sizeof(f->std_bitmap));
+
+	for (size_t i = 0; i < TU_ARRAY_SIZE(f->elements); ++i) {
+		struct sw_filter_element const *e = &f->elements[i];
+
+		if (e->enabled && !e->ext) {
+			for (uint32_t id = e->lo; id <= e->hi; ++id) {
+				f->std_bitmap[id / 32] |= UINT32_C(1) << (id & 31);
+			}
+		}
+	}
+}
+
+extern void sc_can_sw_filter_reset(uint8_t index)
+{
+	struct sw_filter *f = &sw_filters[index];
+
+	memset(f, 0, sizeof(*f));
+}
+
+extern void sc_can_sw_filter_enable(uint8_t index, bool on)
+{
+	struct sw_filter *f = &sw_filters[index];
+
+	f->active = on;
+	f->rejected = 0;
+
+	for (size_t i = 0; i < TU_ARRAY_SIZE(f->elements); ++i) {
+		struct sw_filter_element *e = &f->elements[i];
+
+		e->last_valid = false;
+		e->hits = 0;
+		e->decimated = 0;
+	}
+}
+
+extern void sc_can_sw_filter_set(uint8_t index, uint8_t element, struct sc_msg_sw_filter_set const *msg)
+{
+	struct sw_filter *f = &sw_filters[index];
+	struct sw_filter_element *e = &f->elements[element];
+
+	SC_DEBUG_ASSERT(element < TU_ARRAY_SIZE(f->elements));
+	SC_DEBUG_ASSERT(msg->can_id_lo <= msg->can_id_hi);
+
+	memset(e, 0, sizeof(*e));
+	e->lo = msg->can_id_lo;
+	e->hi = msg->can_id_hi;
+	e->interval_us = msg->interval_us;
+	e->enabled = (msg->flags & SC_FILTER_FLAG_ENABLE) == SC_FILTER_FLAG_ENABLE;
+	e->ext = (msg->flags & SC_FILTER_FLAG_EXT) == SC_FILTER_FLAG_EXT;
+
+	sw_filter_std_bitmap_update(f);
+}
+
+extern uint8_t sc_can_sw_filter_status_size(uint8_t index)
+{
+	struct sw_filter const *f = &sw_filters[index];
+
+	if (!f->active) {
+		return 0;
+	}
+
+	return sizeof(struct sc_msg_sw_filter_status) + sizeof(struct sc_sw_filter_counts) * TU_ARRAY_SIZE(f->elements);
+}
+
+extern void sc_can_sw_filter_status_place(uint8_t index, uint8_t *tx_ptr, uint32_t timestamp_us)
+{
+	struct sw_filter *f = &sw_filters[index];
+	struct sc_msg_sw_filter_status *msg = (struct sc_msg_sw_filter_status *)tx_ptr;
+
+	SC_DEBUG_ASSERT(f->active);
+
+	msg->id = SC_MSG_SW_FILTER_STATUS;
+	msg->len = sc_can_sw_filter_status_size(index);
+	msg->count = TU_ARRAY_SIZE(f->elements);
+	msg->unused = 0;
+	msg->timestamp_us = timestamp_us;
+	msg->rejected = f->rejected;
+	msg->unused2 = 0;
+	f->rejected = 0;
+
+	for (size_t i = 0; i < TU_ARRAY_SIZE(f->elements); ++i) {
+		struct sw_filter_element *e = &f->elements[i];
+
+		msg->elements[i].hits = e->hits;
+		msg->elements[i].decimated = e->decimated;
+		e->hits = 0;
+		e->decimated = 0;
+	}
+}
@@ -0,0 +1,331 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* USB start of frame disciplined device time
+ *
+ * Each adapter runs its own 1 MHz counter, which drifts against the
+ * counters of other adapters by tens of ppm. All adapters on a host share
+ * the host controller's frame timing though.
+ *
+ * Once per second the counter is sampled at a start of frame. The frame
+ * index counts 125 us (micro)frames and wraps every 2.048 s. Device time
+ * is kept in phase with that grid, i.e. at the start of frame i the device
+ * time modulo 2.048 s is i * 125 us. The rate of the counter against the
+ * frame rate is low pass filtered. Device time advances at that rate plus
+ * a correction that removes the remaining phase error over a few seconds.
+ *
+ * Device time never goes backwards. Until the first start of frame is seen
+ * the counter is sampled every TIMEBASE_LOCK_RETRY_MS. The first lock steps
+ * device time forward onto the grid, by up to 2.048 s. After that phase
+ * errors are only slewed, large ones (bus suspended) at TIMEBASE_RATE_MAX.
+ *
+ * Device times of adapters on the same host thus agree to within the
+ * sampling error modulo 2.048 s.
+ *
+ * sc_timebase_map is called from the CAN tasks. The timebase task runs at
+ * the lowest priority and publishes the model through a ring of slots and
+ * a sequence counter so readers never wait on the writer. Each model takes
+ * over at its base counter value. Counter values captured before that are
+ * mapped with the previous model, so a frame gets the same device time no
+ * matter when it is placed. The model carries the last start of frame
+ * sample for SC_MSG_TIME_SYNC, the CAN tasks never wait for a frame
+ * boundary themselves.
+ */
+
+#include <supercan_debug.h>
+#include <timebase.h>
+
+#include <tusb.h>
+
+
+enum {
+	TIMEBASE_INTERVAL_MS = 1000,
+	TIMEBASE_LOCK_RETRY_MS = 10,
+	TIMEBASE_FRAME_INDEX_MASK = 0x3fff,
+	TIMEBASE_FRAME_INDEX_US = 125,
+	TIMEBASE_PERIOD_US = (TIMEBASE_FRAME_INDEX_MASK + 1) * TIMEBASE_FRAME_INDEX_US,
+	TIMEBASE_SAMPLE_TIMEOUT_US = 2000,
+	TIMEBASE_SAMPLE_WINDOW_MAX_US = 16,
+	TIMEBASE_SLEW_US = 8000000, // phase errors are removed over this time
+	TIMEBASE_FREQ_FILTER_SHIFT = 3,
+	// power of two so the sequence counter wraps cleanly, the writer
+	// fills the slot after the current one and leaves the previous intact
+	TIMEBASE_MODEL_COUNT = 4,
+};
+
+/* 2^32 / 1e6 */
+#define TIMEBASE_PPM 4295
+#define TIMEBASE_RATE_MAX (500 * TIMEBASE_PPM)
+
+struct timebase_model {
+	uint32_t base_counter_us;
+	uint32_t base_us;
+	uint32_t base_us_hi; // wraps of the 32 bit device time at base_us
+	int32_t rate; // (device time / counter time - 1) * 2^32
+	uint32_t sof_counter_us; // counter at the start of sof_frame_index
+	uint16_t sof_frame_index;
+	bool sof_valid;
+};
+
+static struct timebase {
+	struct timebase_model models[TIMEBASE_MODEL_COUNT];
+	uint64_t device_us; // device time at last sample, 64 bit to keep the grid and count wraps
+	uint32_t seq; // NOT an index, uses full range of type
+	uint32_t prev_counter_us;
+	int32_t freq; // filtered rate of the counter against the frame rate, unit of rate
+	uint16_t prev_frame_index;
+	bool prev_valid;
+	bool freq_valid;
+	bool locked;
+} tb;
+
+StackType_t sc_timebase_task_stack[SC_TIMEBASE_STACK_SIZE];
+StaticTask_t sc_timebase_task_mem;
+
+
+/* Reads the counter along with the frame index.
+ *
+ * The counter read is a request / wait pair on some boards, which the CAN
+ * interrupts also use. Interrupts are masked so neither interleaves.
+ */
+static inline uint32_t timebase_counter(uint16_t *frame_index)
+{
+	uint32_t counter_us = 0;
+
+	taskENTER_CRITICAL();
+	*frame_index = sc_board_usb_frame_index();
+	sc_board_can_ts_request(0);
+	counter_us = sc_board_can_ts_wait(0);
+	taskEXIT_CRITICAL();
+
+	return counter_us;
+}
+
+SC_RAMFUNC static inline uint32_t timebase_model_map(struct timebase_model const *m, uint32_t counter_us)
+{
+	// signed, counter values may have been taken before the last update
+	int32_t const delta = (int32_t)(counter_us - m->base_counter_us);
+
+	return m->base_us + (uint32_t)delta + (uint32_t)(int32_t)(((int64_t)delta * m->rate) >> 32);
+}
+
+SC_RAMFUNC static inline struct timebase_model *timebase_model_slot(uint32_t seq)
+{
+	return &tb.models[seq & (TIMEBASE_MODEL_COUNT-1)];
+}
+
+SC_RAMFUNC extern uint32_t sc_timebase_map(uint32_t counter_us)
+{
+	struct timebase_model m;
+	uint32_t seq = 0;
+
+	do {
+		seq = __atomic_load_n(&tb.seq, __ATOMIC_ACQUIRE);
+		m = *timebase_model_slot(seq);
+
+		// captured before the current model took over
+		if (unlikely((int32_t)(counter_us - m.base_counter_us) < 0)) {
+			m = *timebase_model_slot(seq - 1);
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (unlikely(seq != __atomic_load_n(&tb.seq, __ATOMIC_RELAXED)));
+
+	return timebase_model_map(&m, counter_us);
+}
+
+SC_RAMFUNC extern uint64_t sc_timebase_extend(uint32_t timestamp_us)
+{
+	struct timebase_model m;
+	uint32_t seq = 0;
+
+	do {
+		seq = __atomic_load_n(&tb.seq, __ATOMIC_ACQUIRE);
+		m = *timebase_model_slot(seq);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (unlikely(seq != __atomic_load_n(&tb.seq, __ATOMIC_RELAXED)));
+
+	return ((((uint64_t)m.base_us_hi) << 32) | m.base_us) + (int64_t)(int32_t)(timestamp_us - m.base_us);
+}
+
+SC_RAMFUNC extern bool sc_timebase_sof(uint16_t *frame_index, uint32_t *timestamp_us)
+{
+	struct timebase_model m;
+	uint32_t seq = 0;
+
+	do {
+		seq = __atomic_load_n(&tb.seq, __ATOMIC_ACQUIRE);
+		m = *timebase_model_slot(seq);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (unlikely(seq != __atomic_load_n(&tb.seq, __ATOMIC_RELAXED)));
+
+	*frame_index = m.sof_frame_index;
+	*timestamp_us = timebase_model_map(&m, m.sof_counter_us);
+
+	return m.sof_valid;
+}
+
+/* Samples the counter at the next start of frame, busy waits up to two frames.
+ *
+ * return  true if the counter value is within a few us of the start of frame_index,
+ *         false if no frame boundary was seen or the sample was disturbed
+ */
+static bool timebase_sof_sample(uint16_t *frame_index, uint32_t *counter_us)
+{
+	uint16_t start_index = 0;
+	uint32_t const start_us = timebase_counter(&start_index);
+	uint32_t before_us = start_us;
+
+	for (;;) {
+		uint16_t index = 0;
+		uint32_t const after_us = timebase_counter(&index);
+
+		if (index != start_index) {
+			// start of frame after the previous read of the frame index
+			*frame_index = index;
+			*counter_us = before_us + (after_us - before_us) / 2;
+
+			return after_us - before_us <= TIMEBASE_SAMPLE_WINDOW_MAX_US;
+		}
+
+		if (after_us - start_us >= TIMEBASE_SAMPLE_TIMEOUT_US) {
+			*frame_index = index;
+			*counter_us = after_us;
+
+			return false;
+		}
+
+		before_us = after_us;
+	}
+}
+
+static inline void timebase_publish(void)
+{
+	__atomic_store_n(&tb.seq, tb.seq + 1, __ATOMIC_RELEASE);
+}
+
+/* keeps the model close to the counter so the mapping doesn't overflow */
+static void timebase_rebase(uint16_t frame_index, uint32_t counter_us)
+{
+	struct timebase_model const *cur = timebase_model_slot(tb.seq);
+	struct timebase_model *next = timebase_model_slot(tb.seq + 1);
+
+	next->base_us = timebase_model_map(cur, counter_us);
+	next->base_counter_us = counter_us;
+	tb.device_us += (uint32_t)(next->base_us - (uint32_t)tb.device_us);
+	next->base_us_hi = (uint32_t)(tb.device_us >> 32);
+	next->rate = cur->rate;
+	next->sof_counter_us = counter_us;
+	next->sof_frame_index = frame_index;
+	next->sof_valid = false;
+
+	timebase_publish();
+}
+
+static void timebase_update(uint16_t frame_index, uint32_t counter_us)
+{
+	struct timebase_model const *cur = timebase_model_slot(tb.seq);
+	struct timebase_model *next = timebase_model_slot(tb.seq + 1);
+	uint32_t const now_us = timebase_model_map(cur, counter_us);
+	int32_t phase_us = 0;
+	int64_t rate = 0;
+
+	frame_index &= TIMEBASE_FRAME_INDEX_MASK;
+	tb.device_us += (uint32_t)(now_us - (uint32_t)tb.device_us);
+
+	// device time the start of frame should have, nearest on the grid
+	phase_us = (int32_t)(frame_index * TIMEBASE_FRAME_INDEX_US) - (int32_t)(tb.device_us % TIMEBASE_PERIOD_US);
+
+	if (phase_us > TIMEBASE_PERIOD_US / 2) {
+		phase_us -= TIMEBASE_PERIOD_US;
+	} else if (phase_us < -(TIMEBASE_PERIOD_US / 2)) {
+		phase_us += TIMEBASE_PERIOD_US;
+	}
+
+	if (tb.prev_valid) {
+		uint32_t const counter_delta_us = counter_us - tb.prev_counter_us;
+		uint32_t const frame_delta_us = ((frame_index - tb.prev_frame_index) & TIMEBASE_FRAME_INDEX_MASK) * TIMEBASE_FRAME_INDEX_US;
+
+		// frame index unambiguous?
+		if (counter_delta_us && counter_delta_us < TIMEBASE_PERIOD_US - TIMEBASE_PERIOD_US / 8) {
+			int64_t const measured = ((int64_t)((int32_t)(frame_delta_us - counter_delta_us)) << 32) / counter_delta_us;
+
+			if (measured >= -TIMEBASE_RATE_MAX && measured <= TIMEBASE_RATE_MAX) {
+				if (likely(tb.freq_valid)) {
+					tb.freq += ((int32_t)measured - tb.freq) >> TIMEBASE_FREQ_FILTER_SHIFT;
+				} else {
+					tb.freq = (int32_t)measured;
+					tb.freq_valid = true;
+				}
+			}
+		}
+	}
+
+	tb.prev_counter_us = counter_us;
+	tb.prev_frame_index = frame_index;
+	tb.prev_valid = true;
+
+	next->base_counter_us = counter_us;
+
+	if (unlikely(!tb.locked)) {
+		// forward onto the grid, device time must not go backwards
+		if (phase_us < 0) {
+			phase_us += TIMEBASE_PERIOD_US;
+		}
+
+		LOG("timebase lock, step %ld us\n", (long)phase_us);
+		tb.locked = true;
+		tb.device_us += phase_us;
+		next->base_us = now_us + phase_us;
+		rate = tb.freq;
+	} else {
+		next->base_us = now_us;
+		rate = tb.freq + (((int64_t)phase_us << 32) / TIMEBASE_SLEW_US);
+	}
+
+	if (rate > TIMEBASE_RATE_MAX) {
+		rate = TIMEBASE_RATE_MAX;
+	} else if (rate < -TIMEBASE_RATE_MAX) {
+		rate = -TIMEBASE_RATE_MAX;
+	}
+
+	next->base_us_hi = (uint32_t)(tb.device_us >> 32);
+	next->rate = (int32_t)rate;
+	next->sof_counter_us = counter_us;
+	next->sof_frame_index = frame_index;
+	next->sof_valid = true;
+
+	timebase_publish();
+}
+
+extern void sc_timebase_task(void *param)
+{
+	(void)param;
+
+	while (42) {
+		uint16_t frame_index = 0;
+		uint32_t counter_us = 0;
+		bool sampled = false;
+
+		if (likely(tb.locked || tud_mounted())) {
+			sampled = timebase_sof_sample(&frame_index, &counter_us);
+		} else {
+			// no frames yet, don't busy wait for them
+			counter_us = timebase_counter(&frame_index);
+		}
+
+		if (sampled) {
+			timebase_update(frame_index, counter_us);
+		} else {
+			// rate is measured between consecutive samples only
+			tb.prev_valid = false;
+			timebase_rebase(frame_index, counter_us);
+		}
+
+		// lock as soon as frames start, ideally before the first CAN frame is timestamped
+		vTaskDelay(pdMS_TO_TICKS(tb.locked ? TIMEBASE_INTERVAL_MS : TIMEBASE_LOCK_RETRY_MS));
+	}
+}
@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright (c) 2023 Jean Gressmann <jean@0x42.de>
+ *
+ */
+
+/* Cyclic tx message generators
+ *
+ * Runs in the CAN task. Due times are kept in the timestamp domain of the
+ * channel and advance by the period, so late releases don't accumulate.
+ */
+
+#include <string.h>
+
+#include <supercan_debug.h>
+#include <tx_gen.h>
+
+#include <tusb.h>
+
+
+struct tx_gen_element {
+	uint32_t period_us;
+	uint32_t phase_us;
+	uint32_t due_us;
+	uint16_t count;
+	uint16_t periods;
+	uint8_t burst;
+	uint8_t burst_left;
+	uint8_t counter;
+	uint8_t counter_offset;
+	uint8_t checksum_offset;
+	uint8_t flags;
+	bool armed;
+	union {
+		struct sc_msg_can_tx msg;
+		uint8_t buffer[sizeof(struct sc_msg_can_tx) + SC_CAN_GEN_DATA_MAX];
+	} tx;
+};
+
+static struct tx_gen {
+	struct tx_gen_element elements[SC_BOARD_CAN_GEN_COUNT];
+	bool active;
+} tx_gens[SC_BOARD_CAN_COUNT];
+
+
+SC_RAMFUNC static inline void tx_gen_payload_update(struct tx_gen_element *e)
+{
+	uint8_t * const data = e->tx.msg.data;
+
+	if (e->flags & SC_GEN_FLAG_COUNTER) {
+		data[e->counter_offset] = e->counter;
+	}
+
+	if (e->flags & SC_GEN_FLAG_CHECKSUM) {
+		uint8_t const len = dlc_to_len(e->tx.msg.dlc);
+		uint8_t sum = 0;
+
+		for (uint8_t i = 0; i < len; ++i) {
+			if (i != e->checksum_offset) {
+				sum += data[i];
+			}
+		}
+
+		data[e->checksum_offset] = sum;
+	}
+}
+
+SC_RAMFUNC extern uint32_t sc_can_gen_run(uint8_t index, uint32_t now_us)
+{
+	struct tx_gen *g = &tx_gens[index];
+	uint32_t wait_us = SC_TS_MAX;
+
+	SC_DEBUG_ASSERT(index < TU_ARRAY_SIZE(tx_gens));
+
+	for (size_t i = 0; i < TU_ARRAY_SIZE(g->elements); ++i) {
+		struct tx_gen_element *e = &g->elements[i];
+
+		if (!(e->flags & SC_GEN_FLAG_ENABLE)) {
+			continue;
+		}
+
+		if (unlikely(!e->armed)) {
+			e->armed = true;
+			e->due_us = now_us + e->phase_us;
+			e->burst_left = e->burst;
+			e->periods = 0;
+		}
+
+		if ((int32_t)(now_us - e->due_us) >= 0) {
+			while (e->burst_left) {
+				tx_gen_payload_update(e);
+
+				if (unlikely(!sc_board_can_tx_queue(index, &e->tx.msg))) {
+					break;
+				}
+
+				sc_can_bus_stats_frame(index, e->tx.msg.can_id, e->tx.msg.flags, e->tx.msg.dlc, true);
+
+				++e->counter;
+				--e->burst_left;
+			}
+
+			if (e->burst_left) {
+				// tx fifo full, retry
+				wait_us = 0;
+				continue;
+			}
+
+			if (e->count && ++e->periods == e->count) {
+				e->flags &= ~SC_GEN_FLAG_ENABLE;
+				continue;
+			}
+
+			e->burst_left = e->burst;
+			e->due_us += e->period_us;
+
+			if ((int32_t)(now_us - e->due_us) >= 0) {
+				// fell behind, skip missed periods instead of sending a burst
+				e->due_us += ((now_us - e->due_us) / e->period_us + 1) * e->period_us;
+			}
+		}
+
+		wait_us = tu_min32(wait_us, e->due_us - now_us);
+	}
+
+	return wait_us;
+}
+
+extern bool sc_can_gen_active(uint8_t index)
+{
+	return tx_gens[index].active;
+}
+
+extern void sc_can_gen_reset(uint8_t index)
+{
+	struct tx_gen *g = &tx_gens[index];
+
+	memset(g, 0, sizeof(*g));
+}
+
+extern void sc_can_gen_enable(uint8_t index, bool on)
+{
+	struct tx_gen *g = &tx_gens[index];
+
+	g->active = on;
+
+	for (size_t i = 0; i < TU_ARRAY_SIZE(g->elements); ++i) {
+		struct tx_gen_element *e = &g->elements[i];
+
+		e->armed = false;
+		e->counter = 0;
+	}
+}
+
+extern void sc_can_gen_set(uint8_t index, struct sc_msg_gen_set const *msg)
+{
+	struct tx_gen *g = &tx_gens[index];
+	struct tx_gen_element *e = &g->elements[msg->index];
+
+	SC_DEBUG_ASSERT(msg->index < TU_ARRAY_SIZE(g->elements));
+	SC_DEBUG_ASSERT(msg->period_us);
+	SC_DEBUG_ASSERT(msg->burst);
+
+	memset(e, 0, sizeof(*e));
+	e->period_us = msg->period_us;
+	e->phase_us = msg->phase_us;
+	e->count = msg->count;
+	e->burst = msg->burst;
+	e->counter_offset = msg->counter_offset;
+	e->checksum_offset = msg->checksum_offset;
+	e->flags = msg->flags;
+
+	uint8_t bytes = sizeof(e->tx.msg);
+
+	if (!(msg->can_flags & SC_CAN_FRAME_FLAG_RTR)) {
+		bytes += dlc_to_len(msg->dlc);
+	}
+
+	if (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1)) {
+		bytes += SC_MSG_CAN_LEN_MULTIPLE - (bytes & (SC_MSG_CAN_LEN_MULTIPLE-1));
+	}
+
+	e->tx.msg.id = SC_MSG_CAN_TX;
+	e->tx.msg.len = bytes;
+	e->tx.msg.dlc = msg->dlc;
+	e->tx.msg.flags = msg->can_flags;
+	e->tx.msg.can_id = msg->can_id;
+	e->tx.msg.track_id = msg->track_id;
+}
+
+extern void sc_can_gen_data(uint8_t index, struct sc_msg_gen_data const *msg)
+{
+	struct tx_gen *g = &tx_gens[index];
+	struct tx_gen_element *e = &g->elements[msg->index];
+	uint8_t const bytes = msg->len - sizeof(*msg);
+
+	SC_DEBUG_ASSERT(msg->index < TU_ARRAY_SIZE(g->elements));
+	SC_DEBUG_ASSERT(msg->offset + bytes <= SC_CAN_GEN_DATA_MAX);
+
+	memcpy(&e->tx.msg.data[msg->offset], msg->data, bytes);
+}
@@ -151,6 +151,9 @@
 #elif TU_CHECK_MCU(GD32VF103)
   #define DCD_ATTR_ENDPOINT_MAX   4
 
+//------------- Provided by the build, e.g. a host simulation -------------//
+#elif defined(DCD_ATTR_ENDPOINT_MAX)
+
 #else
   #warning "DCD_ATTR_ENDPOINT_MAX is not defined for this MCU, default to 8"
   #define DCD_ATTR_ENDPOINT_MAX   8